@@ -72,10 +72,11 @@ void Application::Initialize() {
     auto codec = board.GetAudioCodec();
     audio_service_.Initialize(codec);
     audio_service_.Start();
+    audio_sender_.Start();
 
     AudioServiceCallbacks callbacks;
     callbacks.on_send_queue_available = [this]() {
-        xEventGroupSetBits(event_group_, MAIN_EVENT_SEND_AUDIO);
+        audio_sender_.Notify();
     };
     callbacks.on_wake_word_detected = [this](const std::string& wake_word) {
         xEventGroupSetBits(event_group_, MAIN_EVENT_WAKE_WORD_DETECTED);
@@ -166,7 +167,6 @@ void Application::Initialize() {
 void Application::Run() {
     const EventBits_t ALL_EVENTS = 
         MAIN_EVENT_SCHEDULE |
-        MAIN_EVENT_SEND_AUDIO |
         MAIN_EVENT_WAKE_WORD_DETECTED |
         MAIN_EVENT_VAD_CHANGE |
         MAIN_EVENT_CLOCK_TICK |
@@ -215,14 +215,6 @@ void Application::Run() {
             HandleStopListeningEvent();
         }
 
-        if (bits & MAIN_EVENT_SEND_AUDIO) {
-            while (auto packet = audio_service_.PopPacketFromSendQueue()) {
-                if (protocol_ && !protocol_->SendAudio(std::move(packet))) {
-                    break;
-                }
-            }
-        }
-
         if (bits & MAIN_EVENT_WAKE_WORD_DETECTED) {
             HandleWakeWordDetectedEvent();
         }
@@ -251,6 +243,7 @@ void Application::Run() {
             // Print debug info every 10 seconds
             if (clock_ticks_ % 10 == 0) {
                 SystemInfo::PrintHeapStats();
+                PrintAudioStats();
             }
         }
     }
@@ -466,6 +459,29 @@ void Application::CheckNewVersion() {
     }
 }
 
+AudioStreamParams Application::GetPreferredAudioParams() {
+    AudioStreamParams params;
+#if CONFIG_UPLINK_AUDIO_MODE_20MS
+    params.frame_duration = 20;
+#elif CONFIG_UPLINK_AUDIO_MODE_AUTO
+    // Low latency on Wi-Fi, fewer packets (less header overhead) on cellular
+    params.frame_duration = Board::GetInstance().GetBoardType() == "ml307" ? 60 : 20;
+#endif
+
+    Settings settings("audio", false);
+    int frame_duration = settings.GetInt("frame_duration", params.frame_duration);
+    if (frame_duration == 20 || frame_duration == 40 || frame_duration == 60) {
+        params.frame_duration = frame_duration;
+    }
+    int complexity = settings.GetInt("complexity", params.complexity);
+    if (complexity >= 0 && complexity <= 10) {
+        params.complexity = complexity;
+    } else {
+        ESP_LOGW(TAG, "Invalid audio complexity setting: %d", complexity);
+    }
+    return params;
+}
+
 void Application::InitializeProtocol() {
     auto& board = Board::GetInstance();
     auto display = board.GetDisplay();
@@ -473,6 +489,8 @@ void Application::InitializeProtocol() {
 
     display->SetStatus(Lang::Strings::LOADING_PROTOCOL);
 
+    // The send task must not be using the protocol that is replaced
+    audio_sender_.SetProtocol(nullptr);
     if (ota_->HasMqttConfig()) {
         protocol_ = std::make_unique<MqttProtocol>();
     } else if (ota_->HasWebsocketConfig()) {
@@ -482,6 +500,10 @@ void Application::InitializeProtocol() {
         protocol_ = std::make_unique<MqttProtocol>();
     }
 
+    protocol_->SetPreferredAudioParams(GetPreferredAudioParams());
+    protocol_->SetIncomingPacketPool(audio_service_.GetIncomingPacketPool());
+    audio_sender_.SetProtocol(protocol_.get());
+
     protocol_->OnConnected([this]() {
         DismissAlert();
     });
@@ -493,12 +515,13 @@ void Application::InitializeProtocol() {
     
     protocol_->OnIncomingAudio([this](std::unique_ptr<AudioStreamPacket> packet) {
         if (GetDeviceState() == kDeviceStateSpeaking) {
-            audio_service_.PushPacketToDecodeQueue(std::move(packet));
+            audio_service_.PushPacketToJitterBuffer(std::move(packet));
         }
     });
     
     protocol_->OnAudioChannelOpened([this, codec, &board]() {
         board.SetPowerSaveLevel(PowerSaveLevel::PERFORMANCE);
+        audio_service_.SetStreamParams(protocol_->audio_params());
         if (protocol_->server_sample_rate() != codec->output_sample_rate()) {
             ESP_LOGW(TAG, "Server sample rate %d does not match device output sample rate %d, resampling may cause distortion",
                 protocol_->server_sample_rate(), codec->output_sample_rate());
@@ -774,7 +797,7 @@ void Application::HandleWakeWordDetectedEvent() {
 #if CONFIG_SEND_WAKE_WORD_DATA
         // Encode and send the wake word data to the server
         while (auto packet = audio_service_.PopWakeWordPacket()) {
-            protocol_->SendAudio(std::move(packet));
+            audio_sender_.Send(std::move(packet));
         }
         // Set the chat state to wake word detected
         protocol_->SendWakeWordDetected(wake_word);
@@ -801,12 +824,18 @@ void Application::HandleStateChangedEvent() {
     auto display = board.GetDisplay();
     auto led = board.GetLed();
     led->OnStateChanged();
-    
+
+    // The reply is over when the device stops speaking, entering kDeviceStateSpeaking starts a new stream
+    if (new_state != kDeviceStateSpeaking) {
+        audio_service_.EndIncomingStream();
+    }
+
     switch (new_state) {
         case kDeviceStateUnknown:
         case kDeviceStateIdle:
             display->SetStatus(Lang::Strings::STANDBY);
             display->SetEmotion("neutral");
+            display->EndChatReply();
             audio_service_.EnableVoiceProcessing(false);
             audio_service_.EnableWakeWordDetection(true);
             break;
@@ -818,6 +847,7 @@ void Application::HandleStateChangedEvent() {
         case kDeviceStateListening:
             display->SetStatus(Lang::Strings::LISTENING);
             display->SetEmotion("neutral");
+            display->EndChatReply();
 
             // Make sure the audio processor is running
             if (!audio_service_.IsAudioProcessorRunning()) {
@@ -874,12 +904,49 @@ void Application::SetListeningMode(ListeningMode mode) {
     SetDeviceState(kDeviceStateListening);
 }
 
+cJSON* Application::GetAudioLinkStatusJson() {
+    if (!protocol_ || !protocol_->HasAudioTransportStats()) {
+        return nullptr;
+    }
+    auto stats = protocol_->GetAudioTransportStats();
+    auto link = cJSON_CreateObject();
+    cJSON_AddNumberToObject(link, "received", stats.received);
+    cJSON_AddNumberToObject(link, "lost", stats.lost);
+    cJSON_AddNumberToObject(link, "duplicates", stats.duplicates);
+    cJSON_AddNumberToObject(link, "reordered", stats.reordered);
+    cJSON_AddNumberToObject(link, "late", stats.late);
+    cJSON_AddNumberToObject(link, "jitter_ms", stats.jitter_us / 1000);
+    return link;
+}
+
+void Application::PrintAudioStats() {
+    auto pool = audio_service_.GetIncomingPacketPoolStatistics();
+    if (pool.packets_min_free < pool.packets_total) {
+        ESP_LOGI(TAG, "Downlink packets: free %u/%u (min %u), allocations %u",
+            (unsigned)pool.packets_free, (unsigned)pool.packets_total,
+            (unsigned)pool.packets_min_free, (unsigned)pool.fallback_allocations);
+    }
+
+    auto stats = audio_sender_.GetStats();
+    if (stats.batches == 0) {
+        return;
+    }
+    ESP_LOGI(TAG, "Uplink: sent %u failed %u, latency avg %u max %u us, write avg %u max %u us, "
+        "batch max %u, queue max %u/%u, encoder waits %u",
+        (unsigned)stats.packets, (unsigned)stats.failures,
+        (unsigned)stats.latency.average_us(), (unsigned)stats.latency.max_us,
+        (unsigned)stats.write.average_us(), (unsigned)stats.write.max_us,
+        (unsigned)stats.max_batch, (unsigned)stats.queue.high_watermark, (unsigned)stats.queue.capacity,
+        (unsigned)stats.queue.producer_waits);
+}
+
 void Application::Reboot() {
     ESP_LOGI(TAG, "Rebooting...");
     // Disconnect the audio channel
     if (protocol_ && protocol_->IsAudioChannelOpened()) {
         protocol_->CloseAudioChannel();
     }
+    audio_sender_.SetProtocol(nullptr);
     protocol_.reset();
     audio_service_.Stop();
 
@@ -961,7 +1028,7 @@ void Application::WakeWordInvoke(const std::string& wake_word) {
 #if CONFIG_USE_AFE_WAKE_WORD || CONFIG_USE_CUSTOM_WAKE_WORD
         // Encode and send the wake word data to the server
         while (auto packet = audio_service_.PopWakeWordPacket()) {
-            protocol_->SendAudio(std::move(packet));
+            audio_sender_.Send(std::move(packet));
         }
         // Set the chat state to wake word detected
         protocol_->SendWakeWordDetected(wake_word);
@@ -1002,7 +1069,7 @@ bool Application::CanEnterSleepMode() {
     return true;
 }
 
-void Application::SendMcpMessage(const std::string& payload) {
+void Application::SendMcpMessage(std::string payload) {
     // Always schedule to run in main task for thread safety
     Schedule([this, payload = std::move(payload)]() {
         if (protocol_) {
@@ -1011,6 +1078,19 @@ void Application::SendMcpMessage(const std::string& payload) {
     });
 }
 
+void Application::SendMcpMessage(std::string payload, std::string attachment) {
+    Schedule([this, payload = std::move(payload), attachment = std::move(attachment)]() {
+        if (!protocol_ || protocol_->SendMcpAttachment(payload, attachment)) {
+            return;
+        }
+        // Retry with the attachment embedded as base64 while the channel is still open
+        ESP_LOGW(TAG, "Failed to send MCP message with a %u byte attachment", (unsigned)attachment.size());
+        if (!protocol_->IsAudioChannelOpened() || !protocol_->Protocol::SendMcpAttachment(payload, attachment)) {
+            ESP_LOGE(TAG, "Failed to send MCP message");
+        }
+    });
+}
+
 void Application::SetAecMode(AecMode mode) {
     aec_mode_ = mode;
     Schedule([this]() {
@@ -1049,6 +1129,7 @@ void Application::ResetProtocol() {
             protocol_->CloseAudioChannel();
         }
         // Reset protocol
+        audio_sender_.SetProtocol(nullptr);
         protocol_.reset();
     });
 }
@@ -14,12 +14,12 @@
 #include "protocol.h"
 #include "ota.h"
 #include "audio_service.h"
+#include "audio_sender.h"
 #include "device_state.h"
 #include "device_state_machine.h"
 
 // Main event bits
 #define MAIN_EVENT_SCHEDULE             (1 << 0)
-#define MAIN_EVENT_SEND_AUDIO           (1 << 1)
 #define MAIN_EVENT_WAKE_WORD_DETECTED   (1 << 2)
 #define MAIN_EVENT_VAD_CHANGE           (1 << 3)
 #define MAIN_EVENT_ERROR                (1 << 4)
@@ -107,11 +107,22 @@ public:
     void WakeWordInvoke(const std::string& wake_word);
     bool UpgradeFirmware(const std::string& url, const std::string& version = "");
     bool CanEnterSleepMode();
-    void SendMcpMessage(const std::string& payload);
+    void SendMcpMessage(std::string payload);
+    // Sends an MCP message whose content refers to the attachment, see BINARY_PROTOCOL_TYPE_MCP.
+    // The attachment is embedded as base64 when the transport cannot carry it.
+    void SendMcpMessage(std::string payload, std::string attachment);
     void SetAecMode(AecMode mode);
     AecMode GetAecMode() const { return aec_mode_; }
     void PlaySound(const std::string_view& sound);
     AudioService& GetAudioService() { return audio_service_; }
+    AudioSenderStats GetAudioSendStatistics() const { return audio_sender_.GetStats(); }
+
+    /**
+     * Receive quality of the current or last audio session, for the device status
+     * Returns nullptr before the protocol is up or when it keeps no receive statistics,
+     * the caller owns the object
+     */
+    cJSON* GetAudioLinkStatusJson();
     
     /**
      * Reset protocol resources (thread-safe)
@@ -134,6 +145,7 @@ private:
     AecMode aec_mode_ = kAecOff;
     std::string last_error_message_;
     AudioService audio_service_;
+    AudioSender audio_sender_{audio_service_};
     std::unique_ptr<Ota> ota_;
 
     bool has_server_time_ = false;
@@ -159,10 +171,12 @@ private:
 
     // Helper methods
     void CheckAssetsVersion();
+    void PrintAudioStats();
     void CheckNewVersion();
     void InitializeProtocol();
     void ShowActivationCode(const std::string& code, const std::string& message);
     void SetListeningMode(ListeningMode mode);
+    AudioStreamParams GetPreferredAudioParams();
     
     // State change handler called by state machine
     void OnStateChanged(DeviceState old_state, DeviceState new_state);
@@ -1,5 +1,7 @@
 #include "assets.h"
 #include "board.h"
+#include "flash_stream_writer.h"
+#include "settings.h"
 #include "display.h"
 #include "application.h"
 #include "lvgl_theme.h"
@@ -11,11 +13,20 @@
 #include <esp_log.h>
 #include <spi_flash_mmap.h>
 #include <esp_timer.h>
+#include <esp_rom_crc.h>
 #include <cbin_font.h>
+#include <algorithm>
+#include <cstring>
 
 
 #define TAG "Assets"
 
+// 下载时网络与 flash 之间的缓冲块
+#define ASSETS_DOWNLOAD_CHUNK_SIZE (16 * 1024)
+#define ASSETS_DOWNLOAD_CHUNK_COUNT 3
+// 连续多少次断线未取得进展后放弃
+#define ASSETS_DOWNLOAD_MAX_RETRIES 5
+
 struct mmap_assets_table {
     char asset_name[32];          /*!< Name of the asset */
     uint32_t asset_size;          /*!< Size of the asset */
@@ -24,6 +35,15 @@ struct mmap_assets_table {
     uint16_t asset_height;        /*!< Height of the asset */
 };
 
+// Optional trailer after the data, 4-byte aligned, older firmware ignores it
+struct mmap_assets_trailer {
+    char magic[4];                /*!< "ZZCK" */
+    uint32_t version;             /*!< Version of the trailer */
+    uint32_t length;              /*!< Length of the table and data it covers */
+    uint32_t crc32;               /*!< CRC32 of the table and data */
+    /* Followed by the CRC32 of every asset in table order, without its magic */
+};
+
 
 Assets::Assets() {
     // Initialize the partition
@@ -37,17 +57,59 @@ Assets::~Assets() {
 }
 
 uint32_t Assets::CalculateChecksum(const char* data, uint32_t length) {
+    auto bytes = (const uint8_t*)data;
     uint32_t checksum = 0;
-    for (uint32_t i = 0; i < length; i++) {
-        checksum += data[i];
+    while (length > 0 && ((uintptr_t)bytes & 3) != 0) {
+        checksum += *bytes++;
+        length--;
+    }
+
+    // Four bytes per load, summed in two 16-bit lanes. A word adds at most 510 to a lane,
+    // so a lane is folded into the checksum every 128 words before it can overflow.
+    auto words = (const uint32_t*)bytes;
+    uint32_t word_count = length / 4;
+    while (word_count > 0) {
+        uint32_t block = std::min<uint32_t>(word_count, 128);
+        uint32_t lanes = 0;
+        for (uint32_t i = 0; i < block; i++) {
+            uint32_t word = words[i];
+            lanes += (word & 0x00FF00FF) + ((word >> 8) & 0x00FF00FF);
+        }
+        checksum += (lanes & 0xFFFF) + (lanes >> 16);
+        words += block;
+        word_count -= block;
+    }
+
+    bytes = (const uint8_t*)words;
+    for (uint32_t i = 0; i < (length & 3); i++) {
+        checksum += bytes[i];
     }
     return checksum & 0xFFFF;
 }
 
+const uint32_t* Assets::FindChecksumTrailer(uint32_t stored_files, uint32_t stored_len, uint32_t& crc32) {
+    size_t offset = (12 + stored_len + 3) & ~3;
+    size_t end = offset + sizeof(mmap_assets_trailer) + stored_files * sizeof(uint32_t);
+    if (end > partition_->size) {
+        return nullptr;
+    }
+    auto trailer = (const mmap_assets_trailer*)(mmap_root_ + offset);
+    // The length ties the trailer to this pack, a larger pack written before may have left one behind
+    if (memcmp(trailer->magic, "ZZCK", 4) != 0 || trailer->version != 1 || trailer->length != stored_len) {
+        return nullptr;
+    }
+    crc32 = trailer->crc32;
+    return (const uint32_t*)(trailer + 1);
+}
+
 bool Assets::InitializePartition() {
     partition_valid_ = false;
     checksum_valid_ = false;
-    assets_.clear();
+    asset_table_ = nullptr;
+    asset_count_ = 0;
+    asset_crcs_ = nullptr;
+    sorted_asset_indexes_.clear();
+    asset_verified_.clear();
 
     partition_ = esp_partition_find_first(ESP_PARTITION_TYPE_ANY, ESP_PARTITION_SUBTYPE_ANY, "assets");
     if (partition_ == nullptr) {
@@ -80,26 +142,66 @@ bool Assets::InitializePartition() {
         ESP_LOGD(TAG, "The stored_len (0x%lx) is greater than the partition size (0x%lx) - 12", stored_len, partition_->size);
         return false;
     }
+    if (stored_files > UINT16_MAX || stored_files * sizeof(mmap_assets_table) > stored_len) {
+        ESP_LOGE(TAG, "The asset table (%lu files) does not fit the stored length (0x%lx)", stored_files, stored_len);
+        return false;
+    }
 
-    auto start_time = esp_timer_get_time();
-    uint32_t calculated_checksum = CalculateChecksum(mmap_root_ + 12, stored_len);
-    auto end_time = esp_timer_get_time();
-    ESP_LOGI(TAG, "The checksum calculation time is %d ms", int((end_time - start_time) / 1000));
+    uint32_t stored_crc32 = 0;
+    auto asset_crcs = FindChecksumTrailer(stored_files, stored_len, stored_crc32);
 
-    if (calculated_checksum != stored_chksum) {
-        ESP_LOGE(TAG, "The calculated checksum (0x%lx) does not match the stored checksum (0x%lx)", calculated_checksum, stored_chksum);
-        return false;
+    // The whole pack is scanned once, later boots find its fingerprint and skip the scan
+    uint32_t fingerprint = esp_rom_crc32_le(0, (const uint8_t*)mmap_root_, 12);
+    if (asset_crcs != nullptr) {
+        fingerprint = esp_rom_crc32_le(fingerprint, (const uint8_t*)&stored_crc32, sizeof(stored_crc32));
     }
+    Settings settings("assets", false);
+    if (settings.GetInt("verified") == (int32_t)fingerprint) {
+        ESP_LOGI(TAG, "The assets were verified before, skipping the checksum");
+    } else {
+        auto start_time = esp_timer_get_time();
+        if (asset_crcs != nullptr) {
+            uint32_t calculated_crc32 = esp_rom_crc32_le(0, (const uint8_t*)mmap_root_ + 12, stored_len);
+            if (calculated_crc32 != stored_crc32) {
+                ESP_LOGE(TAG, "The calculated CRC32 (0x%lx) does not match the stored CRC32 (0x%lx)", calculated_crc32, stored_crc32);
+                return false;
+            }
+        } else {
+            uint32_t calculated_checksum = CalculateChecksum(mmap_root_ + 12, stored_len);
+            if (calculated_checksum != stored_chksum) {
+                ESP_LOGE(TAG, "The calculated checksum (0x%lx) does not match the stored checksum (0x%lx)", calculated_checksum, stored_chksum);
+                return false;
+            }
+        }
+        auto end_time = esp_timer_get_time();
+        ESP_LOGI(TAG, "The checksum calculation time is %d ms", int((end_time - start_time) / 1000));
 
-    checksum_valid_ = true;
+        Settings settings("assets", true);
+        settings.SetInt("verified", (int32_t)fingerprint);
+    }
 
-    for (uint32_t i = 0; i < stored_files; i++) {
-        auto item = (const mmap_assets_table*)(mmap_root_ + 12 + i * sizeof(mmap_assets_table));
-        auto asset = Asset{
-            .size = static_cast<size_t>(item->asset_size),
-            .offset = static_cast<size_t>(12 + sizeof(mmap_assets_table) * stored_files + item->asset_offset)
-        };
-        assets_[item->asset_name] = asset;
+    checksum_valid_ = true;
+    asset_table_ = (const mmap_assets_table*)(mmap_root_ + 12);
+    asset_count_ = stored_files;
+    asset_data_offset_ = 12 + sizeof(mmap_assets_table) * stored_files;
+    asset_crcs_ = asset_crcs;
+    asset_verified_.assign(asset_count_, false);
+
+    // Packs made by the current scripts have the table sorted by name and are searched in place,
+    // older packs get an index of the table entries in name order
+    bool sorted = true;
+    for (size_t i = 1; i < asset_count_ && sorted; i++) {
+        sorted = GetAssetName(i - 1) < GetAssetName(i);
+    }
+    if (!sorted) {
+        sorted_asset_indexes_.resize(asset_count_);
+        for (size_t i = 0; i < asset_count_; i++) {
+            sorted_asset_indexes_[i] = i;
+        }
+        std::sort(sorted_asset_indexes_.begin(), sorted_asset_indexes_.end(), [this](uint16_t a, uint16_t b) {
+            return GetAssetName(a) < GetAssetName(b);
+        });
+        ESP_LOGI(TAG, "The asset table is not sorted, indexed %u assets", asset_count_);
     }
     return checksum_valid_;
 }
@@ -186,7 +288,19 @@ bool Assets::Apply() {
                         ESP_LOGE(TAG, "Emoji %s image file %s is not found", name->valuestring, file->valuestring);
                         continue;
                     }
-                    custom_emoji_collection->AddEmoji(name->valuestring, new LvglRawImage(ptr, size));
+                    auto image = new LvglRawImage(ptr, size, file->valuestring);
+                    // GIF 播放方式：none 边播边解码，deltas 预解码并只保存变化区域，frames 预解码完整帧
+                    cJSON* gif_cache = cJSON_GetObjectItem(emoji, "gif_cache");
+                    if (cJSON_IsString(gif_cache)) {
+                        if (strcmp(gif_cache->valuestring, "none") == 0) {
+                            image->set_gif_cache_mode(kGifCacheNone);
+                        } else if (strcmp(gif_cache->valuestring, "frames") == 0) {
+                            image->set_gif_cache_mode(kGifCacheFrames);
+                        } else if (strcmp(gif_cache->valuestring, "deltas") != 0) {
+                            ESP_LOGW(TAG, "Unknown gif_cache %s for emoji %s", gif_cache->valuestring, name->valuestring);
+                        }
+                    }
+                    custom_emoji_collection->AddEmoji(name->valuestring, image);
                 }
             }
         }
@@ -392,119 +506,152 @@ bool Assets::Download(std::string url, std::function<void(int progress, size_t s
         mmap_root_ = nullptr;
     }
     checksum_valid_ = false;
-    assets_.clear();
-
-    // 下载新的资源文件
-    auto network = Board::GetInstance().GetNetwork();
-    auto http = network->CreateHttp(0);
-    
-    if (!http->Open("GET", url)) {
-        ESP_LOGE(TAG, "Failed to open HTTP connection");
-        return false;
+    asset_table_ = nullptr;
+    asset_count_ = 0;
+    asset_crcs_ = nullptr;
+    {
+        // 新的资源需要重新完整校验
+        Settings settings("assets", true);
+        settings.EraseKey("verified");
     }
 
-    if (http->GetStatusCode() != 200) {
-        ESP_LOGE(TAG, "Failed to get assets, status code: %d", http->GetStatusCode());
+    // 网络读取与 flash 写入在不同任务中并行，擦除在写入之前由后台任务提前完成
+    FlashStreamWriter writer(ASSETS_DOWNLOAD_CHUNK_SIZE, ASSETS_DOWNLOAD_CHUNK_COUNT,
+        [this](size_t offset, const char* data, size_t size) {
+            return esp_partition_write(partition_, offset, data, size);
+        });
+    if (!writer.Start()) {
+        ESP_LOGE(TAG, "Failed to start the flash writer");
         return false;
     }
 
-    size_t content_length = http->GetBodyLength();
-    if (content_length == 0) {
-        ESP_LOGE(TAG, "Failed to get content length");
-        return false;
-    }
-
-    if (content_length > partition_->size) {
-        ESP_LOGE(TAG, "Assets file size (%u) is larger than partition size (%lu)", content_length, partition_->size);
-        return false;
-    }
-
-    // 定义扇区大小为4KB（ESP32的标准扇区大小）
-    const size_t SECTOR_SIZE = esp_partition_get_main_flash_sector_size();
-    
-    // 计算需要擦除的扇区数量
-    size_t sectors_to_erase = (content_length + SECTOR_SIZE - 1) / SECTOR_SIZE; // 向上取整
-    size_t total_erase_size = sectors_to_erase * SECTOR_SIZE;
-    
-    ESP_LOGI(TAG, "Sector size: %u, content length: %u, sectors to erase: %u, total erase size: %u", 
-             SECTOR_SIZE, content_length, sectors_to_erase, total_erase_size);
-    
-    // 写入新的资源文件到分区，一边erase一边写入
-    char buffer[512];
-    size_t total_written = 0;
-    size_t recent_written = 0;
-    size_t current_sector = 0;
+    auto network = Board::GetInstance().GetNetwork();
+    size_t content_length = 0;
+    size_t total_read = 0;
+    size_t recent_read = 0;
+    int failures = 0;
     auto last_calc_time = esp_timer_get_time();
-    
-    while (true) {
-        int ret = http->Read(buffer, sizeof(buffer));
-        if (ret < 0) {
-            ESP_LOGE(TAG, "Failed to read HTTP data: %s", esp_err_to_name(ret));
-            return false;
+
+    // 连接中断后通过 HTTP Range 从已接收的位置继续下载
+    while (content_length == 0 || total_read < content_length) {
+        if (content_length != 0) {
+            if (++failures > ASSETS_DOWNLOAD_MAX_RETRIES) {
+                ESP_LOGE(TAG, "Download interrupted at %u/%u bytes, giving up", total_read, content_length);
+                break;
+            }
+            ESP_LOGW(TAG, "Download interrupted at %u/%u bytes, resuming (%d/%d)", total_read, content_length,
+                failures, ASSETS_DOWNLOAD_MAX_RETRIES);
+            vTaskDelay(pdMS_TO_TICKS(1000 * failures));
         }
 
-        if (ret == 0) {
-            break;
+        auto http = network->CreateHttp(0);
+        if (total_read > 0) {
+            http->SetHeader("Range", "bytes=" + std::to_string(total_read) + "-");
+        }
+        if (!http->Open("GET", url)) {
+            ESP_LOGE(TAG, "Failed to open HTTP connection");
+            if (content_length == 0) {
+                return false;
+            }
+            continue;
         }
 
-        // 检查是否需要擦除新的扇区
-        size_t write_end_offset = total_written + ret;
-        size_t needed_sectors = (write_end_offset + SECTOR_SIZE - 1) / SECTOR_SIZE;
-        
-        // 擦除需要的新扇区
-        while (current_sector < needed_sectors) {
-            size_t sector_start = current_sector * SECTOR_SIZE;
-            size_t sector_end = (current_sector + 1) * SECTOR_SIZE;
-            
-            // 确保擦除范围不超过分区大小
-            if (sector_end > partition_->size) {
-                ESP_LOGE(TAG, "Sector end (%u) exceeds partition size (%lu)", sector_end, partition_->size);
+        if (content_length == 0) {
+            if (http->GetStatusCode() != 200) {
+                ESP_LOGE(TAG, "Failed to get assets, status code: %d", http->GetStatusCode());
+                return false;
+            }
+            content_length = http->GetBodyLength();
+            if (content_length == 0) {
+                ESP_LOGE(TAG, "Failed to get content length");
+                return false;
+            }
+            if (content_length > partition_->size) {
+                ESP_LOGE(TAG, "Assets file size (%u) is larger than partition size (%lu)", content_length, partition_->size);
                 return false;
             }
-            
-            ESP_LOGD(TAG, "Erasing sector %u (offset: %u, size: %u)", current_sector, sector_start, SECTOR_SIZE);
-            esp_err_t err = esp_partition_erase_range(partition_, sector_start, SECTOR_SIZE);
-            if (err != ESP_OK) {
-                ESP_LOGE(TAG, "Failed to erase sector %u at offset %u: %s", current_sector, sector_start, esp_err_to_name(err));
+            if (!writer.PreErase(partition_, content_length)) {
+                ESP_LOGE(TAG, "Failed to start erasing the assets partition");
                 return false;
             }
-            
-            current_sector++;
+            ESP_LOGI(TAG, "Content length: %u, chunk size: %u", content_length, writer.chunk_size());
+        } else if (http->GetStatusCode() != 206 || http->GetBodyLength() != content_length - total_read) {
+            ESP_LOGE(TAG, "The server cannot resume the download, status code: %d", http->GetStatusCode());
+            break;
         }
 
-        // 写入数据到分区
-        esp_err_t err = esp_partition_write(partition_, total_written, buffer, ret);
-        if (err != ESP_OK) {
-            ESP_LOGE(TAG, "Failed to write to assets partition at offset %u: %s", total_written, esp_err_to_name(err));
-            return false;
-        }
+        size_t resumed_at = total_read;
+        while (total_read < content_length) {
+            char* chunk = writer.AcquireChunk();
+            if (chunk == nullptr) {
+                break;
+            }
+
+            // 填满一个块再交给写入任务，写入期间继续读取下一个块
+            size_t chunk_offset = total_read;
+            size_t chunk_limit = std::min(writer.chunk_size(), content_length - chunk_offset);
+            size_t filled = 0;
+            int ret = 0;
+            while (filled < chunk_limit) {
+                ret = http->Read(chunk + filled, chunk_limit - filled);
+                if (ret <= 0) {
+                    break;
+                }
+                filled += ret;
+            }
+            if (filled > 0) {
+                writer.SubmitChunk(chunk, chunk_offset, filled);
+            } else {
+                writer.ReleaseChunk(chunk);
+            }
+            total_read += filled;
+            recent_read += filled;
+
+            // 计算进度和速度
+            if (esp_timer_get_time() - last_calc_time >= 1000000 || total_read == content_length) {
+                size_t progress = total_read * 100 / content_length;
+                size_t speed = recent_read; // 每秒的字节数
+                ESP_LOGI(TAG, "Progress: %u%% (%u/%u), Speed: %u B/s", progress, total_read, content_length, speed);
+                if (progress_callback) {
+                    progress_callback(progress, speed);
+                }
+                last_calc_time = esp_timer_get_time();
+                recent_read = 0;
+            }
 
-        total_written += ret;
-        recent_written += ret;
-
-        // 计算进度和速度
-        if (esp_timer_get_time() - last_calc_time >= 1000000 || total_written == content_length || ret == 0) {
-            size_t progress = total_written * 100 / content_length;
-            size_t speed = recent_written; // 每秒的字节数
-            ESP_LOGI(TAG, "Progress: %u%% (%u/%u), Speed: %u B/s, Sectors erased: %u", 
-                     progress, total_written, content_length, speed, current_sector);
-            if (progress_callback) {
-                progress_callback(progress, speed);
+            if (ret < 0) {
+                ESP_LOGE(TAG, "Failed to read HTTP data: %s", esp_err_to_name(ret));
+                break;
+            }
+            if (ret == 0 && filled < chunk_limit) {
+                break;
             }
-            last_calc_time = esp_timer_get_time();
-            recent_written = 0; // 重置最近写入的字节数
+        }
+        http->Close();
+
+        if (total_read > resumed_at) {
+            failures = 0;
+        }
+        if (writer.Flush() != ESP_OK) {
+            break;
         }
     }
-    
-    http->Close();
 
-    if (total_written != content_length) {
-        ESP_LOGE(TAG, "Downloaded size (%u) does not match expected size (%u)", total_written, content_length);
+    esp_err_t err = writer.Flush();
+    auto stats = writer.GetStats();
+    ESP_LOGI(TAG, "Flash written: %u bytes in %d ms, erased ahead in %d ms, writer waited %d ms for erase, reader waited %d ms for flash",
+        stats.bytes, int(stats.write_us / 1000), int(stats.erase_us / 1000), int(stats.erase_wait_us / 1000),
+        int(stats.chunk_wait_us / 1000));
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to write to assets partition: %s", esp_err_to_name(err));
+        return false;
+    }
+    if (total_read != content_length || stats.bytes != content_length) {
+        ESP_LOGE(TAG, "Downloaded size (%u) does not match expected size (%u)", stats.bytes, content_length);
         return false;
     }
 
-    ESP_LOGI(TAG, "Assets download completed, total written: %u bytes, total sectors erased: %u", 
-             total_written, current_sector);
+    ESP_LOGI(TAG, "Assets download completed, total written: %u bytes", stats.bytes);
 
     // 重新初始化资源分区
     if (!InitializePartition()) {
@@ -515,18 +662,53 @@ bool Assets::Download(std::string url, std::function<void(int progress, size_t s
     return true;
 }
 
-bool Assets::GetAssetData(const std::string& name, void*& ptr, size_t& size) {
-    auto asset = assets_.find(name);
-    if (asset == assets_.end()) {
+std::string_view Assets::GetAssetName(size_t index) const {
+    auto& item = asset_table_[index];
+    return std::string_view(item.asset_name, strnlen(item.asset_name, sizeof(item.asset_name)));
+}
+
+int Assets::FindAsset(std::string_view name) const {
+    size_t low = 0;
+    size_t high = asset_count_;
+    while (low < high) {
+        size_t middle = (low + high) / 2;
+        size_t index = sorted_asset_indexes_.empty() ? middle : sorted_asset_indexes_[middle];
+        int result = GetAssetName(index).compare(name);
+        if (result == 0) {
+            return index;
+        } else if (result < 0) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+    return -1;
+}
+
+bool Assets::GetAssetData(std::string_view name, void*& ptr, size_t& size) {
+    int index = FindAsset(name);
+    if (index < 0) {
         return false;
     }
-    auto data = (const char*)(mmap_root_ + asset->second.offset);
+    auto& item = asset_table_[index];
+    auto data = (const char*)(mmap_root_ + asset_data_offset_ + item.asset_offset);
     if (data[0] != 'Z' || data[1] != 'Z') {
-        ESP_LOGE(TAG, "The asset %s is not valid with magic %02x%02x", name.c_str(), data[0], data[1]);
+        ESP_LOGE(TAG, "The asset %.*s is not valid with magic %02x%02x", (int)name.size(), name.data(), data[0], data[1]);
         return false;
     }
 
+    // 每个资源在第一次使用时按 CRC32 校验一次
+    if (asset_crcs_ != nullptr && !asset_verified_[index]) {
+        uint32_t crc32 = esp_rom_crc32_le(0, (const uint8_t*)data + 2, item.asset_size);
+        if (crc32 != asset_crcs_[index]) {
+            ESP_LOGE(TAG, "The asset %.*s is corrupted, CRC32 0x%lx, expected 0x%lx", (int)name.size(), name.data(),
+                crc32, asset_crcs_[index]);
+            return false;
+        }
+        asset_verified_[index] = true;
+    }
+
     ptr = static_cast<void*>(const_cast<char*>(data + 2));
-    size = asset->second.size;
+    size = item.asset_size;
     return true;
 }
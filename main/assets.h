@@ -1,19 +1,16 @@
 #ifndef ASSETS_H
 #define ASSETS_H
 
-#include <map>
 #include <string>
+#include <string_view>
+#include <vector>
 #include <functional>
 
 #include <cJSON.h>
 #include <esp_partition.h>
 #include <model_path.h>
 
-
-struct Asset {
-    size_t size;
-    size_t offset;
-};
+struct mmap_assets_table;
 
 class Assets {
 public:
@@ -25,7 +22,7 @@ public:
 
     bool Download(std::string url, std::function<void(int progress, size_t speed)> progress_callback);
     bool Apply();
-    bool GetAssetData(const std::string& name, void*& ptr, size_t& size);
+    bool GetAssetData(std::string_view name, void*& ptr, size_t& size);
 
     inline bool partition_valid() const { return partition_valid_; }
     inline bool checksum_valid() const { return checksum_valid_; }
@@ -38,6 +35,9 @@ private:
 
     bool InitializePartition();
     uint32_t CalculateChecksum(const char* data, uint32_t length);
+    const uint32_t* FindChecksumTrailer(uint32_t stored_files, uint32_t stored_len, uint32_t& crc32);
+    std::string_view GetAssetName(size_t index) const;
+    int FindAsset(std::string_view name) const;
 
     const esp_partition_t* partition_ = nullptr;
     esp_partition_mmap_handle_t mmap_handle_ = 0;
@@ -46,7 +46,14 @@ private:
     bool checksum_valid_ = false;
     std::string default_assets_url_;
     srmodel_list_t* models_list_ = nullptr;
-    std::map<std::string, Asset> assets_;
+
+    // The asset table is used in place from the mmapped partition
+    const mmap_assets_table* asset_table_ = nullptr;
+    size_t asset_count_ = 0;
+    size_t asset_data_offset_ = 0;
+    const uint32_t* asset_crcs_ = nullptr;          // From the checksum trailer of the pack, if it has one
+    std::vector<uint16_t> sorted_asset_indexes_;    // Only for packs whose table is not sorted by name
+    std::vector<bool> asset_verified_;
 };
 
 #endif
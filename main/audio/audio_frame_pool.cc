@@ -0,0 +1,165 @@
+#include "audio_frame_pool.h"
+
+#include <esp_log.h>
+
+#define TAG "AudioFramePool"
+
+void std::default_delete<AudioTask>::operator()(AudioTask* task) const {
+    if (task->pool != nullptr) {
+        task->pool->Release(task);
+    } else {
+        delete task;
+    }
+}
+
+void std::default_delete<AudioStreamPacket>::operator()(AudioStreamPacket* packet) const {
+    if (packet->pool != nullptr) {
+        packet->pool->Release(packet);
+    } else {
+        delete packet;
+    }
+}
+
+AudioFramePool::~AudioFramePool() {
+    for (auto task : free_tasks_) {
+        delete task;
+    }
+    for (auto packet : free_packets_) {
+        delete packet;
+    }
+}
+
+void AudioFramePool::Initialize(size_t task_count, size_t pcm_samples, size_t packet_count, size_t opus_bytes) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    pcm_samples_ = pcm_samples;
+    opus_bytes_ = opus_bytes;
+
+    // Reserve the free lists for every object so that Release never reallocates them
+    free_tasks_.reserve(task_count);
+    for (size_t i = 0; i < task_count; i++) {
+        auto task = new AudioTask();
+        task->pcm.reserve(pcm_samples_);
+        task->pool = this;
+        free_tasks_.push_back(task);
+    }
+
+    free_packets_.reserve(packet_count);
+    for (size_t i = 0; i < packet_count; i++) {
+        auto packet = new AudioStreamPacket();
+        packet->payload.reserve(opus_bytes_);
+        packet->pool = this;
+        free_packets_.push_back(packet);
+    }
+
+    stats_.tasks_total = stats_.tasks_free = stats_.tasks_min_free = task_count;
+    stats_.packets_total = stats_.packets_free = stats_.packets_min_free = packet_count;
+    ESP_LOGI(TAG, "Preallocated %u PCM frames (%u samples) and %u Opus packets (%u bytes)",
+        task_count, pcm_samples_, packet_count, opus_bytes_);
+}
+
+void AudioFramePool::ResizePackets(size_t packet_count, size_t opus_bytes) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    opus_bytes_ = opus_bytes;
+
+    // Surplus packets that are still in use are deleted when they come back
+    while (stats_.packets_total > packet_count && !free_packets_.empty()) {
+        delete free_packets_.back();
+        free_packets_.pop_back();
+        stats_.packets_total--;
+    }
+    for (auto packet : free_packets_) {
+        packet->payload.reserve(opus_bytes_);
+    }
+    free_packets_.reserve(packet_count);
+    while (stats_.packets_total < packet_count) {
+        auto packet = new AudioStreamPacket();
+        packet->payload.reserve(opus_bytes_);
+        packet->pool = this;
+        free_packets_.push_back(packet);
+        stats_.packets_total++;
+    }
+    stats_.packets_free = stats_.packets_min_free = free_packets_.size();
+    ESP_LOGI(TAG, "Resized to %u Opus packets (%u bytes)", (unsigned)stats_.packets_total, opus_bytes_);
+}
+
+std::unique_ptr<AudioTask> AudioFramePool::AcquireTask(AudioTaskType type) {
+    AudioTask* task = nullptr;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (!free_tasks_.empty()) {
+            task = free_tasks_.back();
+            free_tasks_.pop_back();
+            stats_.tasks_free = free_tasks_.size();
+            if (stats_.tasks_free < stats_.tasks_min_free) {
+                stats_.tasks_min_free = stats_.tasks_free;
+            }
+        } else {
+            stats_.fallback_allocations++;
+        }
+    }
+    if (task == nullptr) {
+        task = new AudioTask();
+    }
+    task->type = type;
+    task->timestamp = 0;
+    task->enqueue_time_us = 0;
+    return std::unique_ptr<AudioTask>(task);
+}
+
+std::unique_ptr<AudioStreamPacket> AudioFramePool::AcquirePacket() {
+    AudioStreamPacket* packet = nullptr;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (!free_packets_.empty()) {
+            packet = free_packets_.back();
+            free_packets_.pop_back();
+            stats_.packets_free = free_packets_.size();
+            if (stats_.packets_free < stats_.packets_min_free) {
+                stats_.packets_min_free = stats_.packets_free;
+            }
+        } else {
+            stats_.fallback_allocations++;
+        }
+    }
+    if (packet == nullptr) {
+        packet = new AudioStreamPacket();
+    }
+    return std::unique_ptr<AudioStreamPacket>(packet);
+}
+
+void AudioFramePool::Release(AudioTask* task) {
+    // clear() keeps the capacity, only a buffer that was moved away has to be reserved again
+    task->pcm.clear();
+    if (task->pcm.capacity() < pcm_samples_) {
+        task->pcm.reserve(pcm_samples_);
+    }
+    std::lock_guard<std::mutex> lock(mutex_);
+    free_tasks_.push_back(task);
+    stats_.tasks_free = free_tasks_.size();
+}
+
+void AudioFramePool::Release(AudioStreamPacket* packet) {
+    packet->sample_rate = 0;
+    packet->frame_duration = 0;
+    packet->timestamp = 0;
+    packet->sequence = 0;
+    packet->headroom = 0;
+    packet->enqueue_time_us = 0;
+    packet->payload.clear();
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (packet->payload.capacity() < opus_bytes_) {
+        packet->payload.reserve(opus_bytes_);
+    }
+    if (free_packets_.size() >= stats_.packets_total) {
+        // The pool was shrunk while this packet was in use
+        delete packet;
+        return;
+    }
+    free_packets_.push_back(packet);
+    stats_.packets_free = free_packets_.size();
+}
+
+AudioFramePoolStats AudioFramePool::GetStats() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return stats_;
+}
@@ -0,0 +1,82 @@
+#ifndef AUDIO_FRAME_POOL_H
+#define AUDIO_FRAME_POOL_H
+
+#include <memory>
+#include <mutex>
+#include <vector>
+#include <cstdint>
+
+#include "protocol.h"
+
+/*
+ * Preallocated PCM frames (AudioTask) and Opus packets (AudioStreamPacket) for the audio pipeline.
+ *
+ * Objects are created once in Initialize() and recycled afterwards. A handle acquired from the
+ * pool is a plain std::unique_ptr: destroying it (after playback, after sending, or when a queue
+ * is flushed) returns the object to the pool with its buffer capacity intact, so steady-state
+ * streaming does not touch the heap. If the pool runs dry, Acquire falls back to a normal heap
+ * allocation and counts it in fallback_allocations.
+ *
+ * ResizePackets() changes the number and size of the Opus packets when the frame duration of a
+ * session changes, so the pool keeps covering the same amount of audio.
+ */
+
+class AudioFramePool;
+
+enum AudioTaskType {
+    kAudioTaskTypeEncodeToSendQueue,
+    kAudioTaskTypeEncodeToTestingQueue,
+    kAudioTaskTypeDecodeToPlaybackQueue,
+};
+
+struct AudioTask {
+    AudioTaskType type;
+    std::vector<int16_t> pcm;
+    uint32_t timestamp = 0;
+    int64_t enqueue_time_us = 0;    // When the task entered its current queue, for latency statistics
+    // Set when the task comes from an AudioFramePool, deleting the task returns it to the pool
+    AudioFramePool* pool = nullptr;
+};
+
+namespace std {
+template <>
+struct default_delete<AudioTask> {
+    void operator()(AudioTask* task) const;
+};
+}
+
+struct AudioFramePoolStats {
+    uint32_t tasks_total = 0;
+    uint32_t tasks_free = 0;
+    uint32_t tasks_min_free = 0;
+    uint32_t packets_total = 0;
+    uint32_t packets_free = 0;
+    uint32_t packets_min_free = 0;
+    uint32_t fallback_allocations = 0;
+};
+
+class AudioFramePool {
+public:
+    AudioFramePool() = default;
+    ~AudioFramePool();
+    AudioFramePool(const AudioFramePool&) = delete;
+    AudioFramePool& operator=(const AudioFramePool&) = delete;
+
+    void Initialize(size_t task_count, size_t pcm_samples, size_t packet_count, size_t opus_bytes);
+    void ResizePackets(size_t packet_count, size_t opus_bytes);
+    std::unique_ptr<AudioTask> AcquireTask(AudioTaskType type);
+    std::unique_ptr<AudioStreamPacket> AcquirePacket();
+    void Release(AudioTask* task);
+    void Release(AudioStreamPacket* packet);
+    AudioFramePoolStats GetStats() const;
+
+private:
+    mutable std::mutex mutex_;
+    std::vector<AudioTask*> free_tasks_;
+    std::vector<AudioStreamPacket*> free_packets_;
+    size_t pcm_samples_ = 0;
+    size_t opus_bytes_ = 0;
+    AudioFramePoolStats stats_;
+};
+
+#endif // AUDIO_FRAME_POOL_H
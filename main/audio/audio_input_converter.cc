@@ -0,0 +1,68 @@
+#include "audio_input_converter.h"
+#include "audio_pcm_kernels.h"
+
+#include <esp_log.h>
+
+#define TAG "AudioInputConverter"
+
+// Extra samples in every scratch buffer, enough to shift its start to any 16-byte phase
+#define PHASE_SLACK_SAMPLES 8
+
+void AudioInputConverter::Configure(int input_sample_rate, int output_sample_rate, int channels) {
+    input_sample_rate_ = input_sample_rate;
+    output_sample_rate_ = output_sample_rate;
+    channels_ = channels;
+    if (resampling()) {
+        for (int i = 0; i < channels_ && i < 2; i++) {
+            resamplers_[i].Configure(input_sample_rate, output_sample_rate);
+        }
+    }
+    ESP_LOGI(TAG, "Input %d Hz x%d -> %d Hz, kernels: %s", input_sample_rate, channels, output_sample_rate,
+        PcmKernelsBackend());
+}
+
+/*
+ * Returns where a planar channel of `samples` starts inside `buffer`. The split / merge kernels
+ * walk the interleaved side 4 bytes per frame and the planar side 2 bytes per frame, so both
+ * reach a 16-byte boundary at the same frame if planar = -(interleaved / 2) modulo 16.
+ */
+int16_t* AudioInputConverter::Place(std::vector<int16_t>& buffer, size_t samples, const int16_t* interleaved) {
+    if (buffer.size() < samples + PHASE_SLACK_SAMPLES) {
+        buffer.resize(samples + PHASE_SLACK_SAMPLES);
+    }
+    uintptr_t base = reinterpret_cast<uintptr_t>(buffer.data());
+    uintptr_t head_frames = ((16 - (reinterpret_cast<uintptr_t>(interleaved) & 15)) & 15) / 4;
+    uintptr_t target = (16 - 2 * head_frames) & 15;
+    uintptr_t shift = (target - (base & 15)) & 15;
+    return buffer.data() + shift / sizeof(int16_t);
+}
+
+void AudioInputConverter::Process(std::vector<int16_t>& data) {
+    if (!resampling()) {
+        return;
+    }
+
+    if (channels_ == 1) {
+        int output_samples = resamplers_[0].GetOutputSamples(data.size());
+        int16_t* output = Place(resampled_buffers_[0], output_samples, data.data());
+        resamplers_[0].Process(data.data(), data.size(), output);
+        data.assign(output, output + output_samples);
+        return;
+    }
+
+    size_t frames = data.size() / 2;
+    size_t output_frames = resamplers_[0].GetOutputSamples(frames);
+    // Reserve first so that the merge writes back to the same (already phase-matched) memory
+    data.reserve(output_frames * 2);
+
+    int16_t* mic = Place(channel_buffers_[0], frames, data.data());
+    int16_t* reference = Place(channel_buffers_[1], frames, data.data());
+    int16_t* resampled_mic = Place(resampled_buffers_[0], output_frames, data.data());
+    int16_t* resampled_reference = Place(resampled_buffers_[1], output_frames, data.data());
+
+    PcmDeinterleaveStereo(data.data(), mic, reference, frames);
+    resamplers_[0].Process(mic, frames, resampled_mic);
+    resamplers_[1].Process(reference, frames, resampled_reference);
+    data.resize(output_frames * 2);
+    PcmInterleaveStereo(resampled_mic, resampled_reference, data.data(), output_frames);
+}
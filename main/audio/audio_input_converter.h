@@ -0,0 +1,43 @@
+#ifndef AUDIO_INPUT_CONVERTER_H
+#define AUDIO_INPUT_CONVERTER_H
+
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+
+#include <opus_resampler.h>
+
+/*
+ * Converts interleaved codec input (microphone, optionally followed by the reference channel)
+ * to the pipeline sample rate in one stage: split the channels, resample each, merge them back.
+ *
+ * The planar scratch buffers are kept across calls and placed so that they have the same
+ * 16-byte phase as the interleaved buffer, which lets the SIMD split / merge kernels cover the
+ * whole frame instead of only the part where both sides happen to be aligned.
+ */
+class AudioInputConverter {
+public:
+    AudioInputConverter() = default;
+    AudioInputConverter(const AudioInputConverter&) = delete;
+    AudioInputConverter& operator=(const AudioInputConverter&) = delete;
+
+    void Configure(int input_sample_rate, int output_sample_rate, int channels);
+    // data holds interleaved frames at the input rate and is replaced by frames at the output rate
+    void Process(std::vector<int16_t>& data);
+
+    inline bool resampling() const { return input_sample_rate_ != output_sample_rate_; }
+
+private:
+    int input_sample_rate_ = 0;
+    int output_sample_rate_ = 0;
+    int channels_ = 1;
+    OpusResampler resamplers_[2];
+
+    // Backing storage, the planar channels live at an offset inside them, see Place()
+    std::vector<int16_t> channel_buffers_[2];
+    std::vector<int16_t> resampled_buffers_[2];
+
+    int16_t* Place(std::vector<int16_t>& buffer, size_t samples, const int16_t* interleaved);
+};
+
+#endif // AUDIO_INPUT_CONVERTER_H
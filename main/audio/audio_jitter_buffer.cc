@@ -0,0 +1,222 @@
+#include "audio_jitter_buffer.h"
+
+#include <esp_log.h>
+
+#define TAG "AudioJitterBuffer"
+
+// Frames of PLC to play when the speaker is about to run dry and the next packet has not arrived
+#define MAX_STARVED_CONCEALMENT_FRAMES 2
+
+void AudioJitterBuffer::Configure(size_t capacity, uint32_t min_depth, uint32_t max_depth) {
+    slots_.clear();
+    slots_.resize(capacity);
+    min_depth_ = min_depth;
+    max_depth_ = max_depth < capacity ? max_depth : capacity;
+    Reset();
+}
+
+void AudioJitterBuffer::Clear() {
+    for (auto& slot : slots_) {
+        slot.reset();
+    }
+    count_ = 0;
+    playing_ = false;
+    starved_ = false;
+    starved_concealed_ = 0;
+    stats_.depth = 0;
+}
+
+void AudioJitterBuffer::Reset() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    Clear();
+    ended_ = false;
+    has_base_ = false;
+    has_transit_ = false;
+    jitter_x16_ = 0;
+    stats_.jitter_us = 0;
+    stats_.target_depth = min_depth_;
+}
+
+bool AudioJitterBuffer::empty() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return count_ == 0;
+}
+
+AudioJitterStats AudioJitterBuffer::GetStats() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return stats_;
+}
+
+void AudioJitterBuffer::UpdateJitter(uint32_t sequence, int64_t now_us) {
+    // Transit time relative to the sender's clock, which advances one frame per sequence
+    int64_t transit_us = now_us - static_cast<int64_t>(sequence) * frame_us_;
+    if (has_transit_) {
+        int64_t d = transit_us - last_transit_us_;
+        if (d < 0) {
+            d = -d;
+        }
+        jitter_x16_ += d - (jitter_x16_ + 8) / 16;
+    }
+    has_transit_ = true;
+    last_transit_us_ = transit_us;
+
+    stats_.jitter_us = jitter_x16_ / 16;
+    uint32_t target = 1 + (2 * stats_.jitter_us + frame_us_ - 1) / frame_us_;
+    stats_.target_depth = target < min_depth_ ? min_depth_ : target > max_depth_ ? max_depth_ : target;
+}
+
+bool AudioJitterBuffer::Push(std::unique_ptr<AudioStreamPacket> packet, int64_t now_us) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (packet->sequence == 0) {
+        packet->sequence = ++auto_sequence_;
+    }
+    uint32_t sequence = packet->sequence;
+    if (packet->frame_duration > 0) {
+        frame_us_ = packet->frame_duration * 1000;
+    }
+    stats_.received++;
+    UpdateJitter(sequence, now_us);
+
+    size_t capacity = slots_.size();
+    if (!has_base_) {
+        has_base_ = true;
+        next_sequence_ = highest_sequence_ = sequence;
+    }
+
+    int32_t ahead = static_cast<int32_t>(sequence - next_sequence_);
+    if (ahead < 0) {
+        stats_.late++;
+        return false;
+    }
+    if (ahead >= static_cast<int32_t>(capacity)) {
+        if (count_ > 0) {
+            stats_.overflows++;
+            return false;
+        }
+        // Nothing buffered and far ahead: the stream jumped, start over from this packet
+        ESP_LOGW(TAG, "Sequence jumped from %lu to %lu, resynchronizing", next_sequence_, sequence);
+        Clear();
+        next_sequence_ = highest_sequence_ = sequence;
+    }
+
+    if (static_cast<int32_t>(sequence - highest_sequence_) < 0) {
+        stats_.reordered++;
+    } else {
+        highest_sequence_ = sequence;
+    }
+
+    auto& slot = slots_[sequence % capacity];
+    if (slot && slot->sequence == sequence) {
+        stats_.duplicates++;
+        return false;
+    }
+    slot = std::move(packet);
+    if (count_ == 0 && !playing_) {
+        buffering_since_us_ = now_us;
+    }
+    if (starved_) {
+        // Keep playing if the stream only paused briefly, otherwise this is a new stream: buffer it up again
+        starved_ = false;
+        if (now_us - starved_since_us_ > static_cast<int64_t>(max_depth_) * frame_us_) {
+            playing_ = false;
+            buffering_since_us_ = now_us;
+        }
+    }
+    count_++;
+    stats_.depth = count_;
+    if (count_ > stats_.max_depth) {
+        stats_.max_depth = count_;
+    }
+    return true;
+}
+
+bool AudioJitterBuffer::IsPlaying() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return playing_;
+}
+
+void AudioJitterBuffer::OnOutputUnderrun(int64_t now_us) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!playing_) {
+        return;
+    }
+    // The cushion was too small: count it and rebuild it before playing on
+    stats_.underruns++;
+    playing_ = false;
+    buffering_since_us_ = now_us;
+}
+
+void AudioJitterBuffer::EndStream() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    ended_ = true;
+}
+
+AudioJitterResult AudioJitterBuffer::Pop(std::unique_ptr<AudioStreamPacket>& packet, int64_t now_us,
+    bool output_starving, int64_t& wait_us) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (count_ == 0) {
+        if (playing_ && !starved_) {
+            starved_ = true;
+            starved_since_us_ = now_us;
+        }
+        /*
+         * The speaker needs a frame now and the next packet is late or lost. Conceal without
+         * moving past it: a late packet is then still played, one frame later, which grows the
+         * cushion by one frame. If it was lost, the gap is concealed once the next packet arrives.
+         * Once the stream has ended nothing is late, the reply is over.
+         */
+        if (playing_ && !ended_ && output_starving && starved_concealed_ < MAX_STARVED_CONCEALMENT_FRAMES) {
+            starved_concealed_++;
+            stats_.concealed++;
+            return kJitterConceal;
+        }
+        return kJitterEmpty;
+    }
+
+    size_t capacity = slots_.size();
+    if (!playing_) {
+        int64_t target_delay_us = stats_.target_depth * frame_us_;
+        int64_t waited_us = now_us - buffering_since_us_;
+        if (count_ < stats_.target_depth && waited_us < target_delay_us) {
+            wait_us = target_delay_us - waited_us;
+            return kJitterWait;
+        }
+        // Start from the oldest buffered packet, whatever was missing before it is not concealed
+        while (!slots_[next_sequence_ % capacity] || slots_[next_sequence_ % capacity]->sequence != next_sequence_) {
+            next_sequence_++;
+        }
+        playing_ = true;
+    }
+
+    auto& slot = slots_[next_sequence_ % capacity];
+    if (slot && slot->sequence == next_sequence_) {
+        packet = std::move(slot);
+        starved_concealed_ = 0;
+        next_sequence_++;
+        count_--;
+        stats_.depth = count_;
+        stats_.played++;
+        return kJitterPacket;
+    }
+
+    // Conceal short gaps, but do not play more than max_depth frames of PLC for a long one
+    uint32_t gap = 1;
+    while (!slots_[(next_sequence_ + gap) % capacity] ||
+        slots_[(next_sequence_ + gap) % capacity]->sequence != next_sequence_ + gap) {
+        gap++;
+    }
+    if (gap > max_depth_) {
+        stats_.skipped += gap;
+        next_sequence_ += gap;
+        packet = std::move(slots_[next_sequence_ % capacity]);
+        starved_concealed_ = 0;
+        next_sequence_++;
+        count_--;
+        stats_.depth = count_;
+        stats_.played++;
+        return kJitterPacket;
+    }
+    next_sequence_++;
+    stats_.concealed++;
+    return kJitterConceal;
+}
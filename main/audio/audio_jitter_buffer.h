@@ -0,0 +1,107 @@
+#ifndef AUDIO_JITTER_BUFFER_H
+#define AUDIO_JITTER_BUFFER_H
+
+#include <memory>
+#include <mutex>
+#include <vector>
+#include <cstdint>
+
+#include "protocol.h"
+
+/*
+ * Adaptive jitter buffer for the incoming (server -> speaker) Opus stream.
+ *
+ * Packets are stored by sequence number, so reordered packets are played in order and
+ * duplicates are dropped. Playout starts once target_depth packets are buffered (or the
+ * oldest packet has waited that long, so short replies are not held back). From then on each
+ * Pop() returns the next sequence; a missing packet is reported as kJitterConceal so the
+ * decoder can run Opus PLC in its place (also when nothing newer has arrived yet but the
+ * speaker is about to run dry), and a packet that arrives after its slot was played
+ * is counted as late and dropped. Gaps longer than max_depth are skipped rather than concealed.
+ *
+ * The target depth follows the RFC 3550 interarrival jitter estimate: one frame plus enough
+ * frames to cover twice the measured jitter, clamped to [min_depth, max_depth]. The depth is
+ * the total cushion: once playing, frames move on to the playback queue as soon as it has room.
+ * If the stream pauses for longer than max_depth frames it is treated as a new stream and
+ * buffered up again; a shorter stall that starves the speaker counts as an underrun.
+ * After EndStream() the speaker running dry is the end of the reply and is not concealed.
+ *
+ * Packets without a sequence number (sequence == 0, e.g. WebSocket) are numbered in arrival order.
+ * Push() and Pop() may be called from different tasks.
+ */
+
+struct AudioJitterStats {
+    uint32_t received = 0;
+    uint32_t played = 0;
+    uint32_t concealed = 0;     // Missing packets replaced by Opus PLC
+    uint32_t skipped = 0;       // Missing packets in gaps too long to conceal
+    uint32_t late = 0;          // Arrived after their slot was played or concealed
+    uint32_t duplicates = 0;
+    uint32_t reordered = 0;     // Arrived after a packet with a higher sequence
+    uint32_t overflows = 0;     // Dropped because they were too far ahead of playout
+    uint32_t underruns = 0;     // The speaker ran dry while the stream was still going
+    uint32_t jitter_us = 0;
+    uint32_t target_depth = 0;
+    uint32_t depth = 0;
+    uint32_t max_depth = 0;
+};
+
+enum AudioJitterResult {
+    kJitterEmpty,       // Nothing buffered
+    kJitterWait,        // Still buffering, ask again after wait_us
+    kJitterPacket,      // Next packet returned
+    kJitterConceal,     // Next packet is missing, conceal one frame
+};
+
+class AudioJitterBuffer {
+public:
+    AudioJitterBuffer() = default;
+    AudioJitterBuffer(const AudioJitterBuffer&) = delete;
+    AudioJitterBuffer& operator=(const AudioJitterBuffer&) = delete;
+
+    // Not thread-safe, call before the producer and consumer start
+    void Configure(size_t capacity, uint32_t min_depth, uint32_t max_depth);
+    bool Push(std::unique_ptr<AudioStreamPacket> packet, int64_t now_us);
+    // output_starving: the speaker has nothing left to play, so a missing packet has to be concealed now
+    AudioJitterResult Pop(std::unique_ptr<AudioStreamPacket>& packet, int64_t now_us, bool output_starving,
+        int64_t& wait_us);
+    // Called when packets arrive while the speaker has nothing left to play
+    void OnOutputUnderrun(int64_t now_us);
+    // The server finished sending the stream, the buffered packets are still played. Reset() starts a new one.
+    void EndStream();
+    void Reset();
+    bool empty() const;
+    bool IsPlaying() const;
+    AudioJitterStats GetStats() const;
+
+private:
+    mutable std::mutex mutex_;
+    std::vector<std::unique_ptr<AudioStreamPacket>> slots_;
+    uint32_t min_depth_ = 1;
+    uint32_t max_depth_ = 1;
+
+    size_t count_ = 0;
+    bool has_base_ = false;         // next_sequence_ is valid
+    bool playing_ = false;
+    bool ended_ = false;            // No more packets are expected, see EndStream()
+    bool starved_ = false;          // Ran dry while playing, waiting to see whether the stream continues
+    int64_t starved_since_us_ = 0;
+    uint32_t starved_concealed_ = 0;
+    uint32_t next_sequence_ = 0;    // Next sequence to play
+    uint32_t highest_sequence_ = 0;
+    uint32_t auto_sequence_ = 0;    // For packets without a sequence number
+    int64_t buffering_since_us_ = 0;
+    int64_t frame_us_ = 60000;
+
+    // Interarrival jitter in microseconds, scaled by 16 as in RFC 3550
+    bool has_transit_ = false;
+    int64_t last_transit_us_ = 0;
+    int64_t jitter_x16_ = 0;
+
+    AudioJitterStats stats_;
+
+    void UpdateJitter(uint32_t sequence, int64_t now_us);
+    void Clear();
+};
+
+#endif // AUDIO_JITTER_BUFFER_H
@@ -0,0 +1,343 @@
+#include "audio_pcm_kernels.h"
+
+#include <sdkconfig.h>
+
+#if CONFIG_IDF_TARGET_ESP32S3
+#define PCM_KERNELS_PIE 1
+#define PIE_OP(op) "ee." op
+#elif CONFIG_IDF_TARGET_ESP32P4
+#define PCM_KERNELS_PIE 1
+#define PIE_OP(op) "esp." op
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#define PCM_KERNELS_SSE2 1
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#define PCM_KERNELS_NEON 1
+#endif
+
+// The SIMD paths work on blocks of 8 frames (one 128-bit register per channel)
+#define PCM_BLOCK_FRAMES 8
+
+const char* PcmKernelsBackend() {
+#if CONFIG_IDF_TARGET_ESP32S3
+    return "pie";
+#elif CONFIG_IDF_TARGET_ESP32P4
+    return "esp32p4";
+#elif PCM_KERNELS_SSE2
+    return "sse2";
+#elif PCM_KERNELS_NEON
+    return "neon";
+#else
+    return "scalar";
+#endif
+}
+
+void PcmDeinterleaveStereoScalar(const int16_t* input, int16_t* left, int16_t* right, size_t frames) {
+    for (size_t i = 0; i < frames; i++) {
+        left[i] = input[2 * i];
+        right[i] = input[2 * i + 1];
+    }
+}
+
+void PcmInterleaveStereoScalar(const int16_t* left, const int16_t* right, int16_t* output, size_t frames) {
+    for (size_t i = 0; i < frames; i++) {
+        output[2 * i] = left[i];
+        output[2 * i + 1] = right[i];
+    }
+}
+
+void PcmExtractChannelScalar(const int16_t* input, int16_t* output, size_t frames, int channels, int channel) {
+    for (size_t i = 0; i < frames; i++) {
+        output[i] = input[i * channels + channel];
+    }
+}
+
+#if PCM_KERNELS_PIE
+static inline bool IsAligned(const void* pointer) {
+    return (reinterpret_cast<uintptr_t>(pointer) & 15) == 0;
+}
+#endif
+
+/*
+ * Frames to hand to the portable code before the interleaved pointer reaches a 16-byte boundary.
+ * Only the PIE loads / stores need alignment, SSE2 and NEON use unaligned accesses.
+ */
+static inline size_t HeadFrames(const int16_t* interleaved, size_t frames) {
+#if PCM_KERNELS_PIE
+    uintptr_t address = reinterpret_cast<uintptr_t>(interleaved);
+    if (address & 3) {
+        return frames;
+    }
+    size_t head = ((16 - (address & 15)) & 15) / 4;
+    return head < frames ? head : frames;
+#else
+    return 0;
+#endif
+}
+
+// Returns the number of frames handled, always a multiple of PCM_BLOCK_FRAMES
+static size_t DeinterleaveBlocks(const int16_t* input, int16_t* left, int16_t* right, size_t frames) {
+    size_t blocks = frames / PCM_BLOCK_FRAMES;
+#if PCM_KERNELS_PIE
+    if (!IsAligned(input) || !IsAligned(left) || !IsAligned(right)) {
+        return 0;
+    }
+    for (size_t i = 0; i < blocks; i++) {
+        __asm__ volatile(
+            PIE_OP("vld.128.ip") " q0, %[in], 16\n"
+            PIE_OP("vld.128.ip") " q1, %[in], 16\n"
+            PIE_OP("vunzip.16") " q0, q1\n"
+            PIE_OP("vst.128.ip") " q0, %[left], 16\n"
+            PIE_OP("vst.128.ip") " q1, %[right], 16\n"
+            : [in] "+r"(input), [left] "+r"(left), [right] "+r"(right)
+            :
+            : "memory");
+    }
+#elif PCM_KERNELS_SSE2
+    for (size_t i = 0; i < blocks; i++, input += 16, left += 8, right += 8) {
+        __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(input));
+        __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(input + 8));
+        // Sign-extend the low (left) and high (right) half of every 32-bit frame, then pack
+        __m128i left_a = _mm_srai_epi32(_mm_slli_epi32(a, 16), 16);
+        __m128i left_b = _mm_srai_epi32(_mm_slli_epi32(b, 16), 16);
+        __m128i right_a = _mm_srai_epi32(a, 16);
+        __m128i right_b = _mm_srai_epi32(b, 16);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(left), _mm_packs_epi32(left_a, left_b));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(right), _mm_packs_epi32(right_a, right_b));
+    }
+#elif PCM_KERNELS_NEON
+    for (size_t i = 0; i < blocks; i++, input += 16, left += 8, right += 8) {
+        int16x8x2_t frame = vld2q_s16(input);
+        vst1q_s16(left, frame.val[0]);
+        vst1q_s16(right, frame.val[1]);
+    }
+#else
+    blocks = 0;
+#endif
+    return blocks * PCM_BLOCK_FRAMES;
+}
+
+static size_t InterleaveBlocks(const int16_t* left, const int16_t* right, int16_t* output, size_t frames) {
+    size_t blocks = frames / PCM_BLOCK_FRAMES;
+#if PCM_KERNELS_PIE
+    if (!IsAligned(output) || !IsAligned(left) || !IsAligned(right)) {
+        return 0;
+    }
+    for (size_t i = 0; i < blocks; i++) {
+        __asm__ volatile(
+            PIE_OP("vld.128.ip") " q0, %[left], 16\n"
+            PIE_OP("vld.128.ip") " q1, %[right], 16\n"
+            PIE_OP("vzip.16") " q0, q1\n"
+            PIE_OP("vst.128.ip") " q0, %[out], 16\n"
+            PIE_OP("vst.128.ip") " q1, %[out], 16\n"
+            : [left] "+r"(left), [right] "+r"(right), [out] "+r"(output)
+            :
+            : "memory");
+    }
+#elif PCM_KERNELS_SSE2
+    for (size_t i = 0; i < blocks; i++, left += 8, right += 8, output += 16) {
+        __m128i l = _mm_loadu_si128(reinterpret_cast<const __m128i*>(left));
+        __m128i r = _mm_loadu_si128(reinterpret_cast<const __m128i*>(right));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(output), _mm_unpacklo_epi16(l, r));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(output + 8), _mm_unpackhi_epi16(l, r));
+    }
+#elif PCM_KERNELS_NEON
+    for (size_t i = 0; i < blocks; i++, left += 8, right += 8, output += 16) {
+        int16x8x2_t frame = { vld1q_s16(left), vld1q_s16(right) };
+        vst2q_s16(output, frame);
+    }
+#else
+    blocks = 0;
+#endif
+    return blocks * PCM_BLOCK_FRAMES;
+}
+
+// Stereo only. Stores trail the loads, so output may alias input.
+static size_t ExtractStereoBlocks(const int16_t* input, int16_t* output, size_t frames, int channel) {
+    size_t blocks = frames / PCM_BLOCK_FRAMES;
+#if PCM_KERNELS_PIE
+    if (!IsAligned(input) || !IsAligned(output)) {
+        return 0;
+    }
+    for (size_t i = 0; i < blocks; i++) {
+        if (channel == 0) {
+            __asm__ volatile(
+                PIE_OP("vld.128.ip") " q0, %[in], 16\n"
+                PIE_OP("vld.128.ip") " q1, %[in], 16\n"
+                PIE_OP("vunzip.16") " q0, q1\n"
+                PIE_OP("vst.128.ip") " q0, %[out], 16\n"
+                : [in] "+r"(input), [out] "+r"(output)
+                :
+                : "memory");
+        } else {
+            __asm__ volatile(
+                PIE_OP("vld.128.ip") " q0, %[in], 16\n"
+                PIE_OP("vld.128.ip") " q1, %[in], 16\n"
+                PIE_OP("vunzip.16") " q0, q1\n"
+                PIE_OP("vst.128.ip") " q1, %[out], 16\n"
+                : [in] "+r"(input), [out] "+r"(output)
+                :
+                : "memory");
+        }
+    }
+#elif PCM_KERNELS_SSE2
+    for (size_t i = 0; i < blocks; i++, input += 16, output += 8) {
+        __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(input));
+        __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(input + 8));
+        if (channel == 0) {
+            a = _mm_slli_epi32(a, 16);
+            b = _mm_slli_epi32(b, 16);
+        }
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(output),
+            _mm_packs_epi32(_mm_srai_epi32(a, 16), _mm_srai_epi32(b, 16)));
+    }
+#elif PCM_KERNELS_NEON
+    for (size_t i = 0; i < blocks; i++, input += 16, output += 8) {
+        int16x8x2_t frame = vld2q_s16(input);
+        vst1q_s16(output, channel == 0 ? frame.val[0] : frame.val[1]);
+    }
+#else
+    blocks = 0;
+#endif
+    return blocks * PCM_BLOCK_FRAMES;
+}
+
+void PcmDeinterleaveStereo(const int16_t* input, int16_t* left, int16_t* right, size_t frames) {
+    size_t done = HeadFrames(input, frames);
+    PcmDeinterleaveStereoScalar(input, left, right, done);
+    done += DeinterleaveBlocks(input + 2 * done, left + done, right + done, frames - done);
+    PcmDeinterleaveStereoScalar(input + 2 * done, left + done, right + done, frames - done);
+}
+
+void PcmInterleaveStereo(const int16_t* left, const int16_t* right, int16_t* output, size_t frames) {
+    size_t done = HeadFrames(output, frames);
+    PcmInterleaveStereoScalar(left, right, output, done);
+    done += InterleaveBlocks(left + done, right + done, output + 2 * done, frames - done);
+    PcmInterleaveStereoScalar(left + done, right + done, output + 2 * done, frames - done);
+}
+
+void PcmExtractChannel(const int16_t* input, int16_t* output, size_t frames, int channels, int channel) {
+    if (channels != 2) {
+        PcmExtractChannelScalar(input, output, frames, channels, channel);
+        return;
+    }
+    size_t done = HeadFrames(input, frames);
+    PcmExtractChannelScalar(input, output, done, 2, channel);
+    done += ExtractStereoBlocks(input + 2 * done, output + done, frames - done, channel);
+    PcmExtractChannelScalar(input + 2 * done, output + done, frames - done, 2, channel);
+}
+
+int32_t PcmVolumeToGainQ16(int volume) {
+    if (volume <= 0) {
+        return 0;
+    }
+    if (volume >= 100) {
+        return 1 << 16;
+    }
+    return volume * volume * 65536 / 10000;
+}
+
+static inline int16_t SaturateSymmetric16(int32_t value) {
+    return value > INT16_MAX ? INT16_MAX : value < -INT16_MAX ? -INT16_MAX : (int16_t)value;
+}
+
+void PcmScale16To32Scalar(const int16_t* input, int32_t* output, size_t samples, int32_t gain_q16) {
+    for (size_t i = 0; i < samples; i++) {
+        output[i] = (int32_t)input[i] * gain_q16;
+    }
+}
+
+void PcmNarrow32To16Scalar(const int32_t* input, int16_t* output, size_t samples, int shift) {
+    for (size_t i = 0; i < samples; i++) {
+        output[i] = SaturateSymmetric16(input[i] >> shift);
+    }
+}
+
+void PcmApplyGainScalar(int16_t* data, size_t samples, int32_t gain_q8) {
+    for (size_t i = 0; i < samples; i++) {
+        data[i] = SaturateSymmetric16((data[i] * gain_q8) >> 8);
+    }
+}
+
+void PcmScale16To32(const int16_t* input, int32_t* output, size_t samples, int32_t gain_q16) {
+    size_t done = 0;
+#if PCM_KERNELS_SSE2
+    if (gain_q16 < 65536) {
+        // 16 x 16 -> 32 bit products from mullo / mulhi, correcting mulhi_epu16 for negative samples
+        __m128i gain = _mm_set1_epi16((int16_t)gain_q16);
+        for (; done + 8 <= samples; done += 8) {
+            __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(input + done));
+            __m128i low = _mm_mullo_epi16(x, gain);
+            __m128i high = _mm_sub_epi16(_mm_mulhi_epu16(x, gain), _mm_and_si128(_mm_srai_epi16(x, 15), gain));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(output + done), _mm_unpacklo_epi16(low, high));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(output + done + 4), _mm_unpackhi_epi16(low, high));
+        }
+    } else {
+        __m128i zero = _mm_setzero_si128();
+        for (; done + 8 <= samples; done += 8) {
+            __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(input + done));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(output + done), _mm_unpacklo_epi16(zero, x));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(output + done + 4), _mm_unpackhi_epi16(zero, x));
+        }
+    }
+#elif PCM_KERNELS_NEON
+    for (; done + 8 <= samples; done += 8) {
+        int16x8_t x = vld1q_s16(input + done);
+        vst1q_s32(output + done, vmulq_n_s32(vmovl_s16(vget_low_s16(x)), gain_q16));
+        vst1q_s32(output + done + 4, vmulq_n_s32(vmovl_s16(vget_high_s16(x)), gain_q16));
+    }
+#endif
+    PcmScale16To32Scalar(input + done, output + done, samples - done, gain_q16);
+}
+
+void PcmNarrow32To16(const int32_t* input, int16_t* output, size_t samples, int shift) {
+    size_t done = 0;
+#if PCM_KERNELS_SSE2
+    __m128i count = _mm_cvtsi32_si128(shift);
+    __m128i minimum = _mm_set1_epi16(-INT16_MAX);
+    for (; done + 8 <= samples; done += 8) {
+        __m128i a = _mm_sra_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(input + done)), count);
+        __m128i b = _mm_sra_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(input + done + 4)), count);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(output + done), _mm_max_epi16(_mm_packs_epi32(a, b), minimum));
+    }
+#elif PCM_KERNELS_NEON
+    int32x4_t count = vdupq_n_s32(-shift);
+    int16x8_t minimum = vdupq_n_s16(-INT16_MAX);
+    for (; done + 8 <= samples; done += 8) {
+        int16x4_t a = vqmovn_s32(vshlq_s32(vld1q_s32(input + done), count));
+        int16x4_t b = vqmovn_s32(vshlq_s32(vld1q_s32(input + done + 4), count));
+        vst1q_s16(output + done, vmaxq_s16(vcombine_s16(a, b), minimum));
+    }
+#endif
+    PcmNarrow32To16Scalar(input + done, output + done, samples - done, shift);
+}
+
+void PcmApplyGain(int16_t* data, size_t samples, int32_t gain_q8) {
+    size_t done = 0;
+#if PCM_KERNELS_SSE2
+    if (gain_q8 <= INT16_MAX) {
+        __m128i gain = _mm_set1_epi16((int16_t)gain_q8);
+        __m128i minimum = _mm_set1_epi16(-INT16_MAX);
+        for (; done + 8 <= samples; done += 8) {
+            __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + done));
+            __m128i low = _mm_mullo_epi16(x, gain);
+            __m128i high = _mm_mulhi_epi16(x, gain);
+            __m128i a = _mm_srai_epi32(_mm_unpacklo_epi16(low, high), 8);
+            __m128i b = _mm_srai_epi32(_mm_unpackhi_epi16(low, high), 8);
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(data + done), _mm_max_epi16(_mm_packs_epi32(a, b), minimum));
+        }
+    }
+#elif PCM_KERNELS_NEON
+    if (gain_q8 <= INT16_MAX) {
+        int16x8_t minimum = vdupq_n_s16(-INT16_MAX);
+        for (; done + 8 <= samples; done += 8) {
+            int16x8_t x = vld1q_s16(data + done);
+            int16x4_t a = vqshrn_n_s32(vmull_n_s16(vget_low_s16(x), (int16_t)gain_q8), 8);
+            int16x4_t b = vqshrn_n_s32(vmull_n_s16(vget_high_s16(x), (int16_t)gain_q8), 8);
+            vst1q_s16(data + done, vmaxq_s16(vcombine_s16(a, b), minimum));
+        }
+    }
+#endif
+    PcmApplyGainScalar(data + done, samples - done, gain_q8);
+}
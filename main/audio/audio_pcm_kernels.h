@@ -0,0 +1,47 @@
+#ifndef AUDIO_PCM_KERNELS_H
+#define AUDIO_PCM_KERNELS_H
+
+#include <cstddef>
+#include <cstdint>
+
+/*
+ * Sample-format kernels for the audio pipeline.
+ *
+ * Every kernel has a portable implementation and, where the target has one, a SIMD path:
+ * PIE on ESP32-S3, the AI extension on ESP32-P4, SSE2 / NEON on the host build. The SIMD path
+ * is taken for the 16-byte aligned middle of a buffer; the unaligned head and the tail go
+ * through the portable code, so any pointer and length are accepted.
+ *
+ * The gain / format kernels are plain 32-bit integer loops on Xtensa and RISC-V (one MULL and
+ * a CLAMPS per sample), with SSE2 / NEON versions on the host.
+ */
+
+// "pie", "esp32p4", "sse2", "neon" or "scalar"
+const char* PcmKernelsBackend();
+
+// Split interleaved stereo into two planar channels
+void PcmDeinterleaveStereo(const int16_t* input, int16_t* left, int16_t* right, size_t frames);
+// Merge two planar channels into interleaved stereo
+void PcmInterleaveStereo(const int16_t* left, const int16_t* right, int16_t* output, size_t frames);
+// Copy one channel out of interleaved frames, output may be the same buffer as input
+void PcmExtractChannel(const int16_t* input, int16_t* output, size_t frames, int channels, int channel);
+
+
+// Speaker volume (0-100, squared curve) as a Q16 gain in [0, 65536]
+int32_t PcmVolumeToGainQ16(int volume);
+// output = input * gain_q16, gain_q16 in [0, 65536], so the result always fits in 32 bits
+void PcmScale16To32(const int16_t* input, int32_t* output, size_t samples, int32_t gain_q16);
+// output = input >> shift, saturated to [-INT16_MAX, INT16_MAX]
+void PcmNarrow32To16(const int32_t* input, int16_t* output, size_t samples, int shift);
+// data = data * gain_q8 / 256 in place, saturated to [-INT16_MAX, INT16_MAX]
+void PcmApplyGain(int16_t* data, size_t samples, int32_t gain_q8);
+
+// Portable versions, also used by the host micro-benchmark as the reference
+void PcmDeinterleaveStereoScalar(const int16_t* input, int16_t* left, int16_t* right, size_t frames);
+void PcmInterleaveStereoScalar(const int16_t* left, const int16_t* right, int16_t* output, size_t frames);
+void PcmExtractChannelScalar(const int16_t* input, int16_t* output, size_t frames, int channels, int channel);
+void PcmScale16To32Scalar(const int16_t* input, int32_t* output, size_t samples, int32_t gain_q16);
+void PcmNarrow32To16Scalar(const int32_t* input, int16_t* output, size_t samples, int shift);
+void PcmApplyGainScalar(int16_t* data, size_t samples, int32_t gain_q8);
+
+#endif // AUDIO_PCM_KERNELS_H
@@ -13,6 +13,8 @@ public:
     virtual ~AudioProcessor() = default;
     
     virtual void Initialize(AudioCodec* codec, int frame_duration_ms, srmodel_list_t* models_list) = 0;
+    // Changes the size of the output frames, only call while the processor is stopped
+    virtual void SetOutputFrameDuration(int frame_duration_ms) = 0;
     virtual void Feed(std::vector<int16_t>&& data) = 0;
     virtual void Start() = 0;
     virtual void Stop() = 0;
@@ -0,0 +1,192 @@
+#ifndef AUDIO_RING_QUEUE_H
+#define AUDIO_RING_QUEUE_H
+
+#include <atomic>
+#include <memory>
+#include <cstddef>
+#include <cstdint>
+
+/*
+ * Fixed-capacity single-producer / single-consumer ring buffer for the audio pipeline.
+ *
+ * Push() must only be called from the producer task and Pop() only from the consumer task,
+ * so neither side takes a lock. Flush() may be called from any task: it marks everything
+ * pushed so far as stale, and the consumer releases those items on its next Pop().
+ *
+ * Resize() allocates the slots once; SetLimit() lowers the usable depth at runtime (e.g. when
+ * the frame duration changes) without reallocating.
+ *
+ * The queue never blocks. The owner pairs it with event group bits and waits on them when
+ * the queue is empty or full, then records the time spent waiting with RecordProducerWait()
+ * or RecordConsumerWait(). A producer that waits retries with TryPush(), which does not count
+ * the full queue as a drop.
+ */
+
+struct AudioQueueStats {
+    uint32_t capacity = 0;          // Usable depth, the limit set by SetLimit()
+    uint32_t size = 0;
+    uint32_t high_watermark = 0;
+    uint32_t push_count = 0;
+    uint32_t pop_count = 0;
+    uint32_t drop_count = 0;        // Items discarded because the queue was full
+    uint32_t flush_count = 0;       // Items discarded by Flush()
+    uint32_t producer_waits = 0;    // Times the producer had to wait for space
+    uint64_t producer_wait_us = 0;
+    uint32_t consumer_waits = 0;    // Times the consumer had to wait for data
+    uint64_t consumer_wait_us = 0;
+};
+
+template <typename T>
+class AudioRingQueue {
+public:
+    AudioRingQueue() = default;
+    explicit AudioRingQueue(size_t capacity) { Resize(capacity); }
+    AudioRingQueue(const AudioRingQueue&) = delete;
+    AudioRingQueue& operator=(const AudioRingQueue&) = delete;
+
+    // Not thread-safe, only call while neither the producer nor the consumer is running
+    void Resize(size_t capacity) {
+        slots_ = std::make_unique<T[]>(capacity);
+        capacity_ = capacity;
+        limit_.store(capacity, std::memory_order_relaxed);
+        head_.store(0, std::memory_order_relaxed);
+        tail_.store(0, std::memory_order_relaxed);
+        flush_.store(0, std::memory_order_relaxed);
+    }
+
+    // Items already queued beyond a lowered limit stay until they are popped
+    void SetLimit(size_t limit) {
+        limit_.store(limit < capacity_ ? limit : capacity_, std::memory_order_release);
+    }
+
+    // Counts a drop when the queue is full, for producers that discard the item then
+    bool Push(T&& item) {
+        if (!TryPush(std::move(item))) {
+            drop_count_.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+        return true;
+    }
+
+    // Leaves the item untouched when the queue is full, for producers that wait and retry
+    bool TryPush(T&& item) {
+        size_t tail = tail_.load(std::memory_order_relaxed);
+        size_t head = head_.load(std::memory_order_acquire);
+        if (tail - head >= limit_.load(std::memory_order_acquire)) {
+            return false;
+        }
+        slots_[tail % capacity_] = std::move(item);
+        tail_.store(tail + 1, std::memory_order_release);
+
+        push_count_.fetch_add(1, std::memory_order_relaxed);
+        uint32_t used = tail + 1 - head;
+        if (used > high_watermark_.load(std::memory_order_relaxed)) {
+            high_watermark_.store(used, std::memory_order_relaxed);
+        }
+        return true;
+    }
+
+    bool Pop(T& item) {
+        size_t head = head_.load(std::memory_order_relaxed);
+        size_t tail = tail_.load(std::memory_order_acquire);
+        size_t flush = flush_.load(std::memory_order_acquire);
+
+        /* Release the items that were flushed since the last pop */
+        while (head != tail && static_cast<ptrdiff_t>(flush - head) > 0) {
+            slots_[head % capacity_] = T();
+            head++;
+            flush_count_.fetch_add(1, std::memory_order_relaxed);
+        }
+        if (head == tail) {
+            head_.store(head, std::memory_order_release);
+            return false;
+        }
+
+        item = std::move(slots_[head % capacity_]);
+        head_.store(head + 1, std::memory_order_release);
+        pop_count_.fetch_add(1, std::memory_order_relaxed);
+        return true;
+    }
+
+    void Flush() {
+        size_t tail = tail_.load(std::memory_order_acquire);
+        size_t flush = flush_.load(std::memory_order_relaxed);
+        while (static_cast<ptrdiff_t>(tail - flush) > 0 &&
+            !flush_.compare_exchange_weak(flush, tail, std::memory_order_acq_rel)) {
+        }
+    }
+
+    // Number of live items, stale items waiting to be released by the consumer are not counted
+    size_t size() const {
+        size_t head = head_.load(std::memory_order_acquire);
+        size_t tail = tail_.load(std::memory_order_acquire);
+        size_t flush = flush_.load(std::memory_order_acquire);
+        if (static_cast<ptrdiff_t>(flush - head) > 0) {
+            head = flush;
+        }
+        return static_cast<ptrdiff_t>(tail - head) > 0 ? tail - head : 0;
+    }
+
+    bool empty() const { return size() == 0; }
+
+    // True if the producer cannot push, stale slots still occupy space until the consumer pops
+    bool full() const {
+        return tail_.load(std::memory_order_acquire) - head_.load(std::memory_order_acquire) >=
+            limit_.load(std::memory_order_acquire);
+    }
+
+    size_t capacity() const { return capacity_; }
+    size_t limit() const { return limit_.load(std::memory_order_relaxed); }
+
+    void RecordDrop() {
+        drop_count_.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    void RecordProducerWait(int64_t us) {
+        producer_waits_.fetch_add(1, std::memory_order_relaxed);
+        producer_wait_us_.fetch_add(us, std::memory_order_relaxed);
+    }
+
+    void RecordConsumerWait(int64_t us) {
+        consumer_waits_.fetch_add(1, std::memory_order_relaxed);
+        consumer_wait_us_.fetch_add(us, std::memory_order_relaxed);
+    }
+
+    AudioQueueStats GetStats() const {
+        AudioQueueStats stats;
+        stats.capacity = limit_.load(std::memory_order_relaxed);
+        stats.size = size();
+        stats.high_watermark = high_watermark_.load(std::memory_order_relaxed);
+        stats.push_count = push_count_.load(std::memory_order_relaxed);
+        stats.pop_count = pop_count_.load(std::memory_order_relaxed);
+        stats.drop_count = drop_count_.load(std::memory_order_relaxed);
+        stats.flush_count = flush_count_.load(std::memory_order_relaxed);
+        stats.producer_waits = producer_waits_.load(std::memory_order_relaxed);
+        stats.producer_wait_us = producer_wait_us_.load(std::memory_order_relaxed);
+        stats.consumer_waits = consumer_waits_.load(std::memory_order_relaxed);
+        stats.consumer_wait_us = consumer_wait_us_.load(std::memory_order_relaxed);
+        return stats;
+    }
+
+private:
+    std::unique_ptr<T[]> slots_;
+    size_t capacity_ = 0;
+    std::atomic<size_t> limit_{0};
+
+    // Monotonic positions, the slot index is position % capacity_
+    std::atomic<size_t> head_{0};
+    std::atomic<size_t> tail_{0};
+    std::atomic<size_t> flush_{0};
+
+    std::atomic<uint32_t> high_watermark_{0};
+    std::atomic<uint32_t> push_count_{0};
+    std::atomic<uint32_t> pop_count_{0};
+    std::atomic<uint32_t> drop_count_{0};
+    std::atomic<uint32_t> flush_count_{0};
+    std::atomic<uint32_t> producer_waits_{0};
+    std::atomic<uint64_t> producer_wait_us_{0};
+    std::atomic<uint32_t> consumer_waits_{0};
+    std::atomic<uint64_t> consumer_wait_us_{0};
+};
+
+#endif // AUDIO_RING_QUEUE_H
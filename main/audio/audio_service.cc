@@ -1,6 +1,8 @@
 #include "audio_service.h"
+#include "audio_pcm_kernels.h"
 #include <esp_log.h>
 #include <cstring>
+#include <algorithm>
 
 #if CONFIG_USE_AUDIO_PROCESSOR
 #include "processors/afe_audio_processor.h"
@@ -20,6 +22,19 @@
 
 AudioService::AudioService() {
     event_group_ = xEventGroupCreate();
+
+    /*
+     * Packet queues are allocated for the shortest frame duration, SetStreamParams() limits
+     * the send queue to the depth that matches the session's frame duration.
+     */
+    audio_encode_queue_.Resize(MAX_ENCODE_TASKS_IN_QUEUE);
+    audio_send_queue_.Resize(MAX_SEND_PACKETS_IN_QUEUE(OPUS_MIN_FRAME_DURATION_MS));
+    audio_send_queue_.SetLimit(MAX_SEND_PACKETS_IN_QUEUE(OPUS_FRAME_DURATION_MS));
+    audio_playback_queue_.Resize(MAX_PLAYBACK_TASKS_IN_QUEUE);
+    audio_testing_queue_.Resize(MAX_TESTING_PACKETS_IN_QUEUE);
+    // The decode queue also receives the whole audio testing recording when testing stops
+    audio_decode_queue_.Resize(std::max(MAX_DECODE_PACKETS_IN_QUEUE(OPUS_MIN_FRAME_DURATION_MS), MAX_TESTING_PACKETS_IN_QUEUE));
+    jitter_buffer_.Configure(MAX_DECODE_PACKETS_IN_QUEUE(OPUS_MIN_FRAME_DURATION_MS), JITTER_BUFFER_MIN_DEPTH, JITTER_BUFFER_MAX_DEPTH);
 }
 
 AudioService::~AudioService() {
@@ -36,12 +51,23 @@ void AudioService::Initialize(AudioCodec* codec) {
     /* Setup the audio codec */
     opus_decoder_ = std::make_unique<OpusDecoderWrapper>(codec->output_sample_rate(), 1, OPUS_FRAME_DURATION_MS);
     opus_encoder_ = std::make_unique<OpusEncoderWrapper>(16000, 1, OPUS_FRAME_DURATION_MS);
-    opus_encoder_->SetComplexity(0);
-
-    if (codec->input_sample_rate() != 16000) {
-        input_resampler_.Configure(codec->input_sample_rate(), 16000);
-        reference_resampler_.Configure(codec->input_sample_rate(), 16000);
-    }
+    opus_encoder_->SetComplexity(stream_params_.complexity);
+    opus_encode_buffer_.reserve(MAX_OPUS_PACKET_SIZE);
+
+    /*
+     * Frames in flight: both queues, one frame held by each of the producer, the Opus task (encode
+     * and decode) and the output task. Opus packets cover the send queue, the packets being sent
+     * and the one being encoded.
+     */
+    int max_sample_rate = std::max(16000, codec->output_sample_rate());
+    frame_pool_.Initialize(MAX_ENCODE_TASKS_IN_QUEUE + MAX_PLAYBACK_TASKS_IN_QUEUE + 4,
+        OPUS_FRAME_DURATION_MS * max_sample_rate / 1000,
+        MAX_SEND_PACKETS_IN_QUEUE(OPUS_FRAME_DURATION_MS) + MAX_SEND_PACKETS_IN_FLIGHT + 1,
+        OPUS_FRAME_MAX_BYTES(OPUS_FRAME_DURATION_MS) + AUDIO_PACKET_HEADROOM);
+    // Network audio is decrypted or copied straight into these, the jitter buffer releases them
+    incoming_packet_pool_.Initialize(0, 0, MAX_INCOMING_PACKETS_IN_POOL, OPUS_FRAME_MAX_BYTES(OPUS_FRAME_DURATION_MS));
+
+    input_converter_.Configure(codec->input_sample_rate(), 16000, codec->input_channels());
 
 #if CONFIG_USE_AUDIO_PROCESSOR
     audio_processor_ = std::make_unique<AfeAudioProcessor>();
@@ -124,12 +150,18 @@ void AudioService::Stop() {
         AS_EVENT_WAKE_WORD_RUNNING |
         AS_EVENT_AUDIO_PROCESSOR_RUNNING);
 
-    std::lock_guard<std::mutex> lock(audio_queue_mutex_);
-    audio_encode_queue_.clear();
-    audio_decode_queue_.clear();
-    audio_playback_queue_.clear();
-    audio_testing_queue_.clear();
-    audio_queue_cv_.notify_all();
+    audio_encode_queue_.Flush();
+    audio_decode_queue_.Flush();
+    audio_playback_queue_.Flush();
+    audio_testing_queue_.Flush();
+    jitter_buffer_.Reset();
+    {
+        std::lock_guard<std::mutex> lock(sound_mutex_);
+        sound_queue_.clear();
+        sound_flushed_ = true;
+    }
+    // Wake up every task blocked on a queue so it can see service_stopped_
+    xEventGroupSetBits(event_group_, AS_EVENT_ALL_QUEUES);
 }
 
 bool AudioService::ReadAudioData(std::vector<int16_t>& data, int sample_rate, int samples) {
@@ -139,32 +171,13 @@ bool AudioService::ReadAudioData(std::vector<int16_t>& data, int sample_rate, in
         codec_->EnableInput(true);
     }
 
+    int64_t start_time = esp_timer_get_time();
     if (codec_->input_sample_rate() != sample_rate) {
         data.resize(samples * codec_->input_sample_rate() / sample_rate * codec_->input_channels());
         if (!codec_->InputData(data)) {
             return false;
         }
-        if (codec_->input_channels() == 2) {
-            auto mic_channel = std::vector<int16_t>(data.size() / 2);
-            auto reference_channel = std::vector<int16_t>(data.size() / 2);
-            for (size_t i = 0, j = 0; i < mic_channel.size(); ++i, j += 2) {
-                mic_channel[i] = data[j];
-                reference_channel[i] = data[j + 1];
-            }
-            auto resampled_mic = std::vector<int16_t>(input_resampler_.GetOutputSamples(mic_channel.size()));
-            auto resampled_reference = std::vector<int16_t>(reference_resampler_.GetOutputSamples(reference_channel.size()));
-            input_resampler_.Process(mic_channel.data(), mic_channel.size(), resampled_mic.data());
-            reference_resampler_.Process(reference_channel.data(), reference_channel.size(), resampled_reference.data());
-            data.resize(resampled_mic.size() + resampled_reference.size());
-            for (size_t i = 0, j = 0; i < resampled_mic.size(); ++i, j += 2) {
-                data[j] = resampled_mic[i];
-                data[j + 1] = resampled_reference[i];
-            }
-        } else {
-            auto resampled = std::vector<int16_t>(input_resampler_.GetOutputSamples(data.size()));
-            input_resampler_.Process(data.data(), data.size(), resampled.data());
-            data = std::move(resampled);
-        }
+        input_converter_.Process(data);
     } else {
         data.resize(samples * codec_->input_channels());
         if (!codec_->InputData(data)) {
@@ -175,6 +188,7 @@ bool AudioService::ReadAudioData(std::vector<int16_t>& data, int sample_rate, in
     /* Update the last input time */
     last_input_time_ = std::chrono::steady_clock::now();
     debug_statistics_.input_count++;
+    pipeline_statistics_.read.Add(esp_timer_get_time() - start_time);
 
 #if CONFIG_USE_AUDIO_DEBUGGER
     // 音频调试：发送原始音频数据
@@ -204,34 +218,31 @@ void AudioService::AudioInputTask() {
 
         /* Used for audio testing in NetworkConfiguring mode by clicking the BOOT button */
         if (bits & AS_EVENT_AUDIO_TESTING_RUNNING) {
-            if (audio_testing_queue_.size() >= AUDIO_TESTING_MAX_DURATION_MS / OPUS_FRAME_DURATION_MS) {
+            if (audio_testing_queue_.size() >= MAX_TESTING_PACKETS_IN_QUEUE) {
                 ESP_LOGW(TAG, "Audio testing queue is full, stopping audio testing");
                 EnableAudioTesting(false);
                 continue;
             }
-            std::vector<int16_t> data;
             int samples = OPUS_FRAME_DURATION_MS * 16000 / 1000;
-            if (ReadAudioData(data, 16000, samples)) {
+            if (ReadAudioData(input_buffer_, 16000, samples)) {
                 // If input channels is 2, we need to fetch the left channel data
                 if (codec_->input_channels() == 2) {
-                    auto mono_data = std::vector<int16_t>(data.size() / 2);
-                    for (size_t i = 0, j = 0; i < mono_data.size(); ++i, j += 2) {
-                        mono_data[i] = data[j];
-                    }
-                    data = std::move(mono_data);
+                    PcmExtractChannel(input_buffer_.data(), input_buffer_.data(), input_buffer_.size() / 2, 2, 0);
+                    input_buffer_.resize(input_buffer_.size() / 2);
                 }
-                PushTaskToEncodeQueue(kAudioTaskTypeEncodeToTestingQueue, std::move(data));
+                PushTaskToEncodeQueue(kAudioTaskTypeEncodeToTestingQueue, std::move(input_buffer_));
                 continue;
             }
         }
 
         /* Feed the wake word */
         if (bits & AS_EVENT_WAKE_WORD_RUNNING) {
-            std::vector<int16_t> data;
             int samples = wake_word_->GetFeedSize();
             if (samples > 0) {
-                if (ReadAudioData(data, 16000, samples)) {
-                    wake_word_->Feed(data);
+                if (ReadAudioData(input_buffer_, 16000, samples)) {
+                    int64_t start_time = esp_timer_get_time();
+                    wake_word_->Feed(input_buffer_);
+                    pipeline_statistics_.process.Add(esp_timer_get_time() - start_time);
                     continue;
                 }
             }
@@ -239,11 +250,13 @@ void AudioService::AudioInputTask() {
 
         /* Feed the audio processor */
         if (bits & AS_EVENT_AUDIO_PROCESSOR_RUNNING) {
-            std::vector<int16_t> data;
             int samples = audio_processor_->GetFeedSize();
             if (samples > 0) {
-                if (ReadAudioData(data, 16000, samples)) {
-                    audio_processor_->Feed(std::move(data));
+                if (ReadAudioData(input_buffer_, 16000, samples)) {
+                    // Includes the wait for encode queue space when the processor outputs synchronously
+                    int64_t start_time = esp_timer_get_time();
+                    audio_processor_->Feed(std::move(input_buffer_));
+                    pipeline_statistics_.process.Add(esp_timer_get_time() - start_time);
                     continue;
                 }
             }
@@ -258,16 +271,22 @@ void AudioService::AudioInputTask() {
 
 void AudioService::AudioOutputTask() {
     while (true) {
-        std::unique_lock<std::mutex> lock(audio_queue_mutex_);
-        audio_queue_cv_.wait(lock, [this]() { return !audio_playback_queue_.empty() || service_stopped_; });
         if (service_stopped_) {
             break;
         }
 
-        auto task = std::move(audio_playback_queue_.front());
-        audio_playback_queue_.pop_front();
-        audio_queue_cv_.notify_all();
-        lock.unlock();
+        std::unique_ptr<AudioTask> task;
+        if (!audio_playback_queue_.Pop(task)) {
+            output_starved_ = true;
+            // The pop may have released flushed slots that the Opus task is waiting for
+            xEventGroupSetBits(event_group_, AS_EVENT_PLAYBACK_QUEUE_SPACE);
+            audio_playback_queue_.RecordConsumerWait(WaitForQueueEvents(AS_EVENT_PLAYBACK_QUEUE_DATA));
+            continue;
+        }
+        output_starved_ = false;
+        xEventGroupSetBits(event_group_, AS_EVENT_PLAYBACK_QUEUE_SPACE);
+        int64_t start_time = esp_timer_get_time();
+        pipeline_statistics_.playback_queue.Add(start_time - task->enqueue_time_us);
 
         if (!codec_->output_enabled()) {
             esp_timer_stop(audio_power_timer_);
@@ -279,11 +298,12 @@ void AudioService::AudioOutputTask() {
         /* Update the last output time */
         last_output_time_ = std::chrono::steady_clock::now();
         debug_statistics_.playback_count++;
+        pipeline_statistics_.output.Add(esp_timer_get_time() - start_time);
 
 #if CONFIG_USE_SERVER_AEC
         /* Record the timestamp for server AEC */
         if (task->timestamp > 0) {
-            lock.lock();
+            std::lock_guard<std::mutex> lock(timestamp_mutex_);
             timestamp_queue_.push_back(task->timestamp);
         }
 #endif
@@ -294,83 +314,162 @@ void AudioService::AudioOutputTask() {
 
 void AudioService::OpusCodecTask() {
     while (true) {
-        std::unique_lock<std::mutex> lock(audio_queue_mutex_);
-        audio_queue_cv_.wait(lock, [this]() {
-            return service_stopped_ ||
-                (!audio_encode_queue_.empty() && audio_send_queue_.size() < MAX_SEND_PACKETS_IN_QUEUE) ||
-                (!audio_decode_queue_.empty() && audio_playback_queue_.size() < MAX_PLAYBACK_TASKS_IN_QUEUE);
-        });
         if (service_stopped_) {
             break;
         }
-
-        /* Decode the audio from decode queue */
-        if (!audio_decode_queue_.empty() && audio_playback_queue_.size() < MAX_PLAYBACK_TASKS_IN_QUEUE) {
-            auto packet = std::move(audio_decode_queue_.front());
-            audio_decode_queue_.pop_front();
-            audio_queue_cv_.notify_all();
-            lock.unlock();
-
-            auto task = std::make_unique<AudioTask>();
-            task->type = kAudioTaskTypeDecodeToPlaybackQueue;
-            task->timestamp = packet->timestamp;
-
-            SetDecodeSampleRate(packet->sample_rate, packet->frame_duration);
-            if (opus_decoder_->Decode(std::move(packet->payload), task->pcm)) {
+        bool busy = false;
+
+        /* Decode the audio from decode queue, local sounds, or the jitter buffer */
+        std::unique_ptr<AudioStreamPacket> packet;
+        AudioJitterResult jitter_result = kJitterEmpty;
+        int64_t jitter_wait_us = 0;
+        // Samples (at the decoder rate) to trim from sound packets, from the pre-skip and granule position
+        size_t trim_front = 0;
+        size_t keep_samples = SIZE_MAX;
+        OggOpusPacket sound_packet;
+        if (!audio_playback_queue_.full()) {
+            if (audio_decode_queue_.Pop(packet)) {
+                xEventGroupSetBits(event_group_, AS_EVENT_DECODE_QUEUE_SPACE);
+            } else if (PopSoundPacket(packet, sound_packet)) {
+                trim_front = (size_t)sound_packet.skip_samples * packet->sample_rate / 48000;
+                keep_samples = (size_t)sound_packet.keep_samples * packet->sample_rate / 48000;
+            } else {
+                jitter_result = jitter_buffer_.Pop(packet, esp_timer_get_time(), output_starved_, jitter_wait_us);
+            }
+        }
+        if (packet || jitter_result == kJitterConceal) {
+            busy = true;
+
+            int64_t start_time = esp_timer_get_time();
+            auto task = frame_pool_.AcquireTask(kAudioTaskTypeDecodeToPlaybackQueue);
+            bool decoded;
+            if (packet) {
+                task->timestamp = packet->timestamp;
+                SetDecodeSampleRate(packet->sample_rate, packet->frame_duration);
+                if (packet->headroom > 0) {
+                    packet->payload.erase(packet->payload.begin(), packet->payload.begin() + packet->headroom);
+                    packet->headroom = 0;
+                }
+                decoded = opus_decoder_->Decode(std::move(packet->payload), task->pcm);
+            } else {
+                // An empty payload makes Opus run packet loss concealment for one frame
+                decoded = opus_decoder_->Decode(std::vector<uint8_t>(), task->pcm);
+            }
+            if (decoded && (trim_front > 0 || keep_samples < task->pcm.size())) {
+                trim_front = std::min(trim_front, task->pcm.size());
+                task->pcm.erase(task->pcm.begin(), task->pcm.begin() + trim_front);
+                task->pcm.resize(std::min(keep_samples, task->pcm.size()));
+            }
+            if (decoded && !task->pcm.empty()) {
                 // Resample if the sample rate is different
                 if (opus_decoder_->sample_rate() != codec_->output_sample_rate()) {
-                    int target_size = output_resampler_.GetOutputSamples(task->pcm.size());
-                    std::vector<int16_t> resampled(target_size);
-                    output_resampler_.Process(task->pcm.data(), task->pcm.size(), resampled.data());
-                    task->pcm = std::move(resampled);
+                    output_resample_buffer_.resize(output_resampler_.GetOutputSamples(task->pcm.size()));
+                    output_resampler_.Process(task->pcm.data(), task->pcm.size(), output_resample_buffer_.data());
+                    task->pcm.swap(output_resample_buffer_);
                 }
 
-                lock.lock();
-                audio_playback_queue_.push_back(std::move(task));
-                audio_queue_cv_.notify_all();
-            } else {
+                task->enqueue_time_us = esp_timer_get_time();
+                pipeline_statistics_.decode.Add(task->enqueue_time_us - start_time);
+                if (audio_playback_queue_.Push(std::move(task))) {
+                    xEventGroupSetBits(event_group_, AS_EVENT_PLAYBACK_QUEUE_DATA);
+                }
+            } else if (!decoded) {
                 ESP_LOGE(TAG, "Failed to decode audio");
-                lock.lock();
             }
             debug_statistics_.decode_count++;
         }
-        
+
         /* Encode the audio to send queue */
-        if (!audio_encode_queue_.empty() && audio_send_queue_.size() < MAX_SEND_PACKETS_IN_QUEUE) {
-            auto task = std::move(audio_encode_queue_.front());
-            audio_encode_queue_.pop_front();
-            audio_queue_cv_.notify_all();
-            lock.unlock();
-
-            auto packet = std::make_unique<AudioStreamPacket>();
-            packet->frame_duration = OPUS_FRAME_DURATION_MS;
+        std::unique_ptr<AudioTask> task;
+        if (!audio_send_queue_.full() && audio_encode_queue_.Pop(task)) {
+            xEventGroupSetBits(event_group_, AS_EVENT_ENCODE_QUEUE_SPACE);
+            busy = true;
+            int64_t start_time = esp_timer_get_time();
+            pipeline_statistics_.encode_queue.Add(start_time - task->enqueue_time_us);
+
+            // The encoder follows the frames: a new session or audio testing may change their size
+            int frame_duration = task->pcm.size() * 1000 / 16000;
+            if (stream_params_changed_.exchange(false) || frame_duration != opus_encoder_->duration_ms()) {
+                ConfigureEncoder(frame_duration);
+            }
+
+            auto packet = frame_pool_.AcquirePacket();
+            packet->frame_duration = opus_encoder_->duration_ms();
             packet->sample_rate = 16000;
             packet->timestamp = task->timestamp;
-            if (!opus_encoder_->Encode(std::move(task->pcm), packet->payload)) {
+            if (!opus_encoder_->Encode(std::move(task->pcm), opus_encode_buffer_)) {
                 ESP_LOGE(TAG, "Failed to encode audio");
                 continue;
             }
+            /*
+             * The wrapper sizes its output for the largest possible packet, more than a pooled
+             * packet reserves, so it encodes into opus_encode_buffer_ and only the result is copied.
+             * Packets for the send queue get the headroom in front of the Opus data, so the protocol
+             * can put its header there instead of copying the packet into a new frame.
+             */
+            size_t headroom = task->type == kAudioTaskTypeEncodeToSendQueue ? AUDIO_PACKET_HEADROOM : 0;
+            packet->payload.resize(headroom + opus_encode_buffer_.size());
+            memcpy(packet->payload.data() + headroom, opus_encode_buffer_.data(), opus_encode_buffer_.size());
+            packet->headroom = headroom;
+            pipeline_statistics_.encode.Add(esp_timer_get_time() - start_time);
 
             if (task->type == kAudioTaskTypeEncodeToSendQueue) {
-                {
-                    std::lock_guard<std::mutex> lock(audio_queue_mutex_);
-                    audio_send_queue_.push_back(std::move(packet));
-                }
-                if (callbacks_.on_send_queue_available) {
+                packet->enqueue_time_us = esp_timer_get_time();
+                if (audio_send_queue_.Push(std::move(packet)) && callbacks_.on_send_queue_available) {
                     callbacks_.on_send_queue_available();
                 }
             } else if (task->type == kAudioTaskTypeEncodeToTestingQueue) {
-                std::lock_guard<std::mutex> lock(audio_queue_mutex_);
-                audio_testing_queue_.push_back(std::move(packet));
+                audio_testing_queue_.Push(std::move(packet));
             }
             debug_statistics_.encode_count++;
-            lock.lock();
+        }
+
+        if (!busy) {
+            /* Nothing to do, record which downstream queue is holding us back before sleeping */
+            bool playback_blocked = audio_playback_queue_.full() && !audio_decode_queue_.empty();
+            bool send_blocked = audio_send_queue_.full() && !audio_encode_queue_.empty();
+            // While the jitter buffer is filling up, wake up when its playout delay is over
+            TickType_t timeout = portMAX_DELAY;
+            if (jitter_result == kJitterWait) {
+                timeout = pdMS_TO_TICKS((jitter_wait_us + 999) / 1000);
+                if (timeout == 0) {
+                    timeout = 1;
+                }
+            }
+            int64_t waited_us = WaitForQueueEvents(AS_EVENT_DECODE_QUEUE_DATA | AS_EVENT_ENCODE_QUEUE_DATA |
+                AS_EVENT_PLAYBACK_QUEUE_SPACE | AS_EVENT_SEND_QUEUE_SPACE, timeout);
+            if (playback_blocked) {
+                audio_playback_queue_.RecordProducerWait(waited_us);
+            }
+            if (send_blocked) {
+                audio_send_queue_.RecordProducerWait(waited_us);
+            }
         }
     }
 
     ESP_LOGW(TAG, "Opus codec task stopped");
 }
 
+int64_t AudioService::WaitForQueueEvents(EventBits_t bits, TickType_t timeout) {
+    int64_t start_time = esp_timer_get_time();
+    xEventGroupWaitBits(event_group_, bits, pdTRUE, pdFALSE, timeout);
+    return esp_timer_get_time() - start_time;
+}
+
+void AudioService::FlushPlaybackQueues() {
+    {
+        std::lock_guard<std::mutex> lock(sound_mutex_);
+        sound_queue_.clear();
+        sound_flushed_ = true;
+    }
+    jitter_buffer_.Reset();
+    audio_decode_queue_.Flush();
+    audio_playback_queue_.Flush();
+    audio_testing_queue_.Flush();
+    // Wake up the consumers so that they release the flushed items and free the slots
+    xEventGroupSetBits(event_group_, AS_EVENT_DECODE_QUEUE_DATA | AS_EVENT_PLAYBACK_QUEUE_DATA);
+}
+
 void AudioService::SetDecodeSampleRate(int sample_rate, int frame_duration) {
     if (opus_decoder_->sample_rate() == sample_rate && opus_decoder_->duration_ms() == frame_duration) {
         return;
@@ -379,58 +478,137 @@ void AudioService::SetDecodeSampleRate(int sample_rate, int frame_duration) {
     opus_decoder_.reset();
     opus_decoder_ = std::make_unique<OpusDecoderWrapper>(sample_rate, 1, frame_duration);
 
-    auto codec = Board::GetInstance().GetAudioCodec();
-    if (opus_decoder_->sample_rate() != codec->output_sample_rate()) {
-        ESP_LOGI(TAG, "Resampling audio from %d to %d", opus_decoder_->sample_rate(), codec->output_sample_rate());
-        output_resampler_.Configure(opus_decoder_->sample_rate(), codec->output_sample_rate());
+    if (opus_decoder_->sample_rate() != codec_->output_sample_rate()) {
+        ESP_LOGI(TAG, "Resampling audio from %d to %d", opus_decoder_->sample_rate(), codec_->output_sample_rate());
+        output_resampler_.Configure(opus_decoder_->sample_rate(), codec_->output_sample_rate());
     }
 }
 
+void AudioService::ConfigureEncoder(int frame_duration) {
+    int complexity;
+    {
+        std::lock_guard<std::mutex> lock(stream_params_mutex_);
+        complexity = stream_params_.complexity;
+    }
+    if (frame_duration > 0 && opus_encoder_->duration_ms() != frame_duration) {
+        ESP_LOGI(TAG, "Encoding %dms frames", frame_duration);
+        opus_encoder_.reset();
+        opus_encoder_ = std::make_unique<OpusEncoderWrapper>(16000, 1, frame_duration);
+    }
+    opus_encoder_->SetComplexity(complexity);
+}
+
+void AudioService::SetStreamParams(const AudioStreamParams& params) {
+    {
+        std::lock_guard<std::mutex> lock(stream_params_mutex_);
+        if (params.frame_duration != stream_params_.frame_duration || params.complexity != stream_params_.complexity) {
+            stream_changes_++;
+        }
+        stream_params_ = params;
+    }
+    ESP_LOGI(TAG, "Stream params: %dms frames, complexity %d", params.frame_duration, params.complexity);
+
+    // The audio processor picks up the frame duration the next time voice processing starts
+    frame_duration_ = params.frame_duration;
+    stream_params_changed_ = true;
+
+    // Keep AUDIO_QUEUE_DURATION_MS of audio in the send queue and enough pooled packets to fill it
+    audio_send_queue_.SetLimit(MAX_SEND_PACKETS_IN_QUEUE(params.frame_duration));
+    frame_pool_.ResizePackets(MAX_SEND_PACKETS_IN_QUEUE(params.frame_duration) + MAX_SEND_PACKETS_IN_FLIGHT + 1,
+        OPUS_FRAME_MAX_BYTES(params.frame_duration) + AUDIO_PACKET_HEADROOM);
+    xEventGroupSetBits(event_group_, AS_EVENT_SEND_QUEUE_SPACE);
+}
+
+AudioStreamParams AudioService::GetStreamParams() const {
+    std::lock_guard<std::mutex> lock(stream_params_mutex_);
+    return stream_params_;
+}
+
+AudioPipelineStatistics AudioService::GetPipelineStatistics() const {
+    AudioPipelineStatistics statistics = pipeline_statistics_;
+    std::lock_guard<std::mutex> lock(stream_params_mutex_);
+    statistics.stream = stream_params_;
+    statistics.stream_changes = stream_changes_;
+    return statistics;
+}
+
 void AudioService::PushTaskToEncodeQueue(AudioTaskType type, std::vector<int16_t>&& pcm) {
-    auto task = std::make_unique<AudioTask>();
-    task->type = type;
-    task->pcm = std::move(pcm);
-    
-    /* Push the task to the encode queue */
-    std::unique_lock<std::mutex> lock(audio_queue_mutex_);
+    /*
+     * Swap instead of move: the caller gets the pooled frame's empty buffer back with its
+     * capacity, so the producer can refill it without allocating.
+     */
+    auto task = frame_pool_.AcquireTask(type);
+    task->pcm.swap(pcm);
 
     /* If the task is to send queue, we need to set the timestamp */
-    if (type == kAudioTaskTypeEncodeToSendQueue && !timestamp_queue_.empty()) {
-        if (timestamp_queue_.size() <= MAX_TIMESTAMPS_IN_QUEUE) {
-            task->timestamp = timestamp_queue_.front();
-        } else {
-            ESP_LOGW(TAG, "Timestamp queue (%u) is full, dropping timestamp", timestamp_queue_.size());
+    if (type == kAudioTaskTypeEncodeToSendQueue) {
+        std::lock_guard<std::mutex> lock(timestamp_mutex_);
+        if (!timestamp_queue_.empty()) {
+            if (timestamp_queue_.size() <= MAX_TIMESTAMPS_IN_QUEUE) {
+                task->timestamp = timestamp_queue_.front();
+            } else {
+                ESP_LOGW(TAG, "Timestamp queue (%u) is full, dropping timestamp", timestamp_queue_.size());
+            }
+            timestamp_queue_.pop_front();
         }
-        timestamp_queue_.pop_front();
     }
 
-    audio_queue_cv_.wait(lock, [this]() { return audio_encode_queue_.size() < MAX_ENCODE_TASKS_IN_QUEUE; });
-    audio_encode_queue_.push_back(std::move(task));
-    audio_queue_cv_.notify_all();
+    /* Push the task to the encode queue */
+    task->enqueue_time_us = esp_timer_get_time();
+    while (!audio_encode_queue_.TryPush(std::move(task))) {
+        if (service_stopped_) {
+            return;
+        }
+        audio_encode_queue_.RecordProducerWait(WaitForQueueEvents(AS_EVENT_ENCODE_QUEUE_SPACE));
+    }
+    xEventGroupSetBits(event_group_, AS_EVENT_ENCODE_QUEUE_DATA);
 }
 
 bool AudioService::PushPacketToDecodeQueue(std::unique_ptr<AudioStreamPacket> packet, bool wait) {
-    std::unique_lock<std::mutex> lock(audio_queue_mutex_);
-    if (audio_decode_queue_.size() >= MAX_DECODE_PACKETS_IN_QUEUE) {
-        if (wait) {
-            audio_queue_cv_.wait(lock, [this]() { return audio_decode_queue_.size() < MAX_DECODE_PACKETS_IN_QUEUE; });
-        } else {
+    // Limit the queue by duration, local sounds may use any frame duration
+    size_t max_packets = MAX_DECODE_PACKETS_IN_QUEUE(packet->frame_duration > 0 ? packet->frame_duration : OPUS_FRAME_DURATION_MS);
+    while (true) {
+        {
+            std::lock_guard<std::mutex> lock(decode_producer_mutex_);
+            if (audio_decode_queue_.size() < max_packets && audio_decode_queue_.TryPush(std::move(packet))) {
+                break;
+            }
+        }
+        if (!wait || service_stopped_) {
+            audio_decode_queue_.RecordDrop();
             return false;
         }
+        audio_decode_queue_.RecordProducerWait(WaitForQueueEvents(AS_EVENT_DECODE_QUEUE_SPACE));
     }
-    audio_decode_queue_.push_back(std::move(packet));
-    audio_queue_cv_.notify_all();
+    xEventGroupSetBits(event_group_, AS_EVENT_DECODE_QUEUE_DATA);
     return true;
 }
 
+bool AudioService::PushPacketToJitterBuffer(std::unique_ptr<AudioStreamPacket> packet) {
+    if (service_stopped_) {
+        return false;
+    }
+    int64_t now = esp_timer_get_time();
+    if (!jitter_buffer_.Push(std::move(packet), now)) {
+        return false;
+    }
+    if (output_starved_) {
+        jitter_buffer_.OnOutputUnderrun(now);
+    }
+    xEventGroupSetBits(event_group_, AS_EVENT_DECODE_QUEUE_DATA);
+    return true;
+}
+
+void AudioService::EndIncomingStream() {
+    jitter_buffer_.EndStream();
+}
+
 std::unique_ptr<AudioStreamPacket> AudioService::PopPacketFromSendQueue() {
-    std::lock_guard<std::mutex> lock(audio_queue_mutex_);
-    if (audio_send_queue_.empty()) {
+    std::unique_ptr<AudioStreamPacket> packet;
+    if (!audio_send_queue_.Pop(packet)) {
         return nullptr;
     }
-    auto packet = std::move(audio_send_queue_.front());
-    audio_send_queue_.pop_front();
-    audio_queue_cv_.notify_all();
+    xEventGroupSetBits(event_group_, AS_EVENT_SEND_QUEUE_SPACE);
     return packet;
 }
 
@@ -478,9 +656,10 @@ void AudioService::EnableVoiceProcessing(bool enable) {
     ESP_LOGD(TAG, "%s voice processing", enable ? "Enabling" : "Disabling");
     if (enable) {
         if (!audio_processor_initialized_) {
-            audio_processor_->Initialize(codec_, OPUS_FRAME_DURATION_MS, models_list_);
+            audio_processor_->Initialize(codec_, frame_duration_, models_list_);
             audio_processor_initialized_ = true;
         }
+        audio_processor_->SetOutputFrameDuration(frame_duration_);
 
         /* We should make sure no audio is playing */
         ResetDecoder();
@@ -499,17 +678,21 @@ void AudioService::EnableAudioTesting(bool enable) {
         xEventGroupSetBits(event_group_, AS_EVENT_AUDIO_TESTING_RUNNING);
     } else {
         xEventGroupClearBits(event_group_, AS_EVENT_AUDIO_TESTING_RUNNING);
-        /* Copy audio_testing_queue_ to audio_decode_queue_ */
-        std::lock_guard<std::mutex> lock(audio_queue_mutex_);
-        audio_decode_queue_ = std::move(audio_testing_queue_);
-        audio_queue_cv_.notify_all();
+        /* Move audio_testing_queue_ to audio_decode_queue_, replacing what was queued before */
+        std::lock_guard<std::mutex> lock(decode_producer_mutex_);
+        audio_decode_queue_.Flush();
+        std::unique_ptr<AudioStreamPacket> packet;
+        while (audio_testing_queue_.Pop(packet)) {
+            audio_decode_queue_.Push(std::move(packet));
+        }
+        xEventGroupSetBits(event_group_, AS_EVENT_DECODE_QUEUE_DATA);
     }
 }
 
 void AudioService::EnableDeviceAec(bool enable) {
     ESP_LOGI(TAG, "%s device AEC", enable ? "Enabling" : "Disabling");
     if (!audio_processor_initialized_) {
-        audio_processor_->Initialize(codec_, OPUS_FRAME_DURATION_MS, models_list_);
+        audio_processor_->Initialize(codec_, frame_duration_, models_list_);
         audio_processor_initialized_ = true;
     }
 
@@ -527,111 +710,62 @@ void AudioService::PlaySound(const std::string_view& ogg) {
         codec_->EnableOutput(true);
     }
 
-    const uint8_t* buf = reinterpret_cast<const uint8_t*>(ogg.data());
-    size_t size = ogg.size();
-    size_t offset = 0;
-
-    auto find_page = [&](size_t start)->size_t {
-        for (size_t i = start; i + 4 <= size; ++i) {
-            if (buf[i] == 'O' && buf[i+1] == 'g' && buf[i+2] == 'g' && buf[i+3] == 'S') return i;
-        }
-        return static_cast<size_t>(-1);
-    };
+    {
+        std::lock_guard<std::mutex> lock(sound_mutex_);
+        sound_queue_.push_back(ogg);
+        // Busy from now on, IsIdle must not report idle before the Opus task opens the sound
+        sound_playing_ = true;
+    }
+    xEventGroupSetBits(event_group_, AS_EVENT_DECODE_QUEUE_DATA);
+}
 
-    bool seen_head = false;
-    bool seen_tags = false;
-    int sample_rate = 16000; // 默认值
+bool AudioService::PopSoundPacket(std::unique_ptr<AudioStreamPacket>& packet, OggOpusPacket& info) {
+    if (sound_flushed_.exchange(false)) {
+        sound_demuxer_.Reset();
+    }
 
     while (true) {
-        size_t pos = find_page(offset);
-        if (pos == static_cast<size_t>(-1)) break;
-        offset = pos;
-        if (offset + 27 > size) break;
-
-        const uint8_t* page = buf + offset;
-        uint8_t page_segments = page[26];
-        size_t seg_table_off = offset + 27;
-        if (seg_table_off + page_segments > size) break;
-
-        size_t body_size = 0;
-        for (size_t i = 0; i < page_segments; ++i) body_size += page[27 + i];
-
-        size_t body_off = seg_table_off + page_segments;
-        if (body_off + body_size > size) break;
-
-        // Parse packets using lacing
-        size_t cur = body_off;
-        size_t seg_idx = 0;
-        while (seg_idx < page_segments) {
-            size_t pkt_len = 0;
-            size_t pkt_start = cur;
-            bool continued = false;
-            do {
-                uint8_t l = page[27 + seg_idx++];
-                pkt_len += l;
-                cur += l;
-                continued = (l == 255);
-            } while (continued && seg_idx < page_segments);
-
-            if (pkt_len == 0) continue;
-            const uint8_t* pkt_ptr = buf + pkt_start;
-
-            if (!seen_head) {
-                // 解析OpusHead包
-                if (pkt_len >= 19 && std::memcmp(pkt_ptr, "OpusHead", 8) == 0) {
-                    seen_head = true;
-                    
-                    // OpusHead结构：[0-7] "OpusHead", [8] version, [9] channel_count, [10-11] pre_skip
-                    // [12-15] input_sample_rate, [16-17] output_gain, [18] mapping_family
-                    if (pkt_len >= 12) {
-                        uint8_t version = pkt_ptr[8];
-                        uint8_t channel_count = pkt_ptr[9];
-                        
-                        if (pkt_len >= 16) {
-                            // 读取输入采样率 (little-endian)
-                            sample_rate = pkt_ptr[12] | (pkt_ptr[13] << 8) | 
-                                        (pkt_ptr[14] << 16) | (pkt_ptr[15] << 24);
-                            ESP_LOGI(TAG, "OpusHead: version=%d, channels=%d, sample_rate=%d", 
-                                   version, channel_count, sample_rate);
-                        }
-                    }
+        if (!sound_demuxer_.IsOpen()) {
+            std::string_view sound;
+            {
+                std::lock_guard<std::mutex> lock(sound_mutex_);
+                if (sound_queue_.empty()) {
+                    sound_playing_ = false;
+                    return false;
                 }
-                continue;
+                sound = sound_queue_.front();
+                sound_queue_.pop_front();
+                sound_playing_ = true;
             }
-            if (!seen_tags) {
-                // Expect OpusTags in second packet
-                if (pkt_len >= 8 && std::memcmp(pkt_ptr, "OpusTags", 8) == 0) {
-                    seen_tags = true;
-                }
+            if (!sound_demuxer_.Open(sound)) {
                 continue;
             }
-
-            // Audio packet (Opus)
-            auto packet = std::make_unique<AudioStreamPacket>();
-            packet->sample_rate = sample_rate;
-            packet->frame_duration = 60;
-            packet->payload.resize(pkt_len);
-            std::memcpy(packet->payload.data(), pkt_ptr, pkt_len);
-            PushPacketToDecodeQueue(std::move(packet), true);
+            ESP_LOGD(TAG, "Playing sound: %d Hz, %d channels", sound_demuxer_.sample_rate(), sound_demuxer_.channels());
+        }
+        if (sound_demuxer_.NextPacket(info)) {
+            break;
         }
-
-        offset = body_off + body_size;
     }
+
+    packet = frame_pool_.AcquirePacket();
+    packet->sample_rate = sound_demuxer_.sample_rate();
+    packet->frame_duration = info.frame_duration;
+    packet->payload.assign(info.data, info.data + info.size);
+    return true;
 }
 
 bool AudioService::IsIdle() {
-    std::lock_guard<std::mutex> lock(audio_queue_mutex_);
-    return audio_encode_queue_.empty() && audio_decode_queue_.empty() && audio_playback_queue_.empty() && audio_testing_queue_.empty();
+    return audio_encode_queue_.empty() && audio_decode_queue_.empty() && audio_playback_queue_.empty() &&
+        audio_testing_queue_.empty() && jitter_buffer_.empty() && !sound_playing_;
 }
 
 void AudioService::ResetDecoder() {
-    std::lock_guard<std::mutex> lock(audio_queue_mutex_);
     opus_decoder_->ResetState();
-    timestamp_queue_.clear();
-    audio_decode_queue_.clear();
-    audio_playback_queue_.clear();
-    audio_testing_queue_.clear();
-    audio_queue_cv_.notify_all();
+    {
+        std::lock_guard<std::mutex> lock(timestamp_mutex_);
+        timestamp_queue_.clear();
+    }
+    FlushPlaybackQueues();
 }
 
 void AudioService::CheckAndUpdateAudioPowerState() {
@@ -677,6 +811,16 @@ void AudioService::SetModelsList(srmodel_list_t* models_list) {
     }
 }
 
+AudioQueueStatistics AudioService::GetQueueStatistics() const {
+    AudioQueueStatistics statistics;
+    statistics.encode = audio_encode_queue_.GetStats();
+    statistics.decode = audio_decode_queue_.GetStats();
+    statistics.send = audio_send_queue_.GetStats();
+    statistics.playback = audio_playback_queue_.GetStats();
+    statistics.testing = audio_testing_queue_.GetStats();
+    return statistics;
+}
+
 bool AudioService::IsAfeWakeWord() {
 #if CONFIG_IDF_TARGET_ESP32S3 || CONFIG_IDF_TARGET_ESP32P4
     return wake_word_ != nullptr && dynamic_cast<AfeWakeWord*>(wake_word_.get()) != nullptr;
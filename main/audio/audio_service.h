@@ -3,9 +3,9 @@
 
 #include <memory>
 #include <deque>
-#include <condition_variable>
 #include <chrono>
 #include <mutex>
+#include <atomic>
 
 #include <freertos/FreeRTOS.h>
 #include <freertos/task.h>
@@ -19,6 +19,11 @@
 
 #include "audio_codec.h"
 #include "audio_processor.h"
+#include "audio_ring_queue.h"
+#include "audio_frame_pool.h"
+#include "audio_input_converter.h"
+#include "audio_jitter_buffer.h"
+#include "ogg_demuxer.h"
 #include "processors/audio_debugger.h"
 #include "wake_word.h"
 #include "protocol.h"
@@ -27,21 +32,52 @@
 /*
  * There are two types of audio data flow:
  * 1. (MIC) -> [Processors] -> {Encode Queue} -> [Opus Encoder] -> {Send Queue} -> (Server)
- * 2. (Server) -> {Decode Queue} -> [Opus Decoder] -> {Playback Queue} -> (Speaker)
+ * 2. (Server) -> {Jitter Buffer} -> [Opus Decoder] -> {Playback Queue} -> (Speaker)
+ *    (Testing) -> {Decode Queue} -> [Opus Decoder] -> {Playback Queue} -> (Speaker)
+ *    (PlaySound) -> {Sound Queue} -> [Ogg Demuxer] -> [Opus Decoder] -> {Playback Queue} -> (Speaker)
  *
  * We use one task for MIC / Speaker / Processors, and one task for Opus Encoder / Opus Decoder.
  * 
  * Decode Queue and Send Queue are the main queues, because Opus packets are quite smaller than PCM packets.
- * 
+ *
+ * Every queue is a lock-free single-producer / single-consumer ring (AudioRingQueue). Each queue
+ * has its own "data" / "space" event bits, so a push only wakes the task waiting on that queue.
+ * The decode queue has several producers (network, audio testing), which are
+ * serialized by decode_producer_mutex_; the consumer side is still lock-free.
+ *
+ * PlaySound() only queues a view of the Ogg file. The Opus task demuxes it one packet at a
+ * time, when the playback queue has room, so the caller never waits and nothing is copied
+ * up front.
+ *
+ * Network audio goes through the jitter buffer instead, which reorders packets, holds back
+ * playout by an adaptive number of frames and asks the decoder to conceal missing packets.
+ * The decode queue and local sounds are played first.
+ *
+ * The uplink frame duration and complexity are negotiated per session in the hello
+ * exchange and applied with SetStreamParams(). The send queue depth and the pooled Opus packets
+ * follow the frame duration, so they always cover AUDIO_QUEUE_DURATION_MS of audio.
  */
 
+// Default uplink frame duration, a session may negotiate 20 or 40 ms (see SetStreamParams)
 #define OPUS_FRAME_DURATION_MS 60
+#define OPUS_MIN_FRAME_DURATION_MS 20
 #define MAX_ENCODE_TASKS_IN_QUEUE 2
 #define MAX_PLAYBACK_TASKS_IN_QUEUE 2
-#define MAX_DECODE_PACKETS_IN_QUEUE (2400 / OPUS_FRAME_DURATION_MS)
-#define MAX_SEND_PACKETS_IN_QUEUE (2400 / OPUS_FRAME_DURATION_MS)
+// Packet queues hold the same amount of audio whatever the frame duration
+#define AUDIO_QUEUE_DURATION_MS 2400
+#define MAX_DECODE_PACKETS_IN_QUEUE(duration_ms) (AUDIO_QUEUE_DURATION_MS / (duration_ms))
+#define MAX_SEND_PACKETS_IN_QUEUE(duration_ms) (AUDIO_QUEUE_DURATION_MS / (duration_ms))
+// Packets taken from the send queue by the network sender and not sent yet
+#define MAX_SEND_PACKETS_IN_FLIGHT 4
 #define AUDIO_TESTING_MAX_DURATION_MS 10000
+#define MAX_TESTING_PACKETS_IN_QUEUE (AUDIO_TESTING_MAX_DURATION_MS / OPUS_FRAME_DURATION_MS)
 #define MAX_TIMESTAMPS_IN_QUEUE 3
+#define JITTER_BUFFER_MIN_DEPTH 1
+#define JITTER_BUFFER_MAX_DEPTH 6
+// Pooled packets for incoming network audio, more than the jitter buffer holds in steady state
+#define MAX_INCOMING_PACKETS_IN_POOL 24
+// Payload reserved for pooled Opus packets, enough for 32 kbit/s, above the encoder's own choice for 16 kHz mono
+#define OPUS_FRAME_MAX_BYTES(duration_ms) ((duration_ms) * 32000 / 8 / 1000)
 
 #define AUDIO_POWER_TIMEOUT_MS 15000
 #define AUDIO_POWER_CHECK_INTERVAL_MS 1000
@@ -52,6 +88,20 @@
 #define AS_EVENT_AUDIO_PROCESSOR_RUNNING    (1 << 2)
 #define AS_EVENT_PLAYBACK_NOT_EMPTY         (1 << 3)
 
+// Per-queue wakeups, set by the other side of the queue after a push (DATA) or a pop (SPACE)
+// DECODE_QUEUE_DATA is also set when a packet enters the jitter buffer
+#define AS_EVENT_ENCODE_QUEUE_DATA          (1 << 4)
+#define AS_EVENT_ENCODE_QUEUE_SPACE         (1 << 5)
+#define AS_EVENT_DECODE_QUEUE_DATA          (1 << 6)
+#define AS_EVENT_DECODE_QUEUE_SPACE         (1 << 7)
+#define AS_EVENT_SEND_QUEUE_SPACE           (1 << 8)
+#define AS_EVENT_PLAYBACK_QUEUE_DATA        (1 << 9)
+#define AS_EVENT_PLAYBACK_QUEUE_SPACE       (1 << 10)
+#define AS_EVENT_ALL_QUEUES                 (AS_EVENT_ENCODE_QUEUE_DATA | AS_EVENT_ENCODE_QUEUE_SPACE | \
+                                             AS_EVENT_DECODE_QUEUE_DATA | AS_EVENT_DECODE_QUEUE_SPACE | \
+                                             AS_EVENT_SEND_QUEUE_SPACE | \
+                                             AS_EVENT_PLAYBACK_QUEUE_DATA | AS_EVENT_PLAYBACK_QUEUE_SPACE)
+
 struct AudioServiceCallbacks {
     std::function<void(void)> on_send_queue_available;
     std::function<void(const std::string&)> on_wake_word_detected;
@@ -60,18 +110,6 @@ struct AudioServiceCallbacks {
 };
 
 
-enum AudioTaskType {
-    kAudioTaskTypeEncodeToSendQueue,
-    kAudioTaskTypeEncodeToTestingQueue,
-    kAudioTaskTypeDecodeToPlaybackQueue,
-};
-
-struct AudioTask {
-    AudioTaskType type;
-    std::vector<int16_t> pcm;
-    uint32_t timestamp;
-};
-
 struct DebugStatistics {
     uint32_t input_count = 0;
     uint32_t decode_count = 0;
@@ -79,6 +117,42 @@ struct DebugStatistics {
     uint32_t playback_count = 0;
 };
 
+struct AudioStageStats {
+    uint32_t count = 0;
+    uint64_t total_us = 0;
+    uint32_t max_us = 0;
+
+    void Add(int64_t us) {
+        count++;
+        total_us += us;
+        if (us > max_us) {
+            max_us = us;
+        }
+    }
+    uint32_t average_us() const { return count > 0 ? total_us / count : 0; }
+};
+
+// Time spent in each stage of the pipeline, every stage is updated by a single task
+struct AudioPipelineStatistics {
+    AudioStageStats read;               // Codec read, channel split and resampling
+    AudioStageStats process;            // Wake word / audio processor feed
+    AudioStageStats encode_queue;       // PCM waiting in the encode queue
+    AudioStageStats encode;             // Opus encode
+    AudioStageStats decode;             // Opus decode and output resampling
+    AudioStageStats playback_queue;     // PCM waiting in the playback queue
+    AudioStageStats output;             // Codec write
+    AudioStreamParams stream;           // Uplink parameters of the current session
+    uint32_t stream_changes = 0;        // Sessions that changed the uplink parameters
+};
+
+struct AudioQueueStatistics {
+    AudioQueueStats encode;
+    AudioQueueStats decode;
+    AudioQueueStats send;
+    AudioQueueStats playback;
+    AudioQueueStats testing;
+};
+
 class AudioService {
 public:
     AudioService();
@@ -104,11 +178,23 @@ public:
     void SetCallbacks(AudioServiceCallbacks& callbacks);
 
     bool PushPacketToDecodeQueue(std::unique_ptr<AudioStreamPacket> packet, bool wait = false);
+    bool PushPacketToJitterBuffer(std::unique_ptr<AudioStreamPacket> packet);
+    // The incoming stream is over, the speaker running dry is no longer concealed until ResetDecoder()
+    void EndIncomingStream();
     std::unique_ptr<AudioStreamPacket> PopPacketFromSendQueue();
+    // The sound must stay valid until it has been played (embedded files and mmapped assets do)
     void PlaySound(const std::string_view& sound);
     bool ReadAudioData(std::vector<int16_t>& data, int sample_rate, int samples);
     void ResetDecoder();
     void SetModelsList(srmodel_list_t* models_list);
+    void SetStreamParams(const AudioStreamParams& params);
+    AudioStreamParams GetStreamParams() const;
+    AudioQueueStatistics GetQueueStatistics() const;
+    AudioFramePoolStats GetFramePoolStatistics() const { return frame_pool_.GetStats(); }
+    AudioFramePool* GetIncomingPacketPool() { return &incoming_packet_pool_; }
+    AudioFramePoolStats GetIncomingPacketPoolStatistics() const { return incoming_packet_pool_.GetStats(); }
+    AudioPipelineStatistics GetPipelineStatistics() const;
+    AudioJitterStats GetJitterStatistics() const { return jitter_buffer_.GetStats(); }
 
 private:
     AudioCodec* codec_ = nullptr;
@@ -117,11 +203,13 @@ private:
     std::unique_ptr<WakeWord> wake_word_;
     std::unique_ptr<AudioDebugger> audio_debugger_;
     std::unique_ptr<OpusEncoderWrapper> opus_encoder_;
+    // The encoder writes up to MAX_OPUS_PACKET_SIZE here, only the result is copied into a pooled packet
+    std::vector<uint8_t> opus_encode_buffer_;
     std::unique_ptr<OpusDecoderWrapper> opus_decoder_;
-    OpusResampler input_resampler_;
-    OpusResampler reference_resampler_;
+    AudioInputConverter input_converter_;
     OpusResampler output_resampler_;
     DebugStatistics debug_statistics_;
+    AudioPipelineStatistics pipeline_statistics_;
     srmodel_list_t* models_list_ = nullptr;
 
     EventGroupHandle_t event_group_;
@@ -130,21 +218,42 @@ private:
     TaskHandle_t audio_input_task_handle_ = nullptr;
     TaskHandle_t audio_output_task_handle_ = nullptr;
     TaskHandle_t opus_codec_task_handle_ = nullptr;
-    std::mutex audio_queue_mutex_;
-    std::condition_variable audio_queue_cv_;
-    std::deque<std::unique_ptr<AudioStreamPacket>> audio_decode_queue_;
-    std::deque<std::unique_ptr<AudioStreamPacket>> audio_send_queue_;
-    std::deque<std::unique_ptr<AudioStreamPacket>> audio_testing_queue_;
-    std::deque<std::unique_ptr<AudioTask>> audio_encode_queue_;
-    std::deque<std::unique_ptr<AudioTask>> audio_playback_queue_;
+    // Declared before the queues so that they outlive the pooled frames they hold
+    AudioFramePool frame_pool_;
+    AudioFramePool incoming_packet_pool_;
+    std::mutex decode_producer_mutex_;
+    AudioRingQueue<std::unique_ptr<AudioStreamPacket>> audio_decode_queue_;
+    AudioRingQueue<std::unique_ptr<AudioStreamPacket>> audio_send_queue_;
+    AudioRingQueue<std::unique_ptr<AudioStreamPacket>> audio_testing_queue_;
+    AudioRingQueue<std::unique_ptr<AudioTask>> audio_encode_queue_;
+    AudioRingQueue<std::unique_ptr<AudioTask>> audio_playback_queue_;
+    AudioJitterBuffer jitter_buffer_;
+    // Sounds waiting to be played, and the one being demuxed by the Opus task
+    std::mutex sound_mutex_;
+    std::deque<std::string_view> sound_queue_;
+    std::atomic<bool> sound_playing_ = false;
+    std::atomic<bool> sound_flushed_ = false;
+    OggDemuxer sound_demuxer_;
+    // Uplink parameters, set by the application and applied to the encoder by the Opus task
+    mutable std::mutex stream_params_mutex_;
+    AudioStreamParams stream_params_;
+    uint32_t stream_changes_ = 0;
+    std::atomic<bool> stream_params_changed_ = false;
+    std::atomic<int> frame_duration_ = OPUS_FRAME_DURATION_MS;
     // For server AEC
+    std::mutex timestamp_mutex_;
     std::deque<uint32_t> timestamp_queue_;
 
+    // Reusable buffers, so that reading and resampling do not allocate per frame
+    std::vector<int16_t> input_buffer_;
+    std::vector<int16_t> output_resample_buffer_;
+
     bool wake_word_initialized_ = false;
     bool audio_processor_initialized_ = false;
     bool voice_detected_ = false;
     bool service_stopped_ = true;
     bool audio_input_need_warmup_ = false;
+    std::atomic<bool> output_starved_ = false;
 
     esp_timer_handle_t audio_power_timer_ = nullptr;
     std::chrono::steady_clock::time_point last_input_time_;
@@ -154,7 +263,11 @@ private:
     void AudioOutputTask();
     void OpusCodecTask();
     void PushTaskToEncodeQueue(AudioTaskType type, std::vector<int16_t>&& pcm);
+    int64_t WaitForQueueEvents(EventBits_t bits, TickType_t timeout = portMAX_DELAY);
+    void FlushPlaybackQueues();
     void SetDecodeSampleRate(int sample_rate, int frame_duration);
+    void ConfigureEncoder(int frame_duration);
+    bool PopSoundPacket(std::unique_ptr<AudioStreamPacket>& packet, OggOpusPacket& info);
     void CheckAndUpdateAudioPowerState();
 };
 
@@ -1,7 +1,7 @@
 #include "no_audio_codec.h"
+#include "audio_pcm_kernels.h"
 
 #include <esp_log.h>
-#include <cmath>
 #include <cstring>
 
 #define TAG "NoAudioCodec"
@@ -216,41 +216,35 @@ NoAudioCodecSimplex::NoAudioCodecSimplex(int input_sample_rate, int output_sampl
 
 int NoAudioCodec::Write(const int16_t* data, int samples) {
     std::lock_guard<std::mutex> lock(data_if_mutex_);
-    std::vector<int32_t> buffer(samples);
-
-    // output_volume_: 0-100
-    // volume_factor_: 0-65536
-    int32_t volume_factor = pow(double(output_volume_) / 100.0, 2) * 65536;
-    for (int i = 0; i < samples; i++) {
-        int64_t temp = int64_t(data[i]) * volume_factor; // 使用 int64_t 进行乘法运算
-        if (temp > INT32_MAX) {
-            buffer[i] = INT32_MAX;
-        } else if (temp < INT32_MIN) {
-            buffer[i] = INT32_MIN;
-        } else {
-            buffer[i] = static_cast<int32_t>(temp);
-        }
+    if (tx_buffer_.size() < (size_t)samples) {
+        tx_buffer_.resize(samples);
+    }
+
+    // output_volume_: 0-100, output_gain_q16_: 0-65536
+    if (output_volume_ != cached_output_volume_) {
+        cached_output_volume_ = output_volume_;
+        output_gain_q16_ = PcmVolumeToGainQ16(output_volume_);
     }
+    PcmScale16To32(data, tx_buffer_.data(), samples, output_gain_q16_);
 
     size_t bytes_written;
-    ESP_ERROR_CHECK(i2s_channel_write(tx_handle_, buffer.data(), samples * sizeof(int32_t), &bytes_written, portMAX_DELAY));
+    ESP_ERROR_CHECK(i2s_channel_write(tx_handle_, tx_buffer_.data(), samples * sizeof(int32_t), &bytes_written, portMAX_DELAY));
     return bytes_written / sizeof(int32_t);
 }
 
 int NoAudioCodec::Read(int16_t* dest, int samples) {
     size_t bytes_read;
 
-    std::vector<int32_t> bit32_buffer(samples);
-    if (i2s_channel_read(rx_handle_, bit32_buffer.data(), samples * sizeof(int32_t), &bytes_read, portMAX_DELAY) != ESP_OK) {
+    if (rx_buffer_.size() < (size_t)samples) {
+        rx_buffer_.resize(samples);
+    }
+    if (i2s_channel_read(rx_handle_, rx_buffer_.data(), samples * sizeof(int32_t), &bytes_read, portMAX_DELAY) != ESP_OK) {
         ESP_LOGE(TAG, "Read Failed!");
         return 0;
     }
 
     samples = bytes_read / sizeof(int32_t);
-    for (int i = 0; i < samples; i++) {
-        int32_t value = bit32_buffer[i] >> 12;
-        dest[i] = (value > INT16_MAX) ? INT16_MAX : (value < -INT16_MAX) ? -INT16_MAX : (int16_t)value;
-    }
+    PcmNarrow32To16(rx_buffer_.data(), dest, samples, 12);
     return samples;
 }
 
@@ -349,11 +343,8 @@ int NoAudioCodecSimplexPdm::Read(int16_t* dest, int samples) {
 
     samples = bytes_read / sizeof(int16_t);
     if (input_gain_ > 0) {
-        int gain_factor = (int)input_gain_;
-        for (int i = 0; i < samples; i++) {
-            int32_t amplified = dest[i] * gain_factor;
-            dest[i] = (amplified > INT16_MAX) ? INT16_MAX : (amplified < -INT16_MAX) ? -INT16_MAX : (int16_t)amplified;
-        }
+        // Integer gain as before, expressed in Q8 for the shared kernel
+        PcmApplyGain(dest, samples, (int32_t)input_gain_ << 8);
     }
     return samples;
 }
@@ -6,10 +6,17 @@
 #include <driver/gpio.h>
 #include <driver/i2s_pdm.h>
 #include <mutex>
+#include <vector>
 
 class NoAudioCodec : public AudioCodec {
 protected:
     std::mutex data_if_mutex_;
+    // 32-bit I2S slot buffers, kept across calls; Write runs under data_if_mutex_, Read on the input task
+    std::vector<int32_t> tx_buffer_;
+    std::vector<int32_t> rx_buffer_;
+    // Q16 speaker gain, recomputed only when output_volume_ changes
+    int cached_output_volume_ = -1;
+    int32_t output_gain_q16_ = 0;
 
     virtual int Write(const int16_t* data, int samples) override;
     virtual int Read(int16_t* dest, int samples) override;
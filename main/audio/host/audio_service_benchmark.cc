@@ -0,0 +1,224 @@
+/*
+ * Runs the real AudioService pipeline on the host and reports where the time goes.
+ *
+ * The microphone is a FileAudioCodec, every encoded packet is looped back from the send queue
+ * into the jitter buffer, so both directions (MIC -> encoder and decoder -> speaker) run at once.
+ * --loss and --reorder drop or swap a percentage of the looped packets to exercise concealment.
+ * --frame-duration and --complexity set the uplink parameters as a negotiated session would.
+ * --sound plays an Ogg Opus file through PlaySound() first and reports how long the call took.
+ *
+ * Usage: audio_service_benchmark [--seconds N] [--input-rate HZ] [--output-rate HZ]
+ *            [--channels 1|2] [--input FILE.pcm] [--output FILE.pcm] [--realtime]
+ *            [--loss PERCENT] [--reorder PERCENT]
+ *            [--frame-duration 20|40|60] [--complexity 0-10] [--sound FILE.ogg]
+ */
+
+#include "audio_service.h"
+#include "file_audio_codec.h"
+
+#include <esp_log.h>
+#include <condition_variable>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <cstdlib>
+#include <mutex>
+#include <thread>
+
+#define TAG "AudioBenchmark"
+
+static void PrintStage(const char* name, const AudioStageStats& stage, int seconds) {
+    printf("  %-16s %8u %10u %10u %8.1f%%\n", name, stage.count, stage.average_us(), stage.max_us,
+        stage.total_us / 10000.0 / seconds);
+}
+
+static void PrintQueue(const char* name, const AudioQueueStats& queue) {
+    printf("  %-10s %4u/%-4u %6u %8u %8u %6u %6u %6u %10llu %6u %10llu\n", name, queue.size, queue.capacity,
+        queue.high_watermark, queue.push_count, queue.pop_count, queue.drop_count, queue.flush_count,
+        queue.producer_waits, (unsigned long long)queue.producer_wait_us,
+        queue.consumer_waits, (unsigned long long)queue.consumer_wait_us);
+}
+
+int main(int argc, char** argv) {
+    int seconds = 5;
+    int input_rate = 16000;
+    int output_rate = 24000;
+    int channels = 1;
+    bool realtime = false;
+    int loss_percent = 0;
+    int reorder_percent = 0;
+    AudioStreamParams stream_params;
+    std::string input_path;
+    std::string output_path;
+    std::string sound_path;
+
+    for (int i = 1; i < argc; i++) {
+        auto next = [&]() -> const char* {
+            if (i + 1 >= argc) {
+                fprintf(stderr, "Missing value for %s\n", argv[i]);
+                exit(1);
+            }
+            return argv[++i];
+        };
+        if (strcmp(argv[i], "--seconds") == 0) {
+            seconds = atoi(next());
+        } else if (strcmp(argv[i], "--input-rate") == 0) {
+            input_rate = atoi(next());
+        } else if (strcmp(argv[i], "--output-rate") == 0) {
+            output_rate = atoi(next());
+        } else if (strcmp(argv[i], "--channels") == 0) {
+            channels = atoi(next());
+        } else if (strcmp(argv[i], "--input") == 0) {
+            input_path = next();
+        } else if (strcmp(argv[i], "--output") == 0) {
+            output_path = next();
+        } else if (strcmp(argv[i], "--loss") == 0) {
+            loss_percent = atoi(next());
+        } else if (strcmp(argv[i], "--reorder") == 0) {
+            reorder_percent = atoi(next());
+        } else if (strcmp(argv[i], "--frame-duration") == 0) {
+            stream_params.frame_duration = atoi(next());
+        } else if (strcmp(argv[i], "--complexity") == 0) {
+            stream_params.complexity = atoi(next());
+        } else if (strcmp(argv[i], "--sound") == 0) {
+            sound_path = next();
+        } else if (strcmp(argv[i], "--realtime") == 0) {
+            realtime = true;
+        } else {
+            fprintf(stderr, "Unknown argument %s\n", argv[i]);
+            return 1;
+        }
+    }
+
+    FileAudioCodec codec(input_rate, output_rate, channels, input_path, output_path, realtime);
+    AudioService audio_service;
+    audio_service.Initialize(&codec);
+
+    std::mutex mutex;
+    std::condition_variable cv;
+    bool send_queue_available = false;
+    AudioServiceCallbacks callbacks;
+    callbacks.on_send_queue_available = [&]() {
+        std::lock_guard<std::mutex> lock(mutex);
+        send_queue_available = true;
+        cv.notify_one();
+    };
+    audio_service.SetCallbacks(callbacks);
+    audio_service.Start();
+    audio_service.SetStreamParams(stream_params);
+
+    if (!sound_path.empty()) {
+        std::ifstream file(sound_path, std::ios::binary);
+        std::stringstream content;
+        content << file.rdbuf();
+        std::string sound = content.str();
+
+        // Walk the file once to know what to expect
+        OggDemuxer demuxer;
+        OggOpusPacket packet;
+        uint32_t packets = 0, samples = 0;
+        if (demuxer.Open(sound)) {
+            while (demuxer.NextPacket(packet)) {
+                packets++;
+                samples += packet.keep_samples;
+            }
+        }
+        printf("Sound %s: %u packets, %u ms, %d Hz\n", sound_path.c_str(), packets, samples / 48,
+            demuxer.sample_rate());
+
+        auto start = std::chrono::steady_clock::now();
+        audio_service.PlaySound(sound);
+        auto queued = std::chrono::steady_clock::now();
+        while (!audio_service.IsIdle()) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(5));
+        }
+        auto played = std::chrono::steady_clock::now();
+        printf("PlaySound returned after %lld us, played in %lld ms, %u frames decoded\n\n",
+            (long long)std::chrono::duration_cast<std::chrono::microseconds>(queued - start).count(),
+            (long long)std::chrono::duration_cast<std::chrono::milliseconds>(played - start).count(),
+            audio_service.GetPipelineStatistics().decode.count);
+    }
+    audio_service.EnableVoiceProcessing(true);
+
+    ESP_LOGI(TAG, "Running for %d s: input %d Hz x%d, output %d Hz, %s", seconds, input_rate, channels,
+        output_rate, realtime ? "realtime" : "free running");
+
+    // Loop the encoded packets back to the decoder until the time is up
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(seconds);
+    uint32_t looped_packets = 0;
+    uint32_t sequence = 0;
+    std::unique_ptr<AudioStreamPacket> held_packet;
+    while (std::chrono::steady_clock::now() < deadline) {
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            cv.wait_until(lock, deadline, [&]() { return send_queue_available; });
+            send_queue_available = false;
+        }
+        while (auto sent = audio_service.PopPacketFromSendQueue()) {
+            // Received like a transport does it, into a packet from the incoming pool
+            auto packet = audio_service.GetIncomingPacketPool()->AcquirePacket();
+            packet->sample_rate = sent->sample_rate;
+            packet->frame_duration = sent->frame_duration;
+            packet->timestamp = sent->timestamp;
+            packet->sequence = ++sequence;
+            packet->payload.assign(sent->payload.begin() + sent->headroom, sent->payload.end());
+            sent.reset();
+            looped_packets++;
+            if (rand() % 100 < loss_percent) {
+                continue;
+            }
+            if (!held_packet && rand() % 100 < reorder_percent) {
+                // Deliver this one after the next packet
+                held_packet = std::move(packet);
+                continue;
+            }
+            audio_service.PushPacketToJitterBuffer(std::move(packet));
+            if (held_packet) {
+                audio_service.PushPacketToJitterBuffer(std::move(held_packet));
+            }
+        }
+    }
+
+    auto pipeline = audio_service.GetPipelineStatistics();
+    auto queues = audio_service.GetQueueStatistics();
+    auto pool = audio_service.GetFramePoolStatistics();
+    auto incoming_pool = audio_service.GetIncomingPacketPoolStatistics();
+    auto jitter = audio_service.GetJitterStatistics();
+    audio_service.Stop();
+
+    printf("\nLooped %u packets in %d s, %d ms frames, complexity %d\n", looped_packets, seconds,
+        pipeline.stream.frame_duration, pipeline.stream.complexity);
+    printf("\n  %-16s %8s %10s %10s %9s\n", "stage", "count", "avg us", "max us", "busy");
+    PrintStage("read", pipeline.read, seconds);
+    PrintStage("process", pipeline.process, seconds);
+    PrintStage("encode queue", pipeline.encode_queue, seconds);
+    PrintStage("encode", pipeline.encode, seconds);
+    PrintStage("decode", pipeline.decode, seconds);
+    PrintStage("playback queue", pipeline.playback_queue, seconds);
+    PrintStage("output", pipeline.output, seconds);
+
+    printf("\n  %-10s %9s %6s %8s %8s %6s %6s %6s %10s %6s %10s\n", "queue", "size", "hwm", "push", "pop",
+        "drop", "flush", "pwait", "pwait us", "cwait", "cwait us");
+    PrintQueue("encode", queues.encode);
+    PrintQueue("decode", queues.decode);
+    PrintQueue("send", queues.send);
+    PrintQueue("playback", queues.playback);
+    PrintQueue("testing", queues.testing);
+
+    printf("\n  frame pool: tasks %u/%u (min free %u), packets %u/%u (min free %u), fallback allocations %u\n",
+        pool.tasks_free, pool.tasks_total, pool.tasks_min_free,
+        pool.packets_free, pool.packets_total, pool.packets_min_free, pool.fallback_allocations);
+    printf("  incoming pool: packets %u/%u (min free %u), fallback allocations %u\n",
+        incoming_pool.packets_free, incoming_pool.packets_total, incoming_pool.packets_min_free,
+        incoming_pool.fallback_allocations);
+
+    printf("  jitter buffer: received %u, played %u, concealed %u, skipped %u, late %u, duplicates %u, reordered %u,\n"
+        "                 overflows %u, underruns %u, jitter %u us, depth %u (target %u, max %u)\n",
+        jitter.received, jitter.played, jitter.concealed, jitter.skipped, jitter.late, jitter.duplicates,
+        jitter.reordered, jitter.overflows, jitter.underruns, jitter.jitter_us, jitter.depth, jitter.target_depth,
+        jitter.max_depth);
+
+    // Let the detached tasks observe the stop before the service goes away
+    std::this_thread::sleep_for(std::chrono::milliseconds(300));
+    return 0;
+}
@@ -0,0 +1,89 @@
+#include "file_audio_codec.h"
+
+#include <esp_log.h>
+#include <cmath>
+#include <thread>
+
+#define TAG "FileAudioCodec"
+
+FileAudioCodec::FileAudioCodec(int input_sample_rate, int output_sample_rate, int input_channels,
+    const std::string& input_path, const std::string& output_path, bool realtime) {
+    duplex_ = true;
+    input_reference_ = input_channels == 2;
+    input_channels_ = input_channels;
+    input_sample_rate_ = input_sample_rate;
+    output_sample_rate_ = output_sample_rate;
+    realtime_ = realtime;
+
+    if (!input_path.empty()) {
+        input_file_ = fopen(input_path.c_str(), "rb");
+        if (input_file_ == nullptr) {
+            ESP_LOGE(TAG, "Failed to open input %s, using a test tone", input_path.c_str());
+        }
+    }
+    if (!output_path.empty()) {
+        output_file_ = fopen(output_path.c_str(), "wb");
+        if (output_file_ == nullptr) {
+            ESP_LOGE(TAG, "Failed to open output %s, discarding output", output_path.c_str());
+        }
+    }
+    input_deadline_ = output_deadline_ = std::chrono::steady_clock::now();
+}
+
+FileAudioCodec::~FileAudioCodec() {
+    if (input_file_ != nullptr) {
+        fclose(input_file_);
+    }
+    if (output_file_ != nullptr) {
+        fclose(output_file_);
+    }
+}
+
+void FileAudioCodec::Pace(std::chrono::steady_clock::time_point& deadline, int frames, int sample_rate) {
+    if (!realtime_) {
+        return;
+    }
+    auto now = std::chrono::steady_clock::now();
+    if (deadline < now) {
+        deadline = now;
+    }
+    deadline += std::chrono::microseconds((int64_t)frames * 1000000 / sample_rate);
+    std::this_thread::sleep_until(deadline);
+}
+
+int FileAudioCodec::Read(int16_t* dest, int samples) {
+    if (input_file_ != nullptr) {
+        int read = 0;
+        while (read < samples) {
+            size_t n = fread(dest + read, sizeof(int16_t), samples - read, input_file_);
+            if (n == 0) {
+                rewind(input_file_);
+                n = fread(dest + read, sizeof(int16_t), samples - read, input_file_);
+                if (n == 0) {
+                    break;
+                }
+            }
+            read += n;
+        }
+        for (int i = read; i < samples; i++) {
+            dest[i] = 0;
+        }
+    } else {
+        for (int i = 0; i < samples; i += input_channels_) {
+            int16_t value = 8000 * sin(2 * M_PI * 440 * tone_phase_++ / input_sample_rate_);
+            for (int ch = 0; ch < input_channels_ && i + ch < samples; ch++) {
+                dest[i + ch] = value;
+            }
+        }
+    }
+    Pace(input_deadline_, samples / input_channels_, input_sample_rate_);
+    return samples;
+}
+
+int FileAudioCodec::Write(const int16_t* data, int samples) {
+    if (output_file_ != nullptr) {
+        fwrite(data, sizeof(int16_t), samples, output_file_);
+    }
+    Pace(output_deadline_, samples / output_channels_, output_sample_rate_);
+    return samples;
+}
@@ -0,0 +1,38 @@
+#ifndef _FILE_AUDIO_CODEC_H
+#define _FILE_AUDIO_CODEC_H
+
+#include "audio_codec.h"
+
+#include <cstdio>
+#include <string>
+#include <vector>
+#include <chrono>
+
+/*
+ * Host codec backed by raw 16-bit PCM files. Input loops over the given file, or generates a
+ * 440 Hz tone when no file is given. Output is appended to a file, or discarded.
+ *
+ * With realtime enabled, Read / Write sleep like an I2S channel would, so queue depths and
+ * latencies look like on the device. Without it the pipeline runs as fast as the CPU allows.
+ */
+class FileAudioCodec : public AudioCodec {
+private:
+    FILE* input_file_ = nullptr;
+    FILE* output_file_ = nullptr;
+    bool realtime_ = false;
+    uint64_t tone_phase_ = 0;
+    std::chrono::steady_clock::time_point input_deadline_;
+    std::chrono::steady_clock::time_point output_deadline_;
+
+    void Pace(std::chrono::steady_clock::time_point& deadline, int frames, int sample_rate);
+
+    virtual int Read(int16_t* dest, int samples) override;
+    virtual int Write(const int16_t* data, int samples) override;
+
+public:
+    FileAudioCodec(int input_sample_rate, int output_sample_rate, int input_channels,
+        const std::string& input_path, const std::string& output_path, bool realtime);
+    virtual ~FileAudioCodec();
+};
+
+#endif // _FILE_AUDIO_CODEC_H
@@ -0,0 +1,151 @@
+/*
+ * FreeRTOS event groups / tasks and esp_timer on top of the C++ standard library, just enough
+ * for AudioService to run on a development machine.
+ */
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <freertos/event_groups.h>
+#include <esp_timer.h>
+
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+struct HostEventGroup {
+    std::mutex mutex;
+    std::condition_variable cv;
+    EventBits_t bits = 0;
+};
+
+EventGroupHandle_t xEventGroupCreate() {
+    return new HostEventGroup();
+}
+
+void vEventGroupDelete(EventGroupHandle_t group) {
+    delete group;
+}
+
+EventBits_t xEventGroupSetBits(EventGroupHandle_t group, EventBits_t bits) {
+    std::lock_guard<std::mutex> lock(group->mutex);
+    group->bits |= bits;
+    group->cv.notify_all();
+    return group->bits;
+}
+
+EventBits_t xEventGroupClearBits(EventGroupHandle_t group, EventBits_t bits) {
+    std::lock_guard<std::mutex> lock(group->mutex);
+    EventBits_t previous = group->bits;
+    group->bits &= ~bits;
+    return previous;
+}
+
+EventBits_t xEventGroupGetBits(EventGroupHandle_t group) {
+    std::lock_guard<std::mutex> lock(group->mutex);
+    return group->bits;
+}
+
+EventBits_t xEventGroupWaitBits(EventGroupHandle_t group, EventBits_t bits, BaseType_t clear_on_exit,
+    BaseType_t wait_for_all, TickType_t ticks_to_wait) {
+    std::unique_lock<std::mutex> lock(group->mutex);
+    auto satisfied = [&]() {
+        return wait_for_all ? (group->bits & bits) == bits : (group->bits & bits) != 0;
+    };
+    if (ticks_to_wait == portMAX_DELAY) {
+        group->cv.wait(lock, satisfied);
+    } else {
+        group->cv.wait_for(lock, std::chrono::milliseconds(ticks_to_wait), satisfied);
+    }
+    EventBits_t result = group->bits;
+    if (satisfied() && clear_on_exit) {
+        group->bits &= ~bits;
+    }
+    return result;
+}
+
+BaseType_t xTaskCreate(TaskFunction_t task, const char* name, uint32_t stack_depth,
+    void* arg, UBaseType_t priority, TaskHandle_t* handle) {
+    std::thread(task, arg).detach();
+    if (handle != nullptr) {
+        // Only compared against nullptr by the callers, never dereferenced
+        *handle = reinterpret_cast<TaskHandle_t>(1);
+    }
+    return pdPASS;
+}
+
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t task, const char* name, uint32_t stack_depth,
+    void* arg, UBaseType_t priority, TaskHandle_t* handle, BaseType_t core_id) {
+    return xTaskCreate(task, name, stack_depth, arg, priority, handle);
+}
+
+void vTaskDelete(TaskHandle_t handle) {
+}
+
+void vTaskDelay(TickType_t ticks) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(ticks));
+}
+
+struct esp_timer {
+    esp_timer_create_args_t args;
+    std::mutex mutex;
+    std::condition_variable cv;
+    // Bumped by every start / stop, a timer thread exits as soon as its generation is stale
+    uint64_t generation = 0;
+};
+
+esp_err_t esp_timer_create(const esp_timer_create_args_t* args, esp_timer_handle_t* out_handle) {
+    auto timer = new esp_timer();
+    timer->args = *args;
+    *out_handle = timer;
+    return ESP_OK;
+}
+
+static esp_err_t StartTimer(esp_timer_handle_t timer, uint64_t us, bool periodic) {
+    uint64_t generation;
+    {
+        std::lock_guard<std::mutex> lock(timer->mutex);
+        generation = ++timer->generation;
+        timer->cv.notify_all();
+    }
+    std::thread([timer, generation, us, periodic]() {
+        std::unique_lock<std::mutex> lock(timer->mutex);
+        do {
+            if (timer->cv.wait_for(lock, std::chrono::microseconds(us), [&]() {
+                return timer->generation != generation;
+            })) {
+                return;
+            }
+            lock.unlock();
+            timer->args.callback(timer->args.arg);
+            lock.lock();
+        } while (periodic && timer->generation == generation);
+    }).detach();
+    return ESP_OK;
+}
+
+esp_err_t esp_timer_start_periodic(esp_timer_handle_t timer, uint64_t period_us) {
+    return StartTimer(timer, period_us, true);
+}
+
+esp_err_t esp_timer_start_once(esp_timer_handle_t timer, uint64_t timeout_us) {
+    return StartTimer(timer, timeout_us, false);
+}
+
+esp_err_t esp_timer_stop(esp_timer_handle_t timer) {
+    std::lock_guard<std::mutex> lock(timer->mutex);
+    timer->generation++;
+    timer->cv.notify_all();
+    return ESP_OK;
+}
+
+esp_err_t esp_timer_delete(esp_timer_handle_t timer) {
+    esp_timer_stop(timer);
+    // Timer threads may still hold the object until they observe the new generation, keep it alive
+    return ESP_OK;
+}
+
+int64_t esp_timer_get_time() {
+    static const auto boot_time = std::chrono::steady_clock::now();
+    return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - boot_time).count();
+}
@@ -0,0 +1,159 @@
+#include "opus_encoder.h"
+#include "opus_decoder.h"
+#include "opus_resampler.h"
+
+#include <esp_log.h>
+#include <cstring>
+
+#if HOST_HAVE_LIBOPUS
+#include <opus.h>
+#endif
+
+#define TAG "HostOpus"
+
+OpusEncoderWrapper::OpusEncoderWrapper(int sample_rate, int channels, int duration_ms)
+    : sample_rate_(sample_rate), duration_ms_(duration_ms) {
+    frame_size_ = sample_rate * channels * duration_ms / 1000;
+#if HOST_HAVE_LIBOPUS
+    int error;
+    audio_enc_ = opus_encoder_create(sample_rate, channels, OPUS_APPLICATION_VOIP, &error);
+    if (audio_enc_ == nullptr) {
+        ESP_LOGE(TAG, "Failed to create audio encoder, error code: %d", error);
+        return;
+    }
+    opus_encoder_ctl(audio_enc_, OPUS_SET_DTX(1));
+#else
+    ESP_LOGW(TAG, "Built without libopus, encoded packets carry raw PCM");
+#endif
+}
+
+OpusEncoderWrapper::~OpusEncoderWrapper() {
+#if HOST_HAVE_LIBOPUS
+    if (audio_enc_ != nullptr) {
+        opus_encoder_destroy(audio_enc_);
+    }
+#endif
+}
+
+void OpusEncoderWrapper::SetDtx(bool enable) {
+#if HOST_HAVE_LIBOPUS
+    opus_encoder_ctl(audio_enc_, OPUS_SET_DTX(enable ? 1 : 0));
+#endif
+}
+
+void OpusEncoderWrapper::SetComplexity(int complexity) {
+#if HOST_HAVE_LIBOPUS
+    opus_encoder_ctl(audio_enc_, OPUS_SET_COMPLEXITY(complexity));
+#endif
+}
+
+void OpusEncoderWrapper::Encode(std::vector<int16_t>&& pcm, std::function<void(std::vector<uint8_t>&& opus)> handler) {
+    in_buffer_.insert(in_buffer_.end(), pcm.begin(), pcm.end());
+    while (in_buffer_.size() >= (size_t)frame_size_) {
+        std::vector<int16_t> frame(in_buffer_.begin(), in_buffer_.begin() + frame_size_);
+        std::vector<uint8_t> opus;
+        if (Encode(std::move(frame), opus)) {
+            handler(std::move(opus));
+        }
+        in_buffer_.erase(in_buffer_.begin(), in_buffer_.begin() + frame_size_);
+    }
+}
+
+bool OpusEncoderWrapper::Encode(std::vector<int16_t>&& pcm, std::vector<uint8_t>& opus) {
+    if (pcm.size() != (size_t)frame_size_) {
+        ESP_LOGE(TAG, "Audio data size is not equal to frame size, size=%zu, frame_size=%d", pcm.size(), frame_size_);
+        return false;
+    }
+#if HOST_HAVE_LIBOPUS
+    opus.resize(MAX_OPUS_PACKET_SIZE);
+    auto ret = opus_encode(audio_enc_, pcm.data(), frame_size_, opus.data(), opus.size());
+    if (ret < 0) {
+        ESP_LOGE(TAG, "Failed to encode audio, error code: %d", ret);
+        return false;
+    }
+    opus.resize(ret);
+#else
+    opus.resize(pcm.size() * sizeof(int16_t));
+    memcpy(opus.data(), pcm.data(), opus.size());
+#endif
+    return true;
+}
+
+void OpusEncoderWrapper::ResetState() {
+#if HOST_HAVE_LIBOPUS
+    opus_encoder_ctl(audio_enc_, OPUS_RESET_STATE);
+#endif
+    in_buffer_.clear();
+}
+
+OpusDecoderWrapper::OpusDecoderWrapper(int sample_rate, int channels, int duration_ms)
+    : sample_rate_(sample_rate), duration_ms_(duration_ms) {
+    frame_size_ = sample_rate * channels * duration_ms / 1000;
+#if HOST_HAVE_LIBOPUS
+    int error;
+    audio_dec_ = opus_decoder_create(sample_rate, channels, &error);
+    if (audio_dec_ == nullptr) {
+        ESP_LOGE(TAG, "Failed to create audio decoder, error code: %d", error);
+    }
+#endif
+}
+
+OpusDecoderWrapper::~OpusDecoderWrapper() {
+#if HOST_HAVE_LIBOPUS
+    if (audio_dec_ != nullptr) {
+        opus_decoder_destroy(audio_dec_);
+    }
+#endif
+}
+
+bool OpusDecoderWrapper::Decode(std::vector<uint8_t>&& opus, std::vector<int16_t>& pcm) {
+#if HOST_HAVE_LIBOPUS
+    pcm.resize(frame_size_);
+    // An empty packet asks libopus for packet loss concealment
+    auto ret = opus_decode(audio_dec_, opus.empty() ? nullptr : opus.data(), opus.size(), pcm.data(), pcm.size(), 0);
+    if (ret < 0) {
+        ESP_LOGE(TAG, "Failed to decode audio, error code: %d", ret);
+        return false;
+    }
+    pcm.resize(ret);
+#else
+    // Raw PCM packets are produced at 16 kHz, stretch them to the decoder rate like a real decoder would.
+    // An empty packet (loss concealment) decodes to silence.
+    size_t input_samples = opus.size() / sizeof(int16_t);
+    pcm.resize(frame_size_);
+    const int16_t* input = reinterpret_cast<const int16_t*>(opus.data());
+    for (size_t i = 0; i < pcm.size(); i++) {
+        size_t j = input_samples > 0 ? i * input_samples / pcm.size() : 0;
+        pcm[i] = input_samples > 0 ? input[j] : 0;
+    }
+#endif
+    return true;
+}
+
+void OpusDecoderWrapper::ResetState() {
+#if HOST_HAVE_LIBOPUS
+    opus_decoder_ctl(audio_dec_, OPUS_RESET_STATE);
+#endif
+}
+
+void OpusResampler::Configure(int input_sample_rate, int output_sample_rate) {
+    input_sample_rate_ = input_sample_rate;
+    output_sample_rate_ = output_sample_rate;
+}
+
+int OpusResampler::GetOutputSamples(int input_samples) const {
+    return (long long)input_samples * output_sample_rate_ / input_sample_rate_;
+}
+
+void OpusResampler::Process(const int16_t* input, int input_samples, int16_t* output) {
+    int output_samples = GetOutputSamples(input_samples);
+    for (int i = 0; i < output_samples; i++) {
+        // Position in the input in 16.16 fixed point
+        long long position = ((long long)i * input_sample_rate_ << 16) / output_sample_rate_;
+        int index = position >> 16;
+        int fraction = position & 0xffff;
+        int a = input[index];
+        int b = index + 1 < input_samples ? input[index + 1] : a;
+        output[i] = a + (((b - a) * fraction) >> 16);
+    }
+}
@@ -0,0 +1,95 @@
+/*
+ * Host replacements for the pieces of the firmware that AudioService links against but the
+ * benchmark does not exercise.
+ */
+
+#include "settings.h"
+#include "wake_words/esp_wake_word.h"
+
+#include <map>
+#include <mutex>
+
+static std::mutex settings_mutex;
+static std::map<std::string, std::string> settings_values;
+
+Settings::Settings(const std::string& ns, bool read_write) : ns_(ns) {
+}
+
+std::string Settings::GetString(const std::string& key, const std::string& default_value) {
+    std::lock_guard<std::mutex> lock(settings_mutex);
+    auto it = settings_values.find(ns_ + "." + key);
+    return it != settings_values.end() ? it->second : default_value;
+}
+
+void Settings::SetString(const std::string& key, const std::string& value) {
+    std::lock_guard<std::mutex> lock(settings_mutex);
+    settings_values[ns_ + "." + key] = value;
+}
+
+int32_t Settings::GetInt(const std::string& key, int32_t default_value) {
+    auto value = GetString(key);
+    return value.empty() ? default_value : std::stoi(value);
+}
+
+void Settings::SetInt(const std::string& key, int32_t value) {
+    SetString(key, std::to_string(value));
+}
+
+bool Settings::GetBool(const std::string& key, bool default_value) {
+    return GetInt(key, default_value ? 1 : 0) != 0;
+}
+
+void Settings::SetBool(const std::string& key, bool value) {
+    SetInt(key, value ? 1 : 0);
+}
+
+void Settings::EraseKey(const std::string& key) {
+    std::lock_guard<std::mutex> lock(settings_mutex);
+    settings_values.erase(ns_ + "." + key);
+}
+
+void Settings::EraseAll() {
+    std::lock_guard<std::mutex> lock(settings_mutex);
+    for (auto it = settings_values.begin(); it != settings_values.end();) {
+        if (it->first.compare(0, ns_.size() + 1, ns_ + ".") == 0) {
+            it = settings_values.erase(it);
+        } else {
+            ++it;
+        }
+    }
+}
+
+// esp_srmodel_filter never finds a model on the host, so the wake word is never instantiated
+EspWakeWord::EspWakeWord() {
+}
+
+EspWakeWord::~EspWakeWord() {
+}
+
+bool EspWakeWord::Initialize(AudioCodec* codec, srmodel_list_t* models_list) {
+    return false;
+}
+
+void EspWakeWord::Feed(const std::vector<int16_t>& data) {
+}
+
+void EspWakeWord::OnWakeWordDetected(std::function<void(const std::string& wake_word)> callback) {
+    wake_word_detected_callback_ = callback;
+}
+
+void EspWakeWord::Start() {
+}
+
+void EspWakeWord::Stop() {
+}
+
+size_t EspWakeWord::GetFeedSize() {
+    return 0;
+}
+
+void EspWakeWord::EncodeWakeWordData() {
+}
+
+bool EspWakeWord::GetWakeWordOpus(std::vector<uint8_t>& opus) {
+    return false;
+}
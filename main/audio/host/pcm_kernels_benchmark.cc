@@ -0,0 +1,248 @@
+/*
+ * Micro-benchmark for audio_pcm_kernels and AudioInputConverter.
+ *
+ * Checks every kernel against its portable version for all pointer phases and odd lengths,
+ * then times the kernels and the full stereo input conversion against the previous
+ * split -> resample x2 -> merge loops.
+ *
+ * Usage: pcm_kernels_benchmark [--iterations N]
+ */
+
+#include "audio_pcm_kernels.h"
+#include "audio_input_converter.h"
+
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <vector>
+
+static double TimeNs(int iterations, const std::function<void()>& body) {
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < iterations; i++) {
+        body();
+    }
+    auto elapsed = std::chrono::steady_clock::now() - start;
+    return std::chrono::duration<double, std::nano>(elapsed).count() / iterations;
+}
+
+static bool CheckKernels() {
+    std::vector<int16_t> input(2 * 1100 + 16);
+    for (size_t i = 0; i < input.size(); i++) {
+        input[i] = (int16_t)(rand() & 0xffff);
+    }
+
+    for (size_t frames : {0, 1, 7, 8, 9, 31, 480, 1023}) {
+        for (int phase = 0; phase < 8; phase++) {
+            const int16_t* in = input.data() + phase;
+            std::vector<int16_t> left(frames + 8), right(frames + 8), left_ref(frames + 8), right_ref(frames + 8);
+            PcmDeinterleaveStereo(in, left.data() + phase, right.data() + phase, frames);
+            PcmDeinterleaveStereoScalar(in, left_ref.data() + phase, right_ref.data() + phase, frames);
+            if (left != left_ref || right != right_ref) {
+                printf("PcmDeinterleaveStereo mismatch: frames=%zu phase=%d\n", frames, phase);
+                return false;
+            }
+
+            std::vector<int16_t> output(2 * frames + 16), output_ref(2 * frames + 16);
+            PcmInterleaveStereo(left.data() + phase, right.data() + phase, output.data() + phase, frames);
+            PcmInterleaveStereoScalar(left_ref.data() + phase, right_ref.data() + phase, output_ref.data() + phase, frames);
+            if (output != output_ref) {
+                printf("PcmInterleaveStereo mismatch: frames=%zu phase=%d\n", frames, phase);
+                return false;
+            }
+
+            for (int channel = 0; channel < 2; channel++) {
+                std::vector<int16_t> in_place(in, in + 2 * frames);
+                std::vector<int16_t> expected(frames);
+                PcmExtractChannelScalar(in, expected.data(), frames, 2, channel);
+                PcmExtractChannel(in_place.data(), in_place.data(), frames, 2, channel);
+                if (memcmp(in_place.data(), expected.data(), frames * sizeof(int16_t)) != 0) {
+                    printf("PcmExtractChannel mismatch: frames=%zu phase=%d channel=%d\n", frames, phase, channel);
+                    return false;
+                }
+            }
+        }
+    }
+
+    std::vector<int32_t> wide(1031), wide_ref(1031);
+    std::vector<int16_t> narrow(1031), narrow_ref(1031);
+    for (int volume : {0, 1, 37, 70, 99, 100}) {
+        int32_t gain = PcmVolumeToGainQ16(volume);
+        PcmScale16To32(input.data(), wide.data(), wide.size(), gain);
+        PcmScale16To32Scalar(input.data(), wide_ref.data(), wide_ref.size(), gain);
+        if (wide != wide_ref) {
+            printf("PcmScale16To32 mismatch: volume=%d\n", volume);
+            return false;
+        }
+    }
+    for (size_t i = 0; i < wide.size(); i++) {
+        wide[i] = (int32_t)((uint32_t)rand() << 16 ^ (uint32_t)rand());
+    }
+    for (int shift : {0, 8, 12, 16}) {
+        PcmNarrow32To16(wide.data(), narrow.data(), narrow.size(), shift);
+        PcmNarrow32To16Scalar(wide.data(), narrow_ref.data(), narrow_ref.size(), shift);
+        if (narrow != narrow_ref) {
+            printf("PcmNarrow32To16 mismatch: shift=%d\n", shift);
+            return false;
+        }
+    }
+    for (int32_t gain : {0, 128, 256, 256 * 3, 256 * 30, 256 * 200}) {
+        std::vector<int16_t> data(input.begin(), input.begin() + 1031), data_ref = data;
+        PcmApplyGain(data.data(), data.size(), gain);
+        PcmApplyGainScalar(data_ref.data(), data_ref.size(), gain);
+        if (data != data_ref) {
+            printf("PcmApplyGain mismatch: gain_q8=%d\n", gain);
+            return false;
+        }
+    }
+    return true;
+}
+
+// The conversion AudioService::ReadAudioData did before AudioInputConverter
+static void LegacyConvert(std::vector<int16_t>& data, OpusResampler& mic_resampler, OpusResampler& reference_resampler,
+    std::vector<int16_t>& mic, std::vector<int16_t>& reference,
+    std::vector<int16_t>& resampled_mic, std::vector<int16_t>& resampled_reference) {
+    mic.resize(data.size() / 2);
+    reference.resize(data.size() / 2);
+    for (size_t i = 0, j = 0; i < mic.size(); ++i, j += 2) {
+        mic[i] = data[j];
+        reference[i] = data[j + 1];
+    }
+    resampled_mic.resize(mic_resampler.GetOutputSamples(mic.size()));
+    resampled_reference.resize(reference_resampler.GetOutputSamples(reference.size()));
+    mic_resampler.Process(mic.data(), mic.size(), resampled_mic.data());
+    reference_resampler.Process(reference.data(), reference.size(), resampled_reference.data());
+    data.resize(resampled_mic.size() + resampled_reference.size());
+    for (size_t i = 0, j = 0; i < resampled_mic.size(); ++i, j += 2) {
+        data[j] = resampled_mic[i];
+        data[j + 1] = resampled_reference[i];
+    }
+}
+
+int main(int argc, char** argv) {
+    int iterations = 20000;
+    if (argc == 3 && strcmp(argv[1], "--iterations") == 0) {
+        iterations = atoi(argv[2]);
+    }
+
+    printf("Backend: %s\n", PcmKernelsBackend());
+    if (!CheckKernels()) {
+        return 1;
+    }
+    printf("Kernels match the portable versions\n\n");
+
+    printf("%-34s %12s %12s %8s\n", "kernel (24 kHz stereo)", "scalar ns", "dispatch ns", "speedup");
+    for (int duration_ms : {10, 30, 60}) {
+        size_t frames = 24 * duration_ms;
+        std::vector<int16_t> input(2 * frames), left(frames), right(frames), output(2 * frames);
+        for (size_t i = 0; i < input.size(); i++) {
+            input[i] = (int16_t)i;
+        }
+        char name[64];
+
+        double scalar = TimeNs(iterations, [&]() {
+            PcmDeinterleaveStereoScalar(input.data(), left.data(), right.data(), frames);
+        });
+        double simd = TimeNs(iterations, [&]() {
+            PcmDeinterleaveStereo(input.data(), left.data(), right.data(), frames);
+        });
+        snprintf(name, sizeof(name), "deinterleave %d ms", duration_ms);
+        printf("%-34s %12.0f %12.0f %7.1fx\n", name, scalar, simd, scalar / simd);
+
+        scalar = TimeNs(iterations, [&]() {
+            PcmInterleaveStereoScalar(left.data(), right.data(), output.data(), frames);
+        });
+        simd = TimeNs(iterations, [&]() {
+            PcmInterleaveStereo(left.data(), right.data(), output.data(), frames);
+        });
+        snprintf(name, sizeof(name), "interleave %d ms", duration_ms);
+        printf("%-34s %12.0f %12.0f %7.1fx\n", name, scalar, simd, scalar / simd);
+
+        scalar = TimeNs(iterations, [&]() {
+            PcmExtractChannelScalar(input.data(), left.data(), frames, 2, 0);
+        });
+        simd = TimeNs(iterations, [&]() {
+            PcmExtractChannel(input.data(), left.data(), frames, 2, 0);
+        });
+        snprintf(name, sizeof(name), "extract channel %d ms", duration_ms);
+        printf("%-34s %12.0f %12.0f %7.1fx\n", name, scalar, simd, scalar / simd);
+    }
+
+    printf("\n%-34s %12s %12s %8s\n", "I2S slot conversion (24 kHz)", "legacy ns", "kernel ns", "speedup");
+    for (int duration_ms : {10, 30, 60}) {
+        size_t samples = 24 * duration_ms;
+        std::vector<int16_t> pcm(samples);
+        for (size_t i = 0; i < samples; i++) {
+            pcm[i] = (int16_t)(i * 37);
+        }
+        std::vector<int32_t> slots(samples);
+        int output_volume = 70;
+        char name[64];
+
+        // What NoAudioCodec::Write / Read did before the shared kernels
+        double legacy = TimeNs(iterations, [&]() {
+            std::vector<int32_t> buffer(samples);
+            int32_t volume_factor = pow(double(output_volume) / 100.0, 2) * 65536;
+            for (size_t i = 0; i < samples; i++) {
+                int64_t temp = int64_t(pcm[i]) * volume_factor;
+                buffer[i] = temp > INT32_MAX ? INT32_MAX : temp < INT32_MIN ? INT32_MIN : (int32_t)temp;
+            }
+            slots.swap(buffer);
+        });
+        double kernel = TimeNs(iterations, [&]() {
+            PcmScale16To32(pcm.data(), slots.data(), samples, PcmVolumeToGainQ16(output_volume));
+        });
+        snprintf(name, sizeof(name), "write 16 -> 32 %d ms", duration_ms);
+        printf("%-34s %12.0f %12.0f %7.1fx\n", name, legacy, kernel, legacy / kernel);
+
+        legacy = TimeNs(iterations, [&]() {
+            std::vector<int32_t> bit32_buffer(slots);
+            for (size_t i = 0; i < samples; i++) {
+                int32_t value = bit32_buffer[i] >> 12;
+                pcm[i] = (value > INT16_MAX) ? INT16_MAX : (value < -INT16_MAX) ? -INT16_MAX : (int16_t)value;
+            }
+        });
+        kernel = TimeNs(iterations, [&]() {
+            PcmNarrow32To16(slots.data(), pcm.data(), samples, 12);
+        });
+        snprintf(name, sizeof(name), "read 32 -> 16 %d ms", duration_ms);
+        printf("%-34s %12.0f %12.0f %7.1fx\n", name, legacy, kernel, legacy / kernel);
+    }
+
+    printf("\n%-34s %12s %12s %8s\n", "input conversion 24 -> 16 kHz", "legacy ns", "converter ns", "speedup");
+    for (int duration_ms : {10, 30, 60}) {
+        size_t frames = 24 * duration_ms;
+        std::vector<int16_t> source(2 * frames);
+        for (size_t i = 0; i < source.size(); i++) {
+            source[i] = (int16_t)(i * 37);
+        }
+
+        OpusResampler mic_resampler, reference_resampler;
+        mic_resampler.Configure(24000, 16000);
+        reference_resampler.Configure(24000, 16000);
+        std::vector<int16_t> data, mic, reference, resampled_mic, resampled_reference;
+        double legacy = TimeNs(iterations, [&]() {
+            data.assign(source.begin(), source.end());
+            LegacyConvert(data, mic_resampler, reference_resampler, mic, reference, resampled_mic, resampled_reference);
+        });
+        std::vector<int16_t> expected = data;
+
+        AudioInputConverter converter;
+        converter.Configure(24000, 16000, 2);
+        double fused = TimeNs(iterations, [&]() {
+            data.assign(source.begin(), source.end());
+            converter.Process(data);
+        });
+        if (data != expected) {
+            printf("AudioInputConverter output differs from the legacy conversion\n");
+            return 1;
+        }
+
+        char name[64];
+        snprintf(name, sizeof(name), "stereo %d ms", duration_ms);
+        printf("%-34s %12.0f %12.0f %7.1fx\n", name, legacy, fused, legacy / fused);
+    }
+    return 0;
+}
@@ -0,0 +1,6 @@
+#ifndef HOST_BOARD_H
+#define HOST_BOARD_H
+
+// audio_codec.h includes board.h but the audio pipeline does not use the board on the host
+
+#endif // HOST_BOARD_H
@@ -0,0 +1,7 @@
+#ifndef HOST_CJSON_H
+#define HOST_CJSON_H
+
+// protocol.h only needs the type for its callbacks
+typedef struct cJSON cJSON;
+
+#endif // HOST_CJSON_H
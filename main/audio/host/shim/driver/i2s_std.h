@@ -0,0 +1,6 @@
+#ifndef HOST_DRIVER_I2S_STD_H
+#define HOST_DRIVER_I2S_STD_H
+
+#include "driver/i2s_common.h"
+
+#endif // HOST_DRIVER_I2S_STD_H
@@ -0,0 +1,6 @@
+#ifndef HOST_ESP_WN_MODELS_H
+#define HOST_ESP_WN_MODELS_H
+
+#include "esp_wn_iface.h"
+
+#endif // HOST_ESP_WN_MODELS_H
@@ -0,0 +1,22 @@
+#ifndef HOST_FREERTOS_H
+#define HOST_FREERTOS_H
+
+/*
+ * Minimal FreeRTOS API for the host build: tasks run on std::thread, ticks are milliseconds.
+ */
+
+#include <cstdint>
+#include "sdkconfig.h"
+
+typedef uint32_t TickType_t;
+typedef long BaseType_t;
+typedef unsigned long UBaseType_t;
+
+#define pdTRUE          1
+#define pdFALSE         0
+#define pdPASS          pdTRUE
+#define portMAX_DELAY   ((TickType_t)0xffffffffUL)
+#define portTICK_PERIOD_MS 1
+#define pdMS_TO_TICKS(ms) ((TickType_t)(ms))
+
+#endif // HOST_FREERTOS_H
@@ -0,0 +1,17 @@
+#ifndef HOST_FREERTOS_TASK_H
+#define HOST_FREERTOS_TASK_H
+
+#include "freertos/FreeRTOS.h"
+
+typedef void (*TaskFunction_t)(void*);
+typedef struct HostTask* TaskHandle_t;
+
+BaseType_t xTaskCreate(TaskFunction_t task, const char* name, uint32_t stack_depth,
+    void* arg, UBaseType_t priority, TaskHandle_t* handle);
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t task, const char* name, uint32_t stack_depth,
+    void* arg, UBaseType_t priority, TaskHandle_t* handle, BaseType_t core_id);
+// The host thread simply returns after the task function, so deleting the current task is a no-op
+void vTaskDelete(TaskHandle_t handle);
+void vTaskDelay(TickType_t ticks);
+
+#endif // HOST_FREERTOS_TASK_H
@@ -0,0 +1,19 @@
+#ifndef HOST_MODEL_PATH_H
+#define HOST_MODEL_PATH_H
+
+// No speech recognition models on the host, esp_srmodel_filter never finds anything
+
+#define ESP_WN_PREFIX "wn"
+#define ESP_MN_PREFIX "mn"
+
+typedef struct {
+    char** model_name;
+    char** model_info;
+    int num;
+} srmodel_list_t;
+
+inline char* esp_srmodel_filter(srmodel_list_t* models, const char* keyword1, const char* keyword2) {
+    return nullptr;
+}
+
+#endif // HOST_MODEL_PATH_H
@@ -0,0 +1,41 @@
+#ifndef HOST_OPUS_ENCODER_H
+#define HOST_OPUS_ENCODER_H
+
+#include <vector>
+#include <memory>
+#include <functional>
+#include <cstdint>
+
+/*
+ * Host version of the esp-opus-encoder OpusEncoderWrapper. It uses libopus when the host has it,
+ * otherwise it stores the raw PCM so that the pipeline still runs end to end.
+ */
+
+#define MAX_OPUS_PACKET_SIZE 1000
+
+struct OpusEncoder;
+
+class OpusEncoderWrapper {
+public:
+    OpusEncoderWrapper(int sample_rate, int channels, int duration_ms = 60);
+    ~OpusEncoderWrapper();
+
+    inline int sample_rate() const { return sample_rate_; }
+    inline int duration_ms() const { return duration_ms_; }
+
+    void SetDtx(bool enable);
+    void SetComplexity(int complexity);
+    void Encode(std::vector<int16_t>&& pcm, std::function<void(std::vector<uint8_t>&& opus)> handler);
+    bool Encode(std::vector<int16_t>&& pcm, std::vector<uint8_t>& opus);
+    bool IsBufferEmpty() const { return in_buffer_.empty(); }
+    void ResetState();
+
+private:
+    OpusEncoder* audio_enc_ = nullptr;
+    int sample_rate_;
+    int duration_ms_;
+    int frame_size_;
+    std::vector<int16_t> in_buffer_;
+};
+
+#endif // HOST_OPUS_ENCODER_H
@@ -0,0 +1,6 @@
+#ifndef HOST_SDKCONFIG_H
+#define HOST_SDKCONFIG_H
+
+// The host build uses NoAudioProcessor and no device or server AEC, so no option is enabled here
+
+#endif // HOST_SDKCONFIG_H
@@ -0,0 +1,241 @@
+#include "ogg_demuxer.h"
+
+#include <esp_log.h>
+#include <cstring>
+
+#define TAG "OggDemuxer"
+
+#define OGG_PAGE_HEADER_SIZE 27
+#define OGG_HEADER_TYPE_CONTINUED 0x01
+#define OGG_HEADER_TYPE_EOS 0x04
+
+uint32_t OggDemuxer::ReadLe32(const uint8_t* p) {
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+uint32_t OggDemuxer::GetPacketSamples(const uint8_t* data, size_t size) {
+    if (size < 1) {
+        return 0;
+    }
+    // RFC 6716 section 3.1: the configuration selects the frame size, the code the frame count
+    static const uint16_t silk_samples[4] = { 480, 960, 1920, 2880 };
+    static const uint16_t celt_samples[4] = { 120, 240, 480, 960 };
+    uint8_t config = data[0] >> 3;
+    uint32_t frame_samples;
+    if (config < 12) {
+        frame_samples = silk_samples[config & 3];
+    } else if (config < 16) {
+        frame_samples = (config & 1) ? 960 : 480;
+    } else {
+        frame_samples = celt_samples[config & 3];
+    }
+
+    uint32_t frames;
+    switch (data[0] & 3) {
+    case 0:
+        frames = 1;
+        break;
+    case 3:
+        if (size < 2) {
+            return 0;
+        }
+        frames = data[1] & 0x3F;
+        break;
+    default:
+        frames = 2;
+        break;
+    }
+    return frame_samples * frames;
+}
+
+void OggDemuxer::Reset() {
+    data_ = nullptr;
+    size_ = 0;
+    open_ = false;
+    segment_count_ = 0;
+    segment_index_ = 0;
+    continued_.clear();
+}
+
+bool OggDemuxer::NextPage() {
+    size_t offset = next_page_offset_;
+    if (offset + 4 > size_ || memcmp(data_ + offset, "OggS", 4) != 0) {
+        // Damaged stream, look for the next capture pattern
+        const uint8_t* found = nullptr;
+        for (size_t i = offset; i + 4 <= size_; i++) {
+            if (data_[i] == 'O' && memcmp(data_ + i, "OggS", 4) == 0) {
+                found = data_ + i;
+                break;
+            }
+        }
+        if (found == nullptr) {
+            return false;
+        }
+        ESP_LOGW(TAG, "Skipped %u bytes to the next page", (unsigned)(found - data_ - offset));
+        offset = found - data_;
+    }
+    if (offset + OGG_PAGE_HEADER_SIZE > size_) {
+        return false;
+    }
+
+    const uint8_t* page = data_ + offset;
+    int segments = page[26];
+    size_t body = offset + OGG_PAGE_HEADER_SIZE + segments;
+    if (body > size_) {
+        return false;
+    }
+    size_t body_size = 0;
+    for (int i = 0; i < segments; i++) {
+        body_size += page[OGG_PAGE_HEADER_SIZE + i];
+    }
+    if (body + body_size > size_) {
+        ESP_LOGW(TAG, "Truncated page at %u", (unsigned)offset);
+        return false;
+    }
+
+    page_offset_ = offset;
+    next_page_offset_ = body + body_size;
+    lacing_ = page + OGG_PAGE_HEADER_SIZE;
+    segment_count_ = segments;
+    segment_index_ = 0;
+    body_offset_ = body;
+    granule_position_ = (int64_t)((uint64_t)ReadLe32(page + 6) | ((uint64_t)ReadLe32(page + 10) << 32));
+    last_page_ = (page[5] & OGG_HEADER_TYPE_EOS) != 0 || next_page_offset_ >= size_;
+    return true;
+}
+
+bool OggDemuxer::ReadPacket(const uint8_t*& data, size_t& size, bool& last_on_page) {
+    continued_.clear();
+    bool spanning = false;
+    while (true) {
+        if (segment_index_ >= segment_count_) {
+            if (!NextPage()) {
+                return false;
+            }
+            bool continued_page = (data_[page_offset_ + 5] & OGG_HEADER_TYPE_CONTINUED) != 0;
+            if (continued_page && !spanning) {
+                // The tail of a packet whose start we did not see, skip it
+                while (segment_index_ < segment_count_ && lacing_[segment_index_] == 255) {
+                    body_offset_ += lacing_[segment_index_++];
+                }
+                if (segment_index_ < segment_count_) {
+                    body_offset_ += lacing_[segment_index_++];
+                }
+                continue;
+            }
+        }
+
+        size_t start = body_offset_;
+        size_t length = 0;
+        bool complete = false;
+        while (segment_index_ < segment_count_) {
+            uint8_t lacing = lacing_[segment_index_++];
+            length += lacing;
+            if (lacing < 255) {
+                complete = true;
+                break;
+            }
+        }
+        body_offset_ += length;
+
+        if (!complete) {
+            // The packet continues on the next page, this is the only case that copies
+            continued_.insert(continued_.end(), data_ + start, data_ + start + length);
+            spanning = true;
+            continue;
+        }
+
+        if (spanning) {
+            continued_.insert(continued_.end(), data_ + start, data_ + start + length);
+            data = continued_.data();
+            size = continued_.size();
+        } else {
+            data = data_ + start;
+            size = length;
+        }
+
+        // Whether another packet completes on this page, the granule position belongs to the last one
+        last_on_page = true;
+        for (int i = segment_index_; i < segment_count_; i++) {
+            if (lacing_[i] < 255) {
+                last_on_page = false;
+                break;
+            }
+        }
+        return true;
+    }
+}
+
+bool OggDemuxer::Open(std::string_view data) {
+    Reset();
+    data_ = reinterpret_cast<const uint8_t*>(data.data());
+    size_ = data.size();
+    next_page_offset_ = 0;
+    position_ = 0;
+
+    const uint8_t* packet;
+    size_t size;
+    bool last_on_page;
+    if (!ReadPacket(packet, size, last_on_page) || size < 19 || memcmp(packet, "OpusHead", 8) != 0) {
+        ESP_LOGE(TAG, "OpusHead not found");
+        Reset();
+        return false;
+    }
+    // OpusHead: [8] version, [9] channel count, [10-11] pre-skip, [12-15] input sample rate
+    channels_ = packet[9];
+    pre_skip_ = packet[10] | (packet[11] << 8);
+    sample_rate_ = ReadLe32(packet + 12);
+    if (sample_rate_ != 8000 && sample_rate_ != 12000 && sample_rate_ != 16000 &&
+        sample_rate_ != 24000 && sample_rate_ != 48000) {
+        // Opus decodes at any of its rates, the input rate is only a hint
+        sample_rate_ = 48000;
+    }
+
+    if (!ReadPacket(packet, size, last_on_page) || size < 8 || memcmp(packet, "OpusTags", 8) != 0) {
+        ESP_LOGE(TAG, "OpusTags not found");
+        Reset();
+        return false;
+    }
+    continued_.clear();
+    continued_.shrink_to_fit();
+
+    open_ = true;
+    return true;
+}
+
+bool OggDemuxer::NextPacket(OggOpusPacket& packet) {
+    if (!open_) {
+        return false;
+    }
+
+    bool last_on_page;
+    while (ReadPacket(packet.data, packet.size, last_on_page)) {
+        if (packet.size == 0) {
+            continue;
+        }
+        packet.samples = GetPacketSamples(packet.data, packet.size);
+        if (packet.samples == 0) {
+            ESP_LOGW(TAG, "Invalid Opus packet of %u bytes", (unsigned)packet.size);
+            continue;
+        }
+        packet.frame_duration = (packet.samples + 47) / 48;
+
+        int64_t start = position_;
+        int64_t end = start + packet.samples;
+        position_ = end;
+        // The granule position of the last page marks the end of the audio
+        if (last_on_page && last_page_ && granule_position_ >= 0 && granule_position_ < end) {
+            end = granule_position_ > start ? granule_position_ : start;
+        }
+        int64_t skip = (int64_t)pre_skip_ > start ? (int64_t)pre_skip_ - start : 0;
+        if (skip > end - start) {
+            skip = end - start;
+        }
+        packet.skip_samples = skip;
+        packet.keep_samples = end - start - skip;
+        return true;
+    }
+
+    open_ = false;
+    return false;
+}
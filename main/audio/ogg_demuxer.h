@@ -0,0 +1,77 @@
+#ifndef OGG_DEMUXER_H
+#define OGG_DEMUXER_H
+
+#include <string_view>
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+
+/*
+ * Streaming Ogg Opus demuxer for sounds stored in flash (embedded files or the mmapped assets
+ * partition).
+ *
+ * Pages are walked by their header lengths, so the data is never scanned byte by byte unless
+ * the stream is damaged. Packets are handed out as views into the original buffer, which must
+ * stay valid until the demuxer is reset or reopened. Only a packet that continues onto the
+ * next page is copied, into a buffer owned by the demuxer. Page CRCs are not checked.
+ *
+ * Each packet reports its duration from the Opus TOC byte. It also reports how many samples to
+ * drop and keep, from the OpusHead pre-skip and, on the last page, from the granule position.
+ * Sample counts are at 48 kHz, as in the Ogg Opus mapping (RFC 7845).
+ */
+
+struct OggOpusPacket {
+    const uint8_t* data = nullptr;
+    size_t size = 0;
+    int frame_duration = 0;         // Milliseconds, rounded up
+    uint32_t samples = 0;           // Duration in 48 kHz samples
+    uint32_t skip_samples = 0;      // Samples to drop from the start of the decoded packet
+    uint32_t keep_samples = 0;      // Samples to keep after the skipped ones
+};
+
+class OggDemuxer {
+public:
+    OggDemuxer() = default;
+    OggDemuxer(const OggDemuxer&) = delete;
+    OggDemuxer& operator=(const OggDemuxer&) = delete;
+
+    // Parses the OpusHead and OpusTags headers, the packets are read with NextPacket()
+    bool Open(std::string_view data);
+    // Returns false at the end of the stream
+    bool NextPacket(OggOpusPacket& packet);
+    void Reset();
+
+    bool IsOpen() const { return open_; }
+    int sample_rate() const { return sample_rate_; }
+    int channels() const { return channels_; }
+
+    // Duration of the Opus packet in 48 kHz samples, 0 if the TOC is invalid
+    static uint32_t GetPacketSamples(const uint8_t* data, size_t size);
+
+private:
+    const uint8_t* data_ = nullptr;
+    size_t size_ = 0;
+    bool open_ = false;
+    int sample_rate_ = 0;
+    int channels_ = 0;
+    uint32_t pre_skip_ = 0;
+
+    // Current page
+    size_t page_offset_ = 0;
+    size_t next_page_offset_ = 0;
+    const uint8_t* lacing_ = nullptr;
+    int segment_count_ = 0;
+    int segment_index_ = 0;
+    size_t body_offset_ = 0;        // Start of the next packet data in the page body
+    int64_t granule_position_ = -1;
+    bool last_page_ = false;
+
+    int64_t position_ = 0;          // End of the last returned packet, in 48 kHz samples
+    std::vector<uint8_t> continued_;
+
+    bool NextPage();
+    bool ReadPacket(const uint8_t*& data, size_t& size, bool& last_on_page);
+    static uint32_t ReadLe32(const uint8_t* p);
+};
+
+#endif // OGG_DEMUXER_H
@@ -74,6 +74,11 @@ void AfeAudioProcessor::Initialize(AudioCodec* codec, int frame_duration_ms, srm
     }, "audio_communication", 4096, this, 3, NULL);
 }
 
+void AfeAudioProcessor::SetOutputFrameDuration(int frame_duration_ms) {
+    // Read by the processor task on its next fetch, the buffered samples are split at the new size
+    frame_samples_.store(frame_duration_ms * 16000 / 1000, std::memory_order_relaxed);
+}
+
 AfeAudioProcessor::~AfeAudioProcessor() {
     if (afe_data_ != nullptr) {
         afe_iface_->destroy(afe_data_);
@@ -151,21 +156,24 @@ void AfeAudioProcessor::AudioProcessorTask() {
 
         if (output_callback_) {
             size_t samples = res->data_size / sizeof(int16_t);
+            // One frame size for the whole fetch, a new duration applies from the next one
+            size_t frame_samples = frame_samples_.load(std::memory_order_relaxed);
             
             // Add data to buffer
             output_buffer_.insert(output_buffer_.end(), res->data, res->data + samples);
             
             // Output complete frames when buffer has enough data
-            while (output_buffer_.size() >= frame_samples_) {
-                if (output_buffer_.size() == frame_samples_) {
+            while (output_buffer_.size() >= frame_samples) {
+                if (output_buffer_.size() == frame_samples) {
                     // If buffer size equals frame size, move the entire buffer
                     output_callback_(std::move(output_buffer_));
                     output_buffer_.clear();
-                    output_buffer_.reserve(frame_samples_);
+                    output_buffer_.reserve(frame_samples);
                 } else {
                     // If buffer size exceeds frame size, copy one frame and remove it
-                    output_callback_(std::vector<int16_t>(output_buffer_.begin(), output_buffer_.begin() + frame_samples_));
-                    output_buffer_.erase(output_buffer_.begin(), output_buffer_.begin() + frame_samples_);
+                    frame_buffer_.assign(output_buffer_.begin(), output_buffer_.begin() + frame_samples);
+                    output_callback_(std::move(frame_buffer_));
+                    output_buffer_.erase(output_buffer_.begin(), output_buffer_.begin() + frame_samples);
                 }
             }
         }
@@ -9,6 +9,7 @@
 #include <string>
 #include <vector>
 #include <functional>
+#include <atomic>
 
 #include "audio_processor.h"
 #include "audio_codec.h"
@@ -19,6 +20,7 @@ public:
     ~AfeAudioProcessor();
 
     void Initialize(AudioCodec* codec, int frame_duration_ms, srmodel_list_t* models_list) override;
+    void SetOutputFrameDuration(int frame_duration_ms) override;
     void Feed(std::vector<int16_t>&& data) override;
     void Start() override;
     void Stop() override;
@@ -35,9 +37,10 @@ private:
     std::function<void(std::vector<int16_t>&& data)> output_callback_;
     std::function<void(bool speaking)> vad_state_change_callback_;
     AudioCodec* codec_ = nullptr;
-    int frame_samples_ = 0;
+    std::atomic<size_t> frame_samples_ = 0;   // Set by the audio service, read by the processor task
     bool is_speaking_ = false;
     std::vector<int16_t> output_buffer_;
+    std::vector<int16_t> frame_buffer_;
 
     void AudioProcessorTask();
 };
@@ -13,6 +13,7 @@ public:
     ~NoAudioProcessor() = default;
 
     void Initialize(AudioCodec* codec, int frame_duration_ms, srmodel_list_t* models_list) override;
+    void SetOutputFrameDuration(int frame_duration_ms) override;
     void Feed(std::vector<int16_t>&& data) override;
     void Start() override;
     void Stop() override;
@@ -0,0 +1,118 @@
+#include "audio_sender.h"
+
+#include <esp_log.h>
+#include <esp_timer.h>
+
+#define TAG "AudioSender"
+
+AudioSender::AudioSender(AudioService& audio_service) : audio_service_(audio_service) {
+    event_group_ = xEventGroupCreate();
+}
+
+AudioSender::~AudioSender() {
+    if (task_handle_ != nullptr) {
+        vTaskDelete(task_handle_);
+    }
+    vEventGroupDelete(event_group_);
+}
+
+void AudioSender::Start() {
+    if (task_handle_ != nullptr) {
+        return;
+    }
+    // The transport writes run on this stack, including TLS for the WebSocket protocol
+    xTaskCreate([](void* arg) {
+        AudioSender* sender = (AudioSender*)arg;
+        sender->SendTask();
+        vTaskDelete(NULL);
+    }, "audio_send", 2048 * 3, this, 4, &task_handle_);
+}
+
+void AudioSender::Notify() {
+    xEventGroupSetBits(event_group_, AUDIO_SENDER_EVENT_DATA);
+}
+
+void AudioSender::SetProtocol(Protocol* protocol) {
+    std::lock_guard<std::mutex> lock(protocol_mutex_);
+    protocol_ = protocol;
+}
+
+bool AudioSender::Send(std::unique_ptr<AudioStreamPacket> packet) {
+    return protocol_ != nullptr && protocol_->SendAudio(std::move(packet));
+}
+
+void AudioSender::SendTask() {
+    std::unique_ptr<AudioStreamPacket> batch[AUDIO_SENDER_MAX_BATCH];
+    while (true) {
+        xEventGroupWaitBits(event_group_, AUDIO_SENDER_EVENT_DATA, pdTRUE, pdFALSE, portMAX_DELAY);
+
+        // Only the packets that are already encoded go into a batch, the sender never waits for more
+        while (true) {
+            size_t count = 0;
+            while (count < AUDIO_SENDER_MAX_BATCH) {
+                auto packet = audio_service_.PopPacketFromSendQueue();
+                if (!packet) {
+                    break;
+                }
+                batch[count++] = std::move(packet);
+            }
+            if (count == 0) {
+                break;
+            }
+            SendBatch(batch, count);
+        }
+    }
+}
+
+void AudioSender::SendBatch(std::unique_ptr<AudioStreamPacket>* packets, size_t count) {
+    // The protocol takes the packets, keep their queue times for the latency
+    int64_t enqueue_times[AUDIO_SENDER_MAX_BATCH];
+    for (size_t i = 0; i < count; i++) {
+        enqueue_times[i] = packets[i]->enqueue_time_us;
+    }
+
+    int64_t start_time = esp_timer_get_time();
+    size_t sent = 0;
+    bool has_protocol;
+    {
+        std::lock_guard<std::mutex> lock(protocol_mutex_);
+        has_protocol = protocol_ != nullptr;
+        if (has_protocol) {
+            sent = protocol_->SendAudioBatch(packets, count);
+        }
+    }
+    int64_t end_time = esp_timer_get_time();
+
+    // Packets that were not sent go back to the pool
+    for (size_t i = 0; i < count; i++) {
+        packets[i].reset();
+    }
+
+    std::lock_guard<std::mutex> lock(stats_mutex_);
+    if (!has_protocol) {
+        stats_.discarded += count;
+        return;
+    }
+    stats_.packets += sent;
+    stats_.failures += count - sent;
+    stats_.batches++;
+    if (count > stats_.max_batch) {
+        stats_.max_batch = count;
+    }
+    stats_.write.Add(end_time - start_time);
+    for (size_t i = 0; i < sent; i++) {
+        if (enqueue_times[i] > 0) {
+            stats_.latency.Add(end_time - enqueue_times[i]);
+        }
+    }
+}
+
+AudioSenderStats AudioSender::GetStats() const {
+    AudioSenderStats stats;
+    {
+        std::lock_guard<std::mutex> lock(stats_mutex_);
+        stats = stats_;
+    }
+    stats.queue = audio_service_.GetQueueStatistics().send;
+    return stats;
+}
@@ -0,0 +1,73 @@
+#ifndef AUDIO_SENDER_H
+#define AUDIO_SENDER_H
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/event_groups.h>
+#include <freertos/task.h>
+
+#include <memory>
+#include <mutex>
+
+#include "audio_service.h"
+#include "protocol.h"
+
+#define AUDIO_SENDER_EVENT_DATA     (1 << 0)
+
+// Most packets handed to the transport in one go, the rest stay in the send queue
+#define AUDIO_SENDER_MAX_BATCH      MAX_SEND_PACKETS_IN_FLIGHT
+
+struct AudioSenderStats {
+    uint32_t packets = 0;           // Packets sent by the transport
+    uint32_t failures = 0;          // Packets the transport failed to send
+    uint32_t discarded = 0;         // Packets dropped because there was no protocol
+    uint32_t batches = 0;
+    uint32_t max_batch = 0;
+    AudioStageStats latency;        // From the send queue push to the end of the transport write
+    AudioStageStats write;          // Transport time per batch
+    AudioQueueStats queue;          // Send queue depth and the time the encoder waited for room
+};
+
+/*
+ * Network stage of the uplink, running in its own task.
+ *
+ * It takes the Opus packets that are ready in the send queue and hands them to the protocol in
+ * batches. A slow or blocked transport write therefore only holds up this task. The main loop
+ * keeps handling events, and the send queue fills up until the Opus task stops encoding. That
+ * is the backpressure on the encoder, and the send queue statistics record it.
+ */
+class AudioSender {
+public:
+    AudioSender(AudioService& audio_service);
+    ~AudioSender();
+    AudioSender(const AudioSender&) = delete;
+    AudioSender& operator=(const AudioSender&) = delete;
+
+    void Start();
+    // Called whenever a packet enters the send queue
+    void Notify();
+    // Waits for the write in progress, so the previous protocol can be destroyed afterwards
+    void SetProtocol(Protocol* protocol);
+    /*
+     * Sends a packet from the task that calls SetProtocol, which is the only task that can destroy
+     * the protocol, so it does not wait for the batch in progress. The protocol serializes the
+     * writes on its channel.
+     */
+    bool Send(std::unique_ptr<AudioStreamPacket> packet);
+    AudioSenderStats GetStats() const;
+
+private:
+    AudioService& audio_service_;
+    EventGroupHandle_t event_group_ = nullptr;
+    TaskHandle_t task_handle_ = nullptr;
+
+    std::mutex protocol_mutex_;     // Held during every batch of the send task
+    Protocol* protocol_ = nullptr;
+
+    mutable std::mutex stats_mutex_;
+    AudioSenderStats stats_;
+
+    void SendTask();
+    void SendBatch(std::unique_ptr<AudioStreamPacket>* packets, size_t count);
+};
+
+#endif // AUDIO_SENDER_H
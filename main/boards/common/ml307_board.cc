@@ -208,6 +208,14 @@ std::string Ml307Board::GetDeviceStatusJson() {
      *         "type": "cellular",
      *         "carrier": "CHINA MOBILE",
      *         "csq": 10
+     *     },
+     *     "audio_link": {
+     *         "received": 1200,
+     *         "lost": 3,
+     *         "duplicates": 0,
+     *         "reordered": 1,
+     *         "late": 0,
+     *         "jitter_ms": 12
      *     }
      * }
      */
@@ -266,6 +274,11 @@ std::string Ml307Board::GetDeviceStatusJson() {
     }
     cJSON_AddItemToObject(root, "network", network);
 
+    // Audio link
+    if (auto audio_link = Application::GetInstance().GetAudioLinkStatusJson()) {
+        cJSON_AddItemToObject(root, "audio_link", audio_link);
+    }
+
     auto json_str = cJSON_PrintUnformatted(root);
     std::string json(json_str);
     cJSON_free(json_str);
@@ -343,6 +343,11 @@ std::string WifiBoard::GetDeviceStatusJson() {
     cJSON_AddStringToObject(network, "signal", signal);
     cJSON_AddItemToObject(root, "network", network);
 
+    // Audio link
+    if (auto audio_link = Application::GetInstance().GetAudioLinkStatusJson()) {
+        cJSON_AddItemToObject(root, "audio_link", audio_link);
+    }
+
     // Chip temperature
     float temp = 0.0f;
     if (board.GetTemperature(temp)) {
@@ -104,6 +104,7 @@ void ElectronEmojiDisplay::SetStatus(const char* status) {
         ESP_LOGE(TAG, "SetStatus: status is nullptr");
         return;
     }
+    status_generation_++;
 
     if (strcmp(status, Lang::Strings::LISTENING) == 0) {
         lv_obj_set_style_text_font(status_label_, &OTTO_ICON_FONT, 0);
@@ -11,12 +11,20 @@
 #include <esp_err.h>
 #include <esp_lvgl_port.h>
 #include <esp_psram.h>
+#include <esp_timer.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
 #include <cstring>
 
 #include "board.h"
 
 #define TAG "LcdDisplay"
 
+// Emotions the server sends most often, decoded in the background after a theme is applied
+static const char* const kPrefetchEmotions[] = {
+    "neutral", "happy", "thinking", "laughing", "sad", "surprised", "relaxed", "winking", "loving", "confused",
+};
+
 LV_FONT_DECLARE(BUILTIN_TEXT_FONT);
 LV_FONT_DECLARE(BUILTIN_ICON_FONT);
 LV_FONT_DECLARE(font_awesome_30_4);
@@ -86,6 +94,18 @@ LcdDisplay::LcdDisplay(esp_lcd_panel_io_handle_t panel_io, esp_lcd_panel_handle_
         .skip_unhandled_events = false,
     };
     esp_timer_create(&preview_timer_args, &preview_timer_);
+
+#if CONFIG_SPIRAM
+    // Decoded PNG and JPEG images are kept in PSRAM
+    size_t psram_size_mb = esp_psram_get_size() / 1024 / 1024;
+    if (psram_size_mb >= 8) {
+        image_cache_ = std::make_unique<LvglImageCache>(2 * 1024 * 1024);
+        ESP_LOGI(TAG, "Use 2MB of PSRAM for image cache");
+    } else if (psram_size_mb >= 2) {
+        image_cache_ = std::make_unique<LvglImageCache>(512 * 1024);
+        ESP_LOGI(TAG, "Use 512KB of PSRAM for image cache");
+    }
+#endif
 }
 
 SpiLcdDisplay::SpiLcdDisplay(esp_lcd_panel_io_handle_t panel_io, esp_lcd_panel_handle_t panel,
@@ -112,18 +132,6 @@ SpiLcdDisplay::SpiLcdDisplay(esp_lcd_panel_io_handle_t panel_io, esp_lcd_panel_h
     ESP_LOGI(TAG, "Initialize LVGL library");
     lv_init();
 
-#if CONFIG_SPIRAM
-    // lv image cache, currently only PNG is supported
-    size_t psram_size_mb = esp_psram_get_size() / 1024 / 1024;
-    if (psram_size_mb >= 8) {
-        lv_image_cache_resize(2 * 1024 * 1024, true);
-        ESP_LOGI(TAG, "Use 2MB of PSRAM for image cache");
-    } else if (psram_size_mb >= 2) {
-        lv_image_cache_resize(512 * 1024, true);
-        ESP_LOGI(TAG, "Use 512KB of PSRAM for image cache");
-    }
-#endif
-
     ESP_LOGI(TAG, "Initialize LVGL port");
     lvgl_port_cfg_t port_cfg = ESP_LVGL_PORT_INIT_CONFIG();
     port_cfg.task_priority = 1;
@@ -137,8 +145,13 @@ SpiLcdDisplay::SpiLcdDisplay(esp_lcd_panel_io_handle_t panel_io, esp_lcd_panel_h
         .io_handle = panel_io_,
         .panel_handle = panel_,
         .control_handle = nullptr,
-        .buffer_size = static_cast<uint32_t>(width_ * 20),
+        .buffer_size = static_cast<uint32_t>(width_ * CONFIG_LCD_SPI_BUFFER_LINES),
+#if CONFIG_LCD_SPI_DOUBLE_BUFFER
+        // LVGL renders the next stripe into one buffer while the SPI DMA sends the other
+        .double_buffer = true,
+#else
         .double_buffer = false,
+#endif
         .trans_size = 0,
         .hres = static_cast<uint32_t>(width_),
         .vres = static_cast<uint32_t>(height_),
@@ -169,9 +182,71 @@ SpiLcdDisplay::SpiLcdDisplay(esp_lcd_panel_io_handle_t panel_io, esp_lcd_panel_h
         lv_display_set_offset(display_, offset_x, offset_y);
     }
 
+    last_stats_time_ = esp_timer_get_time();
+    lv_display_add_event_cb(display_, OnDisplayEvent, LV_EVENT_ALL, this);
+
     SetupUI();
 }
 
+SpiLcdDisplay::~SpiLcdDisplay() {
+    if (display_ != nullptr) {
+        DisplayLockGuard lock(this);
+        lv_display_remove_event_cb_with_user_data(display_, OnDisplayEvent, this);
+    }
+}
+
+void SpiLcdDisplay::OnDisplayEvent(lv_event_t* e) {
+    auto self = static_cast<SpiLcdDisplay*>(lv_event_get_user_data(e));
+    int64_t now = esp_timer_get_time();
+    switch (lv_event_get_code(e)) {
+    case LV_EVENT_REFR_START:
+        self->frame_start_time_ = now;
+        self->frame_flush_us_ = 0;
+        self->frame_wait_us_ = 0;
+        self->frame_areas_ = 0;
+        break;
+    case LV_EVENT_FLUSH_START:
+        self->flush_start_time_ = now;
+        break;
+    case LV_EVENT_FLUSH_FINISH:
+        self->frame_flush_us_ += now - self->flush_start_time_;
+        self->frame_areas_++;
+        break;
+    case LV_EVENT_FLUSH_WAIT_START:
+        self->wait_start_time_ = now;
+        break;
+    case LV_EVENT_FLUSH_WAIT_FINISH:
+        self->frame_wait_us_ += now - self->wait_start_time_;
+        break;
+    case LV_EVENT_REFR_READY: {
+        // Nothing was invalidated
+        if (self->frame_areas_ == 0) {
+            break;
+        }
+        auto& stats = self->flush_stats_;
+        int64_t frame_us = now - self->frame_start_time_;
+        stats.frames++;
+        stats.areas += self->frame_areas_;
+        stats.flush_us += self->frame_flush_us_;
+        stats.wait_us += self->frame_wait_us_;
+        stats.render_us += std::max<int64_t>(0, frame_us - self->frame_flush_us_ - self->frame_wait_us_);
+        stats.max_frame_us = std::max(stats.max_frame_us, frame_us);
+
+        int64_t elapsed_us = now - self->last_stats_time_;
+        if (elapsed_us >= 10 * 1000 * 1000) {
+            ESP_LOGD(TAG, "Flush: %.1f fps, %lu areas/frame, render %lld us, flush %lld us, wait %lld us, max frame %lld us",
+                stats.frames * 1000000.0f / elapsed_us, stats.areas / stats.frames, stats.render_us / stats.frames,
+                stats.flush_us / stats.frames, stats.wait_us / stats.frames, stats.max_frame_us);
+            stats = LcdFlushStats();
+            self->last_stats_time_ = now;
+        }
+        break;
+    }
+    default:
+        break;
+    }
+}
+
 
 // RGB LCD implementation
 RgbLcdDisplay::RgbLcdDisplay(esp_lcd_panel_io_handle_t panel_io, esp_lcd_panel_handle_t panel,
@@ -289,6 +364,10 @@ MipiLcdDisplay::MipiLcdDisplay(esp_lcd_panel_io_handle_t panel_io, esp_lcd_panel
 }
 
 LcdDisplay::~LcdDisplay() {
+    prefetch_stopping_ = true;
+    while (prefetch_running_) {
+        vTaskDelay(pdMS_TO_TICKS(10));
+    }
     SetPreviewImage(nullptr);
     
     // Clean up GIF controller
@@ -320,6 +399,9 @@ LcdDisplay::~LcdDisplay() {
     if (content_ != nullptr) {
         lv_obj_del(content_);
     }
+    if (chat_row_pool_ != nullptr) {
+        lv_obj_del(chat_row_pool_);
+    }
     if (bottom_bar_ != nullptr) {
         lv_obj_del(bottom_bar_);
     }
@@ -355,6 +437,11 @@ void LcdDisplay::Unlock() {
     lvgl_port_unlock();
 }
 
+void LcdDisplay::EndChatReply() {
+    DisplayLockGuard lock(this);
+    chat_appending_ = false;
+}
+
 #if CONFIG_USE_WECHAT_MESSAGE_STYLE
 void LcdDisplay::SetupUI() {
     DisplayLockGuard lock(this);
@@ -472,6 +559,19 @@ void LcdDisplay::SetupUI() {
     // We'll create chat messages dynamically in SetChatMessage
     chat_message_label_ = nullptr;
 
+    // Older messages are hidden while new ones arrive, scrolling by hand shows them again
+    lv_obj_add_event_cb(content_, [](lv_event_t* e) {
+        if (lv_indev_active() == nullptr) {
+            return;
+        }
+        LcdDisplay* display = static_cast<LcdDisplay*>(lv_event_get_user_data(e));
+        display->ShowAllMessages();
+    }, LV_EVENT_SCROLL_BEGIN, this);
+
+    // Rows of collapsed messages, reused before new ones are created
+    chat_row_pool_ = lv_obj_create(screen);
+    lv_obj_add_flag(chat_row_pool_, LV_OBJ_FLAG_HIDDEN);
+
     low_battery_popup_ = lv_obj_create(screen);
     lv_obj_set_scrollbar_mode(low_battery_popup_, LV_SCROLLBAR_MODE_OFF);
     lv_obj_set_size(low_battery_popup_, LV_HOR_RES * 0.9, text_font->line_height * 2);
@@ -499,43 +599,149 @@ void LcdDisplay::SetupUI() {
 #else
 #define  MAX_MESSAGES 20
 #endif
+// Sentences of one reply are appended to its bubble up to this length
+#define  MAX_BUBBLE_TEXT_LENGTH 512
+
+lv_obj_t* LcdDisplay::CreateChatRow() {
+    auto lvgl_theme = static_cast<LvglTheme*>(current_theme_);
+
+    // A full-width transparent row aligns the bubble inside it
+    lv_obj_t* row = lv_obj_create(content_);
+    lv_obj_set_width(row, LV_HOR_RES);
+    lv_obj_set_height(row, LV_SIZE_CONTENT);
+    lv_obj_set_style_bg_opa(row, LV_OPA_TRANSP, 0);
+    lv_obj_set_style_border_width(row, 0, 0);
+    lv_obj_set_style_pad_all(row, 0, 0);
+    lv_obj_set_scrollbar_mode(row, LV_SCROLLBAR_MODE_OFF);
+    lv_obj_set_user_data(row, (void*)"row");
+
+    // Create a message bubble
+    lv_obj_t* msg_bubble = lv_obj_create(row);
+    lv_obj_set_style_radius(msg_bubble, 8, 0);
+    lv_obj_set_scrollbar_mode(msg_bubble, LV_SCROLLBAR_MODE_OFF);
+    lv_obj_set_style_border_width(msg_bubble, 0, 0);
+    lv_obj_set_style_pad_all(msg_bubble, lvgl_theme->spacing(4), 0);
+    lv_obj_set_style_bg_opa(msg_bubble, LV_OPA_70, 0);
+    lv_obj_set_size(msg_bubble, LV_SIZE_CONTENT, LV_SIZE_CONTENT);
+
+    // Create the message text
+    lv_obj_t* msg_text = lv_label_create(msg_bubble);
+    lv_label_set_long_mode(msg_text, LV_LABEL_LONG_WRAP);
+    return row;
+}
+
+lv_obj_t* LcdDisplay::AcquireChatRow() {
+    // Rows of collapsed messages are parked in the pool
+    if (lv_obj_get_child_cnt(chat_row_pool_) > 0) {
+        lv_obj_t* row = lv_obj_get_child(chat_row_pool_, 0);
+        lv_obj_set_parent(row, content_);
+        return row;
+    }
+
+    // Past the limit the oldest row becomes the newest one
+    if (lv_obj_get_child_cnt(content_) >= MAX_MESSAGES) {
+        lv_obj_t* oldest = lv_obj_get_child(content_, 0);
+        void* type = lv_obj_get_user_data(oldest);
+        if (type != nullptr && strcmp((const char*)type, "row") == 0) {
+            lv_obj_move_to_index(oldest, -1);
+            return oldest;
+        }
+        lv_obj_del(oldest);
+    }
+    return CreateChatRow();
+}
+
+void LcdDisplay::SetChatText(lv_obj_t* msg_text, const char* text) {
+    auto lvgl_theme = static_cast<LvglTheme*>(current_theme_);
+    auto text_font = lvgl_theme->text_font()->font();
+
+    // Calculate actual text width
+    lv_coord_t text_width = lv_txt_get_width(text, strlen(text), text_font, 0);
+
+    // Bubble width is between the minimum and 85% of screen width
+    lv_coord_t max_width = LV_HOR_RES * 85 / 100 - 16;
+    lv_coord_t min_width = 20;
+    if (text_width < min_width) {
+        text_width = min_width;
+    }
+    if (text_width > max_width) {
+        text_width = max_width;
+    }
+    lv_obj_set_width(msg_text, text_width);
+}
+
+void LcdDisplay::ShowLatestMessages(lv_obj_t* latest, lv_anim_enable_t anim) {
+    // Only the newest messages that fill the view are laid out, older ones are hidden until the user scrolls
+    lv_obj_update_layout(content_);
+    int32_t view_height = lv_obj_get_content_height(content_);
+    int32_t pad_row = lv_obj_get_style_pad_row(content_, 0);
+    int32_t height = 0;
+    for (int32_t i = lv_obj_get_child_cnt(content_) - 1; i >= 0; i--) {
+        lv_obj_t* child = lv_obj_get_child(content_, i);
+        if (height <= view_height) {
+            height += lv_obj_get_height(child) + pad_row;
+        } else if (lv_obj_has_flag(child, LV_OBJ_FLAG_HIDDEN)) {
+            break;
+        } else {
+            lv_obj_add_flag(child, LV_OBJ_FLAG_HIDDEN);
+        }
+    }
+    lv_obj_scroll_to_view(latest, anim);
+}
+
+void LcdDisplay::ShowAllMessages() {
+    // The hidden messages are the oldest ones, the view stays where it was
+    uint32_t child_count = lv_obj_get_child_cnt(content_);
+    uint32_t hidden = 0;
+    while (hidden < child_count && lv_obj_has_flag(lv_obj_get_child(content_, hidden), LV_OBJ_FLAG_HIDDEN)) {
+        lv_obj_remove_flag(lv_obj_get_child(content_, hidden), LV_OBJ_FLAG_HIDDEN);
+        hidden++;
+    }
+    if (hidden == 0) {
+        return;
+    }
+
+    int32_t scroll_y = lv_obj_get_scroll_y(content_);
+    lv_obj_update_layout(content_);
+    int32_t pad_row = lv_obj_get_style_pad_row(content_, 0);
+    for (uint32_t i = 0; i < hidden; i++) {
+        scroll_y += lv_obj_get_height(lv_obj_get_child(content_, i)) + pad_row;
+    }
+    lv_obj_scroll_to_y(content_, scroll_y, LV_ANIM_OFF);
+}
+
 void LcdDisplay::SetChatMessage(const char* role, const char* content) {
     DisplayLockGuard lock(this);
     if (content_ == nullptr) {
         return;
     }
-    
-    // Check if message count exceeds limit
+
+    // Any other message ends the reply that assistant sentences are appended to
+    bool appending = chat_appending_;
+    chat_appending_ = false;
+
+    // Get the last message row and its bubble
     uint32_t child_count = lv_obj_get_child_cnt(content_);
-    if (child_count >= MAX_MESSAGES) {
-        // Delete the oldest message (first child object)
-        lv_obj_t* first_child = lv_obj_get_child(content_, 0);
-        lv_obj_t* last_child = lv_obj_get_child(content_, child_count - 1);
-        if (first_child != nullptr) {
-            lv_obj_del(first_child);
-        }
-        // Scroll to the last message immediately
-        if (last_child != nullptr) {
-            lv_obj_scroll_to_view_recursive(last_child, LV_ANIM_OFF);
-        }
+    lv_obj_t* last_row = child_count > 0 ? lv_obj_get_child(content_, child_count - 1) : nullptr;
+    lv_obj_t* last_bubble = nullptr;
+    const char* last_type = nullptr;
+    if (last_row != nullptr && lv_obj_get_user_data(last_row) != nullptr &&
+        strcmp((const char*)lv_obj_get_user_data(last_row), "row") == 0) {
+        last_bubble = lv_obj_get_child(last_row, 0);
+        last_type = (const char*)lv_obj_get_user_data(last_bubble);
     }
-    
-    // Collapse system messages (if it's a system message, check if the last message is also a system message)
+
+    lv_obj_t* row = nullptr;
     if (strcmp(role, "system") == 0) {
-        if (child_count > 0) {
-            // Get the last message container
-            lv_obj_t* last_container = lv_obj_get_child(content_, child_count - 1);
-            if (last_container != nullptr && lv_obj_get_child_cnt(last_container) > 0) {
-                // Get the bubble inside the container
-                lv_obj_t* last_bubble = lv_obj_get_child(last_container, 0);
-                if (last_bubble != nullptr) {
-                    // Check if bubble type is system message
-                    void* bubble_type_ptr = lv_obj_get_user_data(last_bubble);
-                    if (bubble_type_ptr != nullptr && strcmp((const char*)bubble_type_ptr, "system") == 0) {
-                        // If the last message is also a system message, delete it
-                        lv_obj_del(last_container);
-                    }
+        // Collapse system messages: a system message replaces the last one in place
+        if (last_type != nullptr && strcmp(last_type, "system") == 0) {
+            row = last_row;
+            if (strlen(content) == 0) {
+                if (chat_message_label_ == lv_obj_get_child(last_bubble, 0)) {
+                    chat_message_label_ = nullptr;
                 }
+                lv_obj_set_parent(row, chat_row_pool_);
+                return;
             }
         }
     } else {
@@ -544,147 +750,65 @@ void LcdDisplay::SetChatMessage(const char* role, const char* content) {
     }
 
     // Avoid empty message boxes
-    if(strlen(content) == 0) {
+    if (strlen(content) == 0) {
         return;
     }
 
-    auto lvgl_theme = static_cast<LvglTheme*>(current_theme_);
-    auto text_font = lvgl_theme->text_font()->font();
-
-    // Create a message bubble
-    lv_obj_t* msg_bubble = lv_obj_create(content_);
-    lv_obj_set_style_radius(msg_bubble, 8, 0);
-    lv_obj_set_scrollbar_mode(msg_bubble, LV_SCROLLBAR_MODE_OFF);
-    lv_obj_set_style_border_width(msg_bubble, 0, 0);
-    lv_obj_set_style_pad_all(msg_bubble, lvgl_theme->spacing(4), 0);
-
-    // Create the message text
-    lv_obj_t* msg_text = lv_label_create(msg_bubble);
-    lv_label_set_text(msg_text, content);
-    
-    // Calculate actual text width
-    lv_coord_t text_width = lv_txt_get_width(content, strlen(content), text_font, 0);
-
-    // Calculate bubble width
-    lv_coord_t max_width = LV_HOR_RES * 85 / 100 - 16;  // 85% of screen width
-    lv_coord_t min_width = 20;  
-    lv_coord_t bubble_width;
-    
-    // Ensure text width is not less than minimum width
-    if (text_width < min_width) {
-        text_width = min_width;
+    // The sentences of a spoken reply go into the same bubble
+    bool is_assistant = strcmp(role, "user") != 0 && strcmp(role, "system") != 0;
+    if (is_assistant && appending && last_type != nullptr && strcmp(last_type, "assistant") == 0) {
+        lv_obj_t* msg_text = lv_obj_get_child(last_bubble, 0);
+        std::string text = lv_label_get_text(msg_text);
+        if (text.size() + strlen(content) < MAX_BUBBLE_TEXT_LENGTH) {
+            // Latin words need a space between sentences, CJK text does not
+            if (!text.empty() && (uint8_t)text.back() < 0x80 && text.back() != ' ' && (uint8_t)content[0] < 0x80) {
+                text += ' ';
+            }
+            text += content;
+            lv_label_set_text(msg_text, text.c_str());
+            SetChatText(msg_text, text.c_str());
+            chat_appending_ = true;
+            chat_message_label_ = msg_text;
+            ShowLatestMessages(last_row, LV_ANIM_OFF);
+            return;
+        }
     }
 
-    // If text width is less than max width, use text width
-    if (text_width < max_width) {
-        bubble_width = text_width; 
-    } else {
-        bubble_width = max_width;
+    if (row == nullptr) {
+        row = AcquireChatRow();
     }
-    
-    // Set message text width
-    lv_obj_set_width(msg_text, bubble_width);  // Subtract padding
-    lv_label_set_long_mode(msg_text, LV_LABEL_LONG_WRAP);
-
-    // Set bubble width
-    lv_obj_set_width(msg_bubble, bubble_width);
-    lv_obj_set_height(msg_bubble, LV_SIZE_CONTENT);
+    lv_obj_remove_flag(row, LV_OBJ_FLAG_HIDDEN);
+    lv_obj_t* msg_bubble = lv_obj_get_child(row, 0);
+    lv_obj_t* msg_text = lv_obj_get_child(msg_bubble, 0);
+    lv_label_set_text(msg_text, content);
+    SetChatText(msg_text, content);
 
     // Set alignment and style based on message role
+    auto lvgl_theme = static_cast<LvglTheme*>(current_theme_);
     if (strcmp(role, "user") == 0) {
         // User messages are right-aligned with green background
         lv_obj_set_style_bg_color(msg_bubble, lvgl_theme->user_bubble_color(), 0);
-        lv_obj_set_style_bg_opa(msg_bubble, LV_OPA_70, 0);
-        // Set text color for contrast
         lv_obj_set_style_text_color(msg_text, lvgl_theme->text_color(), 0);
-        
-        // Set custom attribute to mark bubble type
         lv_obj_set_user_data(msg_bubble, (void*)"user");
-        
-        // Set appropriate width for content
-        lv_obj_set_width(msg_bubble, LV_SIZE_CONTENT);
-        lv_obj_set_height(msg_bubble, LV_SIZE_CONTENT);
-        
-        // Don't grow
-        lv_obj_set_style_flex_grow(msg_bubble, 0, 0);
-    } else if (strcmp(role, "assistant") == 0) {
-        // Assistant messages are left-aligned with white background
-        lv_obj_set_style_bg_color(msg_bubble, lvgl_theme->assistant_bubble_color(), 0);
-        lv_obj_set_style_bg_opa(msg_bubble, LV_OPA_70, 0);
-        // Set text color for contrast
-        lv_obj_set_style_text_color(msg_text, lvgl_theme->text_color(), 0);
-        
-        // Set custom attribute to mark bubble type
-        lv_obj_set_user_data(msg_bubble, (void*)"assistant");
-        
-        // Set appropriate width for content
-        lv_obj_set_width(msg_bubble, LV_SIZE_CONTENT);
-        lv_obj_set_height(msg_bubble, LV_SIZE_CONTENT);
-        
-        // Don't grow
-        lv_obj_set_style_flex_grow(msg_bubble, 0, 0);
+        lv_obj_align(msg_bubble, LV_ALIGN_RIGHT_MID, -25, 0);
     } else if (strcmp(role, "system") == 0) {
         // System messages are center-aligned with light gray background
         lv_obj_set_style_bg_color(msg_bubble, lvgl_theme->system_bubble_color(), 0);
-        lv_obj_set_style_bg_opa(msg_bubble, LV_OPA_70, 0);
-        // Set text color for contrast
         lv_obj_set_style_text_color(msg_text, lvgl_theme->system_text_color(), 0);
-        
-        // Set custom attribute to mark bubble type
         lv_obj_set_user_data(msg_bubble, (void*)"system");
-        
-        // Set appropriate width for content
-        lv_obj_set_width(msg_bubble, LV_SIZE_CONTENT);
-        lv_obj_set_height(msg_bubble, LV_SIZE_CONTENT);
-        
-        // Don't grow
-        lv_obj_set_style_flex_grow(msg_bubble, 0, 0);
-    }
-    
-    // Create a full-width container for user messages to ensure right alignment
-    if (strcmp(role, "user") == 0) {
-        // Create a full-width container
-        lv_obj_t* container = lv_obj_create(content_);
-        lv_obj_set_width(container, LV_HOR_RES);
-        lv_obj_set_height(container, LV_SIZE_CONTENT);
-        
-        // Make container transparent and borderless
-        lv_obj_set_style_bg_opa(container, LV_OPA_TRANSP, 0);
-        lv_obj_set_style_border_width(container, 0, 0);
-        lv_obj_set_style_pad_all(container, 0, 0);
-        
-        // Move the message bubble into this container
-        lv_obj_set_parent(msg_bubble, container);
-        
-        // Right align the bubble in the container
-        lv_obj_align(msg_bubble, LV_ALIGN_RIGHT_MID, -25, 0);
-        
-        // Auto-scroll to this container
-        lv_obj_scroll_to_view_recursive(container, LV_ANIM_ON);
-    } else if (strcmp(role, "system") == 0) {
-        // Create full-width container for system messages to ensure center alignment
-        lv_obj_t* container = lv_obj_create(content_);
-        lv_obj_set_width(container, LV_HOR_RES);
-        lv_obj_set_height(container, LV_SIZE_CONTENT);
-        
-        lv_obj_set_style_bg_opa(container, LV_OPA_TRANSP, 0);
-        lv_obj_set_style_border_width(container, 0, 0);
-        lv_obj_set_style_pad_all(container, 0, 0);
-        
-        lv_obj_set_parent(msg_bubble, container);
         lv_obj_align(msg_bubble, LV_ALIGN_CENTER, 0, 0);
-        lv_obj_scroll_to_view_recursive(container, LV_ANIM_ON);
     } else {
-        // For assistant messages
-        // Left align assistant messages
+        // Assistant messages are left-aligned with white background
+        lv_obj_set_style_bg_color(msg_bubble, lvgl_theme->assistant_bubble_color(), 0);
+        lv_obj_set_style_text_color(msg_text, lvgl_theme->text_color(), 0);
+        lv_obj_set_user_data(msg_bubble, (void*)"assistant");
         lv_obj_align(msg_bubble, LV_ALIGN_LEFT_MID, 0, 0);
-
-        // Auto-scroll to the message bubble
-        lv_obj_scroll_to_view_recursive(msg_bubble, LV_ANIM_ON);
+        chat_appending_ = true;
     }
-    
+
     // Store reference to the latest message label
     chat_message_label_ = msg_text;
+    ShowLatestMessages(row, LV_ANIM_ON);
 }
 
 void LcdDisplay::SetPreviewImage(std::unique_ptr<LvglImage> image) {
@@ -720,7 +844,8 @@ void LcdDisplay::SetPreviewImage(std::unique_ptr<LvglImage> image) {
     lv_coord_t max_height = LV_VER_RES * 50 / 100; // 50% of screen height
     
     // Calculate zoom factor to fit within maximum dimensions
-    auto img_dsc = image->image_dsc();
+    auto decoded = DecodeImage(std::move(image));
+    auto img_dsc = decoded->image_dsc();
     lv_coord_t img_width = img_dsc->header.w;
     lv_coord_t img_height = img_dsc->header.h;
     if (img_width == 0 || img_height == 0) {
@@ -742,13 +867,13 @@ void LcdDisplay::SetPreviewImage(std::unique_ptr<LvglImage> image) {
     
     // Add event handler to clean up LvglImage when image is deleted
     // We need to transfer ownership of the unique_ptr to the event callback
-    LvglImage* raw_image = image.release(); // Release ownership of smart pointer
+    auto holder = new std::shared_ptr<LvglImage>(std::move(decoded));
     lv_obj_add_event_cb(preview_image, [](lv_event_t* e) {
-        LvglImage* img = (LvglImage*)lv_event_get_user_data(e);
-        if (img != nullptr) {
-            delete img; // Properly release memory by deleting LvglImage object
+        auto holder = (std::shared_ptr<LvglImage>*)lv_event_get_user_data(e);
+        if (holder != nullptr) {
+            delete holder; // Properly release memory by deleting LvglImage object
         }
-    }, LV_EVENT_DELETE, (void*)raw_image);
+    }, LV_EVENT_DELETE, (void*)holder);
     
     // Calculate actual scaled image dimensions
     lv_coord_t scaled_width = (img_width * zoom) / 256;
@@ -943,9 +1068,11 @@ void LcdDisplay::SetPreviewImage(std::unique_ptr<LvglImage> image) {
         return;
     }
 
-    preview_image_cached_ = std::move(image);
-    auto img_dsc = preview_image_cached_->image_dsc();
+    // The compressed image is released once decoded
+    auto decoded = DecodeImage(std::move(image));
+    auto img_dsc = decoded->image_dsc();
     lv_image_set_src(preview_image_, img_dsc);
+    preview_image_cached_ = std::move(decoded);
     if (img_dsc->header.w > 0 && img_dsc->header.h > 0) {
         // zoom factor 0.5
         lv_image_set_scale(preview_image_, 128 * width_ / img_dsc->header.w);
@@ -970,6 +1097,106 @@ void LcdDisplay::SetChatMessage(const char* role, const char* content) {
 }
 #endif
 
+std::shared_ptr<LvglImage> LcdDisplay::DecodeImage(std::shared_ptr<LvglImage> image) {
+    if (image_cache_ != nullptr) {
+        auto decoded = image_cache_->Decode(image.get());
+        if (decoded != nullptr) {
+            return decoded;
+        }
+    }
+    return image;
+}
+
+bool LcdDisplay::PrefetchEmotion(const char* emotion, bool shown) {
+    // The asset data stays mapped, a copy of the image outlives a theme change during the decode
+    std::unique_ptr<LvglRawImage> image;
+    const lv_image_dsc_t* source_dsc = nullptr;
+    {
+        DisplayLockGuard lock(this);
+        auto emoji_collection = static_cast<LvglTheme*>(current_theme_)->emoji_collection();
+        if (emoji_collection == nullptr) {
+            return false;
+        }
+        auto source = emoji_collection->GetEmojiImage(emotion);
+        if (source == nullptr) {
+            return true;
+        }
+        image = std::make_unique<LvglRawImage>((void*)source->image_dsc()->data, source->image_dsc()->data_size,
+            source->name() ? source->name() : emotion);
+        image->set_gif_cache_mode(source->gif_cache_mode());
+        source_dsc = source->image_dsc();
+    }
+    std::string name = image->name();
+    if (image_cache_->Contains(name, image.get())) {
+        return true;
+    }
+
+    // Decoded without the display lock, only the insert, which may release images, takes it
+    if (image->IsGif()) {
+        if (image->gif_cache_mode() == kGifCacheNone) {
+            return true;
+        }
+        // A GIF that cannot be cached is still inserted, without frames, so it is not built again
+        auto frames = GifFrameCache::Create(image->image_dsc()->data, image->gif_cache_mode(), image_cache_->max_bytes());
+        DisplayLockGuard lock(this);
+        if (shown) {
+            image_cache_->InsertFrames(name, image.get(), std::move(frames));
+            return true;
+        }
+        return image_cache_->Prefetch(name, image.get(), std::move(frames));
+    }
+
+    if (!LvglImageCache::IsCompressed(image.get())) {
+        return true;
+    }
+    auto decoded = image_cache_->Decode(image.get());
+    if (decoded == nullptr) {
+        return true;
+    }
+    DisplayLockGuard lock(this);
+    if (!shown) {
+        return image_cache_->Prefetch(name, image.get(), std::move(decoded));
+    }
+    image_cache_->Insert(name, image.get(), decoded);
+    // SetEmotion drew the compressed source meanwhile, swap in the decoded image if it is still shown
+    if (lv_image_get_src(emoji_image_) == source_dsc) {
+        lv_image_set_src(emoji_image_, decoded->image_dsc());
+        emoji_image_decoded_ = std::move(decoded);
+    }
+    return true;
+}
+
+void LcdDisplay::PrefetchEmotions(const char* emotion) {
+    if (image_cache_ == nullptr || prefetch_running_.exchange(true)) {
+        return;
+    }
+
+    prefetch_emotion_ = emotion != nullptr ? emotion : "";
+    auto ret = xTaskCreate([](void* arg) {
+        LcdDisplay* display = (LcdDisplay*)arg;
+        if (!display->prefetch_emotion_.empty()) {
+            display->PrefetchEmotion(display->prefetch_emotion_.c_str(), true);
+        } else {
+            for (auto emotion : kPrefetchEmotions) {
+                if (display->prefetch_stopping_ || !display->PrefetchEmotion(emotion, false)) {
+                    break;
+                }
+            }
+        }
+
+        auto stats = display->image_cache_->GetStats();
+        ESP_LOGI(TAG, "Image cache: %u images, %u bytes, %lu hits, %lu misses, %lu decodes in %d ms, slowest %d ms",
+            stats.entries, stats.bytes, stats.hits, stats.misses, stats.decodes, int(stats.decode_us / 1000),
+            int(stats.max_decode_us / 1000));
+        display->prefetch_running_ = false;
+        vTaskDelete(NULL);
+    }, "image_prefetch", 4096 * 2, this, 1, nullptr);
+    if (ret != pdPASS) {
+        ESP_LOGE(TAG, "Failed to create image prefetch task");
+        prefetch_running_ = false;
+    }
+}
+
 void LcdDisplay::SetEmotion(const char* emotion) {
     // Stop any running GIF animation
     if (gif_controller_) {
@@ -997,17 +1224,47 @@ void LcdDisplay::SetEmotion(const char* emotion) {
 
     DisplayLockGuard lock(this);
     if (image->IsGif()) {
+        // Frames decoded once are shared through the image cache. Until the prefetch task has built
+        // them the GIF is decoded while playing.
+        std::shared_ptr<const GifFrameCache> frames;
+        if (image_cache_ != nullptr && image->gif_cache_mode() != kGifCacheNone) {
+            const char* name = image->name() ? image->name() : emotion;
+            frames = image_cache_->GetFrames(name, image);
+            if (frames == nullptr && !image_cache_->Contains(name, image)) {
+                PrefetchEmotions(emotion);
+            }
+        }
+
         // Create new GIF controller
-        gif_controller_ = std::make_unique<LvglGif>(image->image_dsc());
+        gif_controller_ = std::make_unique<LvglGif>(image->image_dsc(), frames);
         
         if (gif_controller_->IsLoaded()) {
             // Set up frame update callback
             gif_controller_->SetFrameCallback([this]() {
-                lv_image_set_src(emoji_image_, gif_controller_->image_dsc());
+                auto img_dsc = gif_controller_->image_dsc();
+                lv_image_cache_drop(img_dsc);
+                if (lv_image_get_src(emoji_image_) != img_dsc) {
+                    lv_image_set_src(emoji_image_, img_dsc);
+                    return;
+                }
+
+                // Unscaled and uncropped, only the changed part of the frame is redrawn
+                if (lv_image_get_scale(emoji_image_) == LV_SCALE_NONE &&
+                    lv_obj_get_content_width(emoji_image_) == img_dsc->header.w &&
+                    lv_obj_get_content_height(emoji_image_) == img_dsc->header.h) {
+                    lv_area_t coords;
+                    lv_obj_get_content_coords(emoji_image_, &coords);
+                    lv_area_t area = gif_controller_->dirty_area();
+                    lv_area_move(&area, coords.x1, coords.y1);
+                    lv_obj_invalidate_area(emoji_image_, &area);
+                } else {
+                    lv_obj_invalidate(emoji_image_);
+                }
             });
             
             // Set initial frame and start animation
             lv_image_set_src(emoji_image_, gif_controller_->image_dsc());
+            emoji_image_decoded_.reset();
             gif_controller_->Start();
             
             // Show GIF, hide others
@@ -1018,7 +1275,17 @@ void LcdDisplay::SetEmotion(const char* emotion) {
             gif_controller_.reset();
         }
     } else {
-        lv_image_set_src(emoji_image_, image->image_dsc());
+        // PNG and JPEG are decoded once and kept by name, the switch only sets the source. On a miss
+        // the compressed source is drawn until the prefetch task has decoded it.
+        std::shared_ptr<LvglImage> decoded;
+        if (image_cache_ != nullptr && LvglImageCache::IsCompressed(image)) {
+            decoded = image_cache_->Get(image->name() ? image->name() : emotion, image);
+            if (decoded == nullptr) {
+                PrefetchEmotions(emotion);
+            }
+        }
+        lv_image_set_src(emoji_image_, decoded != nullptr ? decoded->image_dsc() : image->image_dsc());
+        emoji_image_decoded_ = decoded;
         lv_obj_add_flag(emoji_label_, LV_OBJ_FLAG_HIDDEN);
         lv_obj_remove_flag(emoji_image_, LV_OBJ_FLAG_HIDDEN);
     }
@@ -1179,6 +1446,7 @@ void LcdDisplay::SetTheme(Theme* theme) {
 
     // No errors occurred. Save theme to settings
     Display::SetTheme(lvgl_theme);
+    PrefetchEmotions();
 }
 
 void LcdDisplay::SetHideSubtitle(bool hide) {
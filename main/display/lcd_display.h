@@ -3,6 +3,7 @@
 
 #include "lvgl_display.h"
 #include "gif/lvgl_gif.h"
+#include "lvgl_image_cache.h"
 
 #include <esp_lcd_panel_io.h>
 #include <esp_lcd_panel_ops.h>
@@ -32,12 +33,34 @@ protected:
     std::unique_ptr<LvglGif> gif_controller_ = nullptr;
     lv_obj_t* emoji_box_ = nullptr;
     lv_obj_t* chat_message_label_ = nullptr;
+    lv_obj_t* chat_row_pool_ = nullptr;
+    bool chat_appending_ = false;
     esp_timer_handle_t preview_timer_ = nullptr;
-    std::unique_ptr<LvglImage> preview_image_cached_ = nullptr;
+    std::shared_ptr<LvglImage> preview_image_cached_ = nullptr;
+    // Decoded PNG and JPEG images and GIF frames, nullptr without PSRAM
+    std::unique_ptr<LvglImageCache> image_cache_ = nullptr;
+    // Decoded image shown by emoji_image_, held until it is replaced
+    std::shared_ptr<LvglImage> emoji_image_decoded_ = nullptr;
+    std::atomic<bool> prefetch_running_ = false;
+    std::atomic<bool> prefetch_stopping_ = false;
+    // Emotion shown without its decoded frames, the prefetch task builds only these
+    std::string prefetch_emotion_;
     bool hide_subtitle_ = false;  // Control whether to hide chat messages/subtitles
 
     void InitializeLcdThemes();
     void SetupUI();
+    // Message rows of the wechat style UI
+    lv_obj_t* CreateChatRow();
+    lv_obj_t* AcquireChatRow();
+    void SetChatText(lv_obj_t* msg_text, const char* text);
+    void ShowLatestMessages(lv_obj_t* latest, lv_anim_enable_t anim);
+    void ShowAllMessages();
+    // Decodes the most common emotions of the current theme in the background, or only the given one
+    void PrefetchEmotions(const char* emotion = nullptr);
+    // Decodes one emotion into the image cache, false when the prefetch should stop
+    bool PrefetchEmotion(const char* emotion, bool shown);
+    // Returns the decoded image, or the image itself when it needs no decoding
+    std::shared_ptr<LvglImage> DecodeImage(std::shared_ptr<LvglImage> image);
     virtual bool Lock(int timeout_ms = 0) override;
     virtual void Unlock() override;
 
@@ -49,6 +72,7 @@ public:
     ~LcdDisplay();
     virtual void SetEmotion(const char* emotion) override;
     virtual void SetChatMessage(const char* role, const char* content) override; 
+    virtual void EndChatReply() override;
     virtual void SetPreviewImage(std::unique_ptr<LvglImage> image) override;
 
     // Add theme switching function
@@ -58,12 +82,35 @@ public:
     void SetHideSubtitle(bool hide);
 };
 
+struct LcdFlushStats {
+    uint32_t frames = 0;
+    uint32_t areas = 0;             // Stripes sent to the panel
+    int64_t render_us = 0;          // Time LVGL spent rendering
+    int64_t flush_us = 0;           // Time spent in the flush callback, byte swap and queueing the DMA
+    int64_t wait_us = 0;            // Time spent waiting for a busy buffer
+    int64_t max_frame_us = 0;
+};
+
 // SPI LCD display
 class SpiLcdDisplay : public LcdDisplay {
+private:
+    // Timing of the frame being refreshed, only touched by the LVGL task
+    int64_t frame_start_time_ = 0;
+    int64_t flush_start_time_ = 0;
+    int64_t wait_start_time_ = 0;
+    int64_t frame_flush_us_ = 0;
+    int64_t frame_wait_us_ = 0;
+    uint32_t frame_areas_ = 0;
+    int64_t last_stats_time_ = 0;
+    LcdFlushStats flush_stats_;
+
+    static void OnDisplayEvent(lv_event_t* e);
+
 public:
     SpiLcdDisplay(esp_lcd_panel_io_handle_t panel_io, esp_lcd_panel_handle_t panel,
                   int width, int height, int offset_x, int offset_y,
                   bool mirror_x, bool mirror_y, bool swap_xy);
+    ~SpiLcdDisplay();
 };
 
 // RGB LCD display
@@ -0,0 +1,209 @@
+#include "gif_frame_cache.h"
+#include "gifdec.h"
+
+#include <esp_log.h>
+#include <esp_timer.h>
+#include <esp_heap_caps.h>
+#include <cstring>
+#include <algorithm>
+#include <utility>
+
+#define TAG "GifFrameCache"
+
+std::shared_ptr<GifFrameCache> GifFrameCache::Create(const void* gif_data, GifCacheMode mode, size_t max_bytes) {
+    if (mode == kGifCacheNone || gif_data == nullptr) {
+        return nullptr;
+    }
+
+    auto start_time = esp_timer_get_time();
+    std::shared_ptr<GifFrameCache> cache(new GifFrameCache(mode, std::min<size_t>(max_bytes, GIF_FRAME_CACHE_MAX_BYTES)));
+    // RGB565 is tried first, a transparent pixel restarts the decoding in ARGB8888
+    auto result = cache->Build(gif_data, 2);
+    if (result == kBuildTransparent) {
+        result = cache->Build(gif_data, 4);
+    }
+    if (result != kBuildDone) {
+        return nullptr;
+    }
+
+    ESP_LOGI(TAG, "Cached %u frames of %ux%u in %u bytes (%s) in %d ms", cache->frames_.size(), cache->width_,
+        cache->height_, cache->data_size_, cache->pixel_size_ == 2 ? "RGB565" : "ARGB8888",
+        int((esp_timer_get_time() - start_time) / 1000));
+    return cache;
+}
+
+GifFrameCache::~GifFrameCache() {
+    if (data_ != nullptr) {
+        heap_caps_free(data_);
+    }
+}
+
+bool GifFrameCache::Append(const uint8_t* pixels, uint32_t stride, const lv_area_t& area) {
+    uint32_t row_size = lv_area_get_width(&area) * pixel_size_;
+    uint32_t rows = lv_area_get_height(&area);
+    size_t size = row_size * rows;
+    if (data_size_ + size > max_bytes_) {
+        ESP_LOGW(TAG, "The frames of the GIF exceed %u bytes", max_bytes_);
+        return false;
+    }
+    if (data_size_ + size > data_capacity_) {
+        size_t capacity = std::max(data_capacity_ * 2, data_size_ + size);
+        if (capacity > max_bytes_) {
+            capacity = max_bytes_;
+        }
+        auto data = (uint8_t*)heap_caps_realloc(data_, capacity, MALLOC_CAP_SPIRAM);
+        if (data == nullptr) {
+            ESP_LOGW(TAG, "Failed to allocate %u bytes in PSRAM", capacity);
+            return false;
+        }
+        data_ = data;
+        data_capacity_ = capacity;
+    }
+
+    const uint8_t* source = pixels + area.y1 * stride + area.x1 * pixel_size_;
+    for (uint32_t y = 0; y < rows; y++) {
+        memcpy(data_ + data_size_, source, row_size);
+        data_size_ += row_size;
+        source += stride;
+    }
+    return true;
+}
+
+lv_area_t GifFrameCache::Diff(const uint8_t* previous, const uint8_t* current) const {
+    uint32_t stride = width_ * pixel_size_;
+    lv_area_t area = {0, 0, -1, -1};
+
+    int32_t top = 0;
+    while (top < height_ && memcmp(previous + top * stride, current + top * stride, stride) == 0) {
+        top++;
+    }
+    if (top == height_) {
+        return area;
+    }
+    int32_t bottom = height_ - 1;
+    while (bottom > top && memcmp(previous + bottom * stride, current + bottom * stride, stride) == 0) {
+        bottom--;
+    }
+
+    int32_t left = width_;
+    int32_t right = -1;
+    for (int32_t y = top; y <= bottom; y++) {
+        auto a = previous + y * stride;
+        auto b = current + y * stride;
+        for (int32_t x = 0; x < left; x++) {
+            if (memcmp(a + x * pixel_size_, b + x * pixel_size_, pixel_size_) != 0) {
+                left = x;
+                break;
+            }
+        }
+        for (int32_t x = width_ - 1; x > right; x--) {
+            if (memcmp(a + x * pixel_size_, b + x * pixel_size_, pixel_size_) != 0) {
+                right = x;
+                break;
+            }
+        }
+    }
+    area = {left, top, right, bottom};
+    return area;
+}
+
+GifFrameCache::BuildResult GifFrameCache::Build(const void* gif_data, uint32_t pixel_size) {
+    frames_.clear();
+    data_size_ = 0;
+    pixel_size_ = pixel_size;
+
+    gd_GIF* gif = gd_open_gif_data(gif_data);
+    if (gif == nullptr) {
+        return kBuildFailed;
+    }
+    width_ = gif->width;
+    height_ = gif->height;
+    uint32_t stride = width_ * pixel_size_;
+    size_t frame_size = stride * height_;
+
+    auto previous = (uint8_t*)heap_caps_malloc(frame_size, MALLOC_CAP_SPIRAM);
+    auto current = (uint8_t*)heap_caps_malloc(frame_size, MALLOC_CAP_SPIRAM);
+    std::vector<size_t> offsets;
+    BuildResult result = kBuildDone;
+    const lv_area_t whole = {0, 0, width_ - 1, height_ - 1};
+
+    if (previous == nullptr || current == nullptr) {
+        result = kBuildFailed;
+    }
+    while (result == kBuildDone) {
+        int ret = gd_get_frame(gif);
+        if (ret != 1) {
+            if (frames_.empty()) {
+                result = kBuildFailed;
+            }
+            break;
+        }
+        if (frames_.empty()) {
+            // The loop extension comes before the first image, keep it for playback and stop at the trailer
+            loop_count_ = gif->loop_count;
+            gif->loop_count = 1;
+        }
+        gd_render_frame(gif, gif->canvas);
+
+        // gifdec renders BGRA, that is ARGB8888 in memory
+        const uint8_t* canvas = gif->canvas;
+        if (pixel_size_ == 4) {
+            memcpy(current, canvas, frame_size);
+        } else {
+            auto pixel = (uint16_t*)current;
+            for (size_t i = 0; i < (size_t)width_ * height_; i++, canvas += 4) {
+                if (canvas[3] != 0xFF) {
+                    result = kBuildTransparent;
+                    break;
+                }
+                *pixel++ = ((canvas[2] & 0xF8) << 8) | ((canvas[1] & 0xFC) << 3) | (canvas[0] >> 3);
+            }
+            if (result != kBuildDone) {
+                break;
+            }
+        }
+
+        Frame frame = {};
+        frame.delay_ms = gif->gce.delay * 10;
+        if (frames_.empty()) {
+            frame.area = whole;
+        } else {
+            frame.area = Diff(previous, current);
+        }
+        offsets.push_back(data_size_);
+        // The first frame is kept whole in both modes, the next ones whole or only their changed area
+        bool keep_whole = frames_.empty() || mode_ == kGifCacheFrames;
+        const lv_area_t& stored = keep_whole ? whole : frame.area;
+        if (lv_area_get_width(&stored) > 0 && !Append(current, stride, stored)) {
+            result = kBuildFailed;
+            break;
+        }
+        frames_.push_back(frame);
+        std::swap(previous, current);
+    }
+
+    if (result == kBuildDone) {
+        // The first frame follows the last one when the animation loops
+        frames_[0].area = Diff(previous, data_);
+        for (size_t i = 0; i < frames_.size(); i++) {
+            auto& frame = frames_[i];
+            const uint8_t* base = data_ + offsets[i];
+            if (i == 0 || mode_ == kGifCacheFrames) {
+                frame.image = base;
+                frame.stride = stride;
+                frame.pixels = base + frame.area.y1 * stride + frame.area.x1 * pixel_size_;
+            } else {
+                frame.stride = lv_area_get_width(&frame.area) * pixel_size_;
+                frame.pixels = base;
+            }
+        }
+        if (mode_ != kGifCacheFrames) {
+            frames_[0].image = nullptr;
+        }
+    }
+
+    heap_caps_free(previous);
+    heap_caps_free(current);
+    gd_close_gif(gif);
+    return result;
+}
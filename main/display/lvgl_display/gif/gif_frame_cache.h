@@ -0,0 +1,81 @@
+#pragma once
+
+#include <lvgl.h>
+#include <memory>
+#include <vector>
+
+/**
+ * How an animated GIF is played, trading memory against CPU
+ */
+enum GifCacheMode {
+    kGifCacheNone,      // Decode every frame while playing, only the gifdec buffers are allocated
+    kGifCacheDeltas,    // Decode once, keep the first frame and the changed rectangle of every frame
+    kGifCacheFrames,    // Decode once, keep every frame whole, playback only switches buffers
+};
+
+// Largest cache built for one GIF, bigger ones are decoded while playing
+#define GIF_FRAME_CACHE_MAX_BYTES (1024 * 1024)
+
+/**
+ * The frames of a GIF decoded once into PSRAM.
+ *
+ * Frames are stored as RGB565 when every pixel is opaque and as ARGB8888 otherwise. Each frame
+ * records the rectangle that differs from the frame shown before it, so playback copies and
+ * invalidates only that area. The frames form a cycle: the rectangle of the first frame is its
+ * difference from the last one, which is what a loop shows.
+ */
+class GifFrameCache {
+public:
+    struct Frame {
+        uint32_t delay_ms;
+        lv_area_t area;             // Changed rectangle in image coordinates, empty if nothing changed
+        const uint8_t* pixels;      // Pixel at the top left of the area
+        uint32_t stride;            // Bytes between the rows of pixels
+        const uint8_t* image;       // Whole frame, only with kGifCacheFrames
+    };
+
+    /**
+     * Decodes the GIF, returns nullptr for kGifCacheNone, without PSRAM or over max_bytes.
+     * Does not touch LVGL, may run without the display lock.
+     */
+    static std::shared_ptr<GifFrameCache> Create(const void* gif_data, GifCacheMode mode,
+        size_t max_bytes = GIF_FRAME_CACHE_MAX_BYTES);
+    ~GifFrameCache();
+    GifFrameCache(const GifFrameCache&) = delete;
+    GifFrameCache& operator=(const GifFrameCache&) = delete;
+
+    inline GifCacheMode mode() const { return mode_; }
+    inline uint16_t width() const { return width_; }
+    inline uint16_t height() const { return height_; }
+    inline lv_color_format_t color_format() const { return pixel_size_ == 2 ? LV_COLOR_FORMAT_RGB565 : LV_COLOR_FORMAT_ARGB8888; }
+    inline uint32_t pixel_size() const { return pixel_size_; }
+    inline int32_t loop_count() const { return loop_count_; }
+    inline size_t frame_count() const { return frames_.size(); }
+    inline const Frame& frame(size_t index) const { return frames_[index]; }
+    // The first frame whole, playback starts from it
+    inline const uint8_t* first_frame() const { return data_; }
+    inline size_t size() const { return data_size_; }
+
+private:
+    enum BuildResult {
+        kBuildDone,
+        kBuildTransparent,
+        kBuildFailed,
+    };
+
+    GifFrameCache(GifCacheMode mode, size_t max_bytes) : mode_(mode), max_bytes_(max_bytes) {}
+    BuildResult Build(const void* gif_data, uint32_t pixel_size);
+    bool Append(const uint8_t* pixels, uint32_t stride, const lv_area_t& area);
+    lv_area_t Diff(const uint8_t* previous, const uint8_t* current) const;
+
+    GifCacheMode mode_;
+    size_t max_bytes_;
+    uint16_t width_ = 0;
+    uint16_t height_ = 0;
+    uint32_t pixel_size_ = 2;
+    int32_t loop_count_ = 0;
+    uint8_t* data_ = nullptr;
+    size_t data_size_ = 0;
+    size_t data_capacity_ = 0;
+    std::vector<Frame> frames_;
+};
@@ -1,16 +1,42 @@
 #include "lvgl_gif.h"
 #include <esp_log.h>
+#include <esp_heap_caps.h>
 #include <cstring>
 
 #define TAG "LvglGif"
 
-LvglGif::LvglGif(const lv_img_dsc_t* img_dsc)
+LvglGif::LvglGif(const lv_img_dsc_t* img_dsc, std::shared_ptr<const GifFrameCache> cache)
     : gif_(nullptr), timer_(nullptr), last_call_(0), playing_(false), loaded_(false) {
     if (!img_dsc || !img_dsc->data) {
         ESP_LOGE(TAG, "Invalid image descriptor");
         return;
     }
 
+    if (cache) {
+        memset(&img_dsc_, 0, sizeof(img_dsc_));
+        img_dsc_.header.magic = LV_IMAGE_HEADER_MAGIC;
+        img_dsc_.header.flags = LV_IMAGE_FLAGS_MODIFIABLE;
+        img_dsc_.header.cf = cache->color_format();
+        img_dsc_.header.w = cache->width();
+        img_dsc_.header.h = cache->height();
+        img_dsc_.header.stride = cache->width() * cache->pixel_size();
+        img_dsc_.data_size = img_dsc_.header.stride * cache->height();
+
+        // The deltas are applied to a canvas of our own, whole frames are shown in place
+        if (cache->mode() == kGifCacheDeltas) {
+            canvas_ = (uint8_t*)heap_caps_malloc(img_dsc_.data_size, MALLOC_CAP_SPIRAM);
+        }
+        if (cache->mode() == kGifCacheFrames || canvas_ != nullptr) {
+            cache_ = cache;
+            loop_count_ = cache_->loop_count();
+            RewindCache();
+            loaded_ = true;
+            ESP_LOGD(TAG, "GIF loaded from frame cache: %dx%d", cache_->width(), cache_->height());
+            return;
+        }
+        ESP_LOGW(TAG, "Failed to allocate the GIF canvas, decoding while playing");
+    }
+
     gif_ = gd_open_gif_data(img_dsc->data);
     if (!gif_) {
         ESP_LOGE(TAG, "Failed to open GIF from image descriptor");
@@ -52,7 +78,7 @@ const lv_img_dsc_t* LvglGif::image_dsc() const {
 
 // Animation control methods
 void LvglGif::Start() {
-    if (!loaded_ || !gif_) {
+    if (!loaded_) {
         ESP_LOGW(TAG, "GIF not loaded, cannot start");
         return;
     }
@@ -69,6 +95,7 @@ void LvglGif::Start() {
         last_call_ = lv_tick_get();
         lv_timer_resume(timer_);
         lv_timer_reset(timer_);
+        lv_area_set(&dirty_area_, 0, 0, img_dsc_.header.w - 1, img_dsc_.header.h - 1);
         
         // Render first frame
         NextFrame();
@@ -86,7 +113,7 @@ void LvglGif::Pause() {
 }
 
 void LvglGif::Resume() {
-    if (!loaded_ || !gif_) {
+    if (!loaded_) {
         ESP_LOGW(TAG, "GIF not loaded, cannot resume");
         return;
     }
@@ -108,6 +135,13 @@ void LvglGif::Stop() {
         gd_rewind(gif_);
         NextFrame();
         ESP_LOGD(TAG, "GIF animation stopped and rewound");
+    } else if (cache_) {
+        loop_count_ = -1;
+        RewindCache();
+        if (frame_callback_) {
+            frame_callback_();
+        }
+        ESP_LOGD(TAG, "GIF animation stopped and rewound");
     }
 }
 
@@ -120,40 +154,52 @@ bool LvglGif::IsLoaded() const {
 }
 
 int32_t LvglGif::GetLoopCount() const {
-    if (!loaded_ || !gif_) {
+    if (!loaded_) {
         return -1;
     }
-    return gif_->loop_count;
+    return gif_ ? gif_->loop_count : loop_count_;
 }
 
 void LvglGif::SetLoopCount(int32_t count) {
-    if (!loaded_ || !gif_) {
+    if (!loaded_) {
         ESP_LOGW(TAG, "GIF not loaded, cannot set loop count");
         return;
     }
-    gif_->loop_count = count;
+    if (gif_) {
+        gif_->loop_count = count;
+    } else {
+        loop_count_ = count;
+    }
 }
 
 uint16_t LvglGif::width() const {
-    if (!loaded_ || !gif_) {
+    if (!loaded_) {
         return 0;
     }
-    return gif_->width;
+    return img_dsc_.header.w;
 }
 
 uint16_t LvglGif::height() const {
-    if (!loaded_ || !gif_) {
+    if (!loaded_) {
         return 0;
     }
-    return gif_->height;
+    return img_dsc_.header.h;
 }
 
 void LvglGif::SetFrameCallback(std::function<void()> callback) {
     frame_callback_ = callback;
 }
 
+const lv_area_t& LvglGif::dirty_area() const {
+    return dirty_area_;
+}
+
 void LvglGif::NextFrame() {
-    if (!loaded_ || !gif_ || !playing_) {
+    if (!loaded_ || !playing_) {
+        return;
+    }
+    if (!gif_) {
+        NextCachedFrame();
         return;
     }
 
@@ -165,6 +211,10 @@ void LvglGif::NextFrame() {
 
     last_call_ = lv_tick_get();
 
+    // The previous frame rectangle is disposed and the next one drawn
+    lv_area_t previous_area;
+    lv_area_set(&previous_area, gif_->fx, gif_->fy, gif_->fx + gif_->fw - 1, gif_->fy + gif_->fh - 1);
+
     // Get next frame
     int has_next = gd_get_frame(gif_);
     if (has_next == 0) {
@@ -179,6 +229,10 @@ void LvglGif::NextFrame() {
     // Render current frame
     if (gif_->canvas) {
         gd_render_frame(gif_, gif_->canvas);
+        lv_area_set(&dirty_area_, gif_->fx, gif_->fy, gif_->fx + gif_->fw - 1, gif_->fy + gif_->fh - 1);
+        if (lv_area_get_size(&previous_area) > 0) {
+            lv_area_join(&dirty_area_, &dirty_area_, &previous_area);
+        }
         
         // Call frame callback if set
         if (frame_callback_) {
@@ -187,6 +241,66 @@ void LvglGif::NextFrame() {
     }
 }
 
+void LvglGif::NextCachedFrame() {
+    uint32_t elapsed = lv_tick_elaps(last_call_);
+    if (elapsed < cache_->frame(frame_index_).delay_ms) {
+        return;
+    }
+
+    last_call_ = lv_tick_get();
+
+    size_t next = frame_index_ + 1;
+    if (next == cache_->frame_count()) {
+        // Same loop rules as gifdec: 0 loops forever, -1 plays once, n plays n - 1 more times
+        if (loop_count_ == 1 || loop_count_ < 0) {
+            playing_ = false;
+            if (timer_) {
+                lv_timer_pause(timer_);
+            }
+            ESP_LOGD(TAG, "GIF animation completed");
+            return;
+        } else if (loop_count_ > 1) {
+            loop_count_--;
+        }
+        next = 0;
+    }
+    frame_index_ = next;
+
+    const auto& frame = cache_->frame(frame_index_);
+    if (lv_area_get_size(&frame.area) == 0) {
+        return;
+    }
+    if (canvas_) {
+        uint32_t stride = img_dsc_.header.stride;
+        uint32_t row_size = lv_area_get_width(&frame.area) * cache_->pixel_size();
+        uint8_t* dst = canvas_ + frame.area.y1 * stride + frame.area.x1 * cache_->pixel_size();
+        const uint8_t* src = frame.pixels;
+        for (int32_t y = frame.area.y1; y <= frame.area.y2; y++) {
+            memcpy(dst, src, row_size);
+            dst += stride;
+            src += frame.stride;
+        }
+    } else {
+        img_dsc_.data = frame.image;
+    }
+    dirty_area_ = frame.area;
+
+    if (frame_callback_) {
+        frame_callback_();
+    }
+}
+
+void LvglGif::RewindCache() {
+    frame_index_ = 0;
+    if (canvas_) {
+        memcpy(canvas_, cache_->first_frame(), img_dsc_.data_size);
+        img_dsc_.data = canvas_;
+    } else {
+        img_dsc_.data = cache_->frame(0).image;
+    }
+    lv_area_set(&dirty_area_, 0, 0, img_dsc_.header.w - 1, img_dsc_.header.h - 1);
+}
+
 void LvglGif::Cleanup() {
     // Stop and delete timer
     if (timer_) {
@@ -200,6 +314,12 @@ void LvglGif::Cleanup() {
         gif_ = nullptr;
     }
 
+    if (canvas_) {
+        heap_caps_free(canvas_);
+        canvas_ = nullptr;
+    }
+    cache_.reset();
+
     playing_ = false;
     loaded_ = false;
     
@@ -2,17 +2,19 @@
 
 #include "../lvgl_image.h"
 #include "gifdec.h"
+#include "gif_frame_cache.h"
 #include <lvgl.h>
 #include <memory>
 #include <functional>
 
 /**
  * C++ implementation of LVGL GIF widget
- * Provides GIF animation functionality using gifdec library
+ * Provides GIF animation functionality using gifdec library, or plays the frames of a
+ * GifFrameCache without decoding
  */
 class LvglGif {
 public:
-    explicit LvglGif(const lv_img_dsc_t* img_dsc);
+    explicit LvglGif(const lv_img_dsc_t* img_dsc, std::shared_ptr<const GifFrameCache> cache = nullptr);
     virtual ~LvglGif();
 
     // LvglImage interface implementation
@@ -69,9 +71,21 @@ public:
      */
     void SetFrameCallback(std::function<void()> callback);
 
+    /**
+     * Area of the image changed by the last frame, in image coordinates
+     */
+    const lv_area_t& dirty_area() const;
+
 private:
-    // GIF decoder instance
+    // GIF decoder instance, nullptr when playing from the cache
     gd_GIF* gif_;
+
+    // Decoded frames, canvas_ holds the current frame with kGifCacheDeltas
+    std::shared_ptr<const GifFrameCache> cache_;
+    uint8_t* canvas_ = nullptr;
+    size_t frame_index_ = 0;
+    int32_t loop_count_ = -1;
+    lv_area_t dirty_area_ = {0, 0, -1, -1};
     
     // LVGL image descriptor
     lv_img_dsc_t img_dsc_;
@@ -93,6 +107,12 @@ private:
      * Update to next frame
      */
     void NextFrame();
+    void NextCachedFrame();
+
+    /**
+     * Show the first frame of the cache
+     */
+    void RewindCache();
     
     /**
      * Cleanup resources
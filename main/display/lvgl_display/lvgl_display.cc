@@ -71,6 +71,10 @@ LvglDisplay::~LvglDisplay() {
 
 void LvglDisplay::SetStatus(const char* status) {
     DisplayLockGuard lock(this);
+    SetStatusUnlocked(status);
+}
+
+void LvglDisplay::SetStatusUnlocked(const char* status) {
     if (status_label_ == nullptr) {
         return;
     }
@@ -79,6 +83,7 @@ void LvglDisplay::SetStatus(const char* status) {
     lv_obj_add_flag(notification_label_, LV_OBJ_FLAG_HIDDEN);
 
     last_status_update_time_ = std::chrono::system_clock::now();
+    status_generation_++;
 }
 
 void LvglDisplay::ShowNotification(const std::string &notification, int duration_ms) {
@@ -99,38 +104,32 @@ void LvglDisplay::ShowNotification(const char* notification, int duration_ms) {
 }
 
 void LvglDisplay::UpdateStatusBar(bool update_all) {
+    if (mute_label_ == nullptr) {
+        return;
+    }
+
+    int64_t start_time = esp_timer_get_time();
     auto& app = Application::GetInstance();
     auto& board = Board::GetInstance();
     auto codec = board.GetAudioCodec();
+    auto device_state = app.GetDeviceState();
 
-    // Update mute icon
-    {
-        DisplayLockGuard lock(this);
-        if (mute_label_ == nullptr) {
-            return;
-        }
-
-        // Update icon if mute state changes
-        if (codec->output_volume() == 0 && !muted_) {
-            muted_ = true;
-            lv_label_set_text(mute_label_, FONT_AWESOME_VOLUME_XMARK);
-        } else if (codec->output_volume() > 0 && muted_) {
-            muted_ = false;
-            lv_label_set_text(mute_label_, "");
-        }
-    }
+    // Every item is read without the display lock, which is only taken for the items that changed
+    bool muted = codec->output_volume() == 0;
 
     // Update time
-    if (app.GetDeviceState() == kDeviceStateIdle) {
+    char time_str[sizeof(status_clock_)] = "";
+    if (device_state != kDeviceStateIdle) {
+        // Another status replaces the clock when the device leaves the idle state
+        status_clock_[0] = '\0';
+    } else {
         if (last_status_update_time_ + std::chrono::seconds(10) < std::chrono::system_clock::now()) {
             // Set status to clock "HH:MM"
             time_t now = time(NULL);
             struct tm* tm = localtime(&now);
             // Check if the we have already set the time
             if (tm->tm_year >= 2025 - 1900) {
-                char time_str[16];
                 strftime(time_str, sizeof(time_str), "%H:%M", tm);
-                SetStatus(time_str);
             } else {
                 ESP_LOGW(TAG, "System time is not set, tm_year: %d", tm->tm_year);
             }
@@ -139,12 +138,13 @@ void LvglDisplay::UpdateStatusBar(bool update_all) {
 
     esp_pm_lock_acquire(pm_lock_);
     // Update battery icon
+    const char* battery_icon = battery_icon_;
+    bool low_battery = low_battery_shown_;
     int battery_level;
     bool charging, discharging;
-    const char* icon = nullptr;
     if (board.GetBatteryLevel(battery_level, charging, discharging)) {
         if (charging) {
-            icon = FONT_AWESOME_BATTERY_BOLT;
+            battery_icon = FONT_AWESOME_BATTERY_BOLT;
         } else {
             const char* levels[] = {
                 FONT_AWESOME_BATTERY_EMPTY, // 0-19%
@@ -154,34 +154,16 @@ void LvglDisplay::UpdateStatusBar(bool update_all) {
                 FONT_AWESOME_BATTERY_FULL, // 80-99%
                 FONT_AWESOME_BATTERY_FULL, // 100%
             };
-            icon = levels[battery_level / 20];
-        }
-        DisplayLockGuard lock(this);
-        if (battery_label_ != nullptr && battery_icon_ != icon) {
-            battery_icon_ = icon;
-            lv_label_set_text(battery_label_, battery_icon_);
-        }
-
-        if (low_battery_popup_ != nullptr) {
-            if (strcmp(icon, FONT_AWESOME_BATTERY_EMPTY) == 0 && discharging) {
-                if (lv_obj_has_flag(low_battery_popup_, LV_OBJ_FLAG_HIDDEN)) { // Show if low battery popup is hidden
-                    lv_obj_remove_flag(low_battery_popup_, LV_OBJ_FLAG_HIDDEN);
-                    app.PlaySound(Lang::Sounds::OGG_LOW_BATTERY);
-                }
-            } else {
-                // Hide the low battery popup when the battery is not empty
-                if (!lv_obj_has_flag(low_battery_popup_, LV_OBJ_FLAG_HIDDEN)) { // Hide if low battery popup is shown
-                    lv_obj_add_flag(low_battery_popup_, LV_OBJ_FLAG_HIDDEN);
-                }
-            }
+            battery_icon = levels[battery_level / 20];
         }
+        low_battery = strcmp(battery_icon, FONT_AWESOME_BATTERY_EMPTY) == 0 && discharging;
     }
 
     // Update network icon every 10 seconds
+    const char* network_icon = network_icon_;
     static int seconds_counter = 0;
     if (update_all || seconds_counter++ % 10 == 0) {
         // Don't read 4G network status during firmware upgrade to avoid occupying UART resources
-        auto device_state = Application::GetInstance().GetDeviceState();
         static const std::vector<DeviceState> allowed_states = {
             kDeviceStateIdle,
             kDeviceStateStarting,
@@ -190,16 +172,75 @@ void LvglDisplay::UpdateStatusBar(bool update_all) {
             kDeviceStateActivating,
         };
         if (std::find(allowed_states.begin(), allowed_states.end(), device_state) != allowed_states.end()) {
-            icon = board.GetNetworkStateIcon();
-            if (network_label_ != nullptr && icon != nullptr && network_icon_ != icon) {
-                DisplayLockGuard lock(this);
-                network_icon_ = icon;
-                lv_label_set_text(network_label_, network_icon_);
+            auto icon = board.GetNetworkStateIcon();
+            if (icon != nullptr) {
+                network_icon = icon;
             }
         }
     }
-
     esp_pm_lock_release(pm_lock_);
+
+    bool changed = muted != muted_ || battery_icon != battery_icon_ || network_icon != network_icon_ ||
+        (low_battery != low_battery_shown_ && low_battery_popup_ != nullptr);
+    // The clock is set again only when the minute changes or another status replaced it
+    bool clock_changed = time_str[0] != '\0' &&
+        (strcmp(status_clock_, time_str) != 0 || status_generation_ != status_clock_generation_);
+    int64_t lock_wait_us = 0;
+    if (changed || clock_changed) {
+        int64_t lock_start_time = esp_timer_get_time();
+        DisplayLockGuard lock(this);
+        lock_wait_us = esp_timer_get_time() - lock_start_time;
+
+        if (clock_changed) {
+            SetStatusUnlocked(time_str);
+            strcpy(status_clock_, time_str);
+            // Read under the lock, so a SetStatus on another task always bumps it past this value
+            status_clock_generation_ = status_generation_;
+            changed = true;
+        }
+
+        // Setting a label invalidates only its own area
+        if (muted != muted_) {
+            muted_ = muted;
+            lv_label_set_text(mute_label_, muted_ ? FONT_AWESOME_VOLUME_XMARK : "");
+        }
+        if (battery_label_ != nullptr && battery_icon != battery_icon_) {
+            battery_icon_ = battery_icon;
+            lv_label_set_text(battery_label_, battery_icon_);
+        }
+        if (low_battery_popup_ != nullptr && low_battery != low_battery_shown_) {
+            low_battery_shown_ = low_battery;
+            if (low_battery_shown_) {
+                lv_obj_remove_flag(low_battery_popup_, LV_OBJ_FLAG_HIDDEN);
+                app.PlaySound(Lang::Sounds::OGG_LOW_BATTERY);
+            } else {
+                // Hide the low battery popup when the battery is not empty
+                lv_obj_add_flag(low_battery_popup_, LV_OBJ_FLAG_HIDDEN);
+            }
+        }
+        if (network_label_ != nullptr && network_icon != network_icon_) {
+            network_icon_ = network_icon;
+            lv_label_set_text(network_label_, network_icon_);
+        }
+    }
+
+    // Cost of the updates, a debug summary once a minute
+    int64_t cost_us = esp_timer_get_time() - start_time;
+    status_bar_stats_.updates++;
+    if (changed) {
+        status_bar_stats_.changed++;
+    }
+    status_bar_stats_.total_us += cost_us;
+    status_bar_stats_.lock_wait_us += lock_wait_us;
+    if (cost_us > status_bar_stats_.max_us) {
+        status_bar_stats_.max_us = cost_us;
+    }
+    if (status_bar_stats_.updates >= 60) {
+        ESP_LOGD(TAG, "Status bar: %lu updates, %lu changed, avg %lld us, max %lld us, lock wait %lld us",
+            status_bar_stats_.updates, status_bar_stats_.changed, status_bar_stats_.total_us / status_bar_stats_.updates,
+            status_bar_stats_.max_us, status_bar_stats_.lock_wait_us);
+        status_bar_stats_ = StatusBarStats();
+    }
 }
 
 void LvglDisplay::SetPreviewImage(std::unique_ptr<LvglImage> image) {
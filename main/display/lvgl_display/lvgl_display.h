@@ -11,6 +11,15 @@
 
 #include <string>
 #include <chrono>
+#include <atomic>
+
+struct StatusBarStats {
+    uint32_t updates = 0;
+    uint32_t changed = 0;           // Updates that changed at least one item
+    int64_t total_us = 0;
+    int64_t max_us = 0;
+    int64_t lock_wait_us = 0;       // Time spent waiting for the display lock
+};
 
 class LvglDisplay : public Display {
 public:
@@ -40,10 +49,20 @@ protected:
     const char* battery_icon_ = nullptr;
     const char* network_icon_ = nullptr;
     bool muted_ = false;
+    bool low_battery_shown_ = false;
+    // Bumped by every status label update, so UpdateStatusBar sees without the lock that the clock was replaced
+    std::atomic<uint32_t> status_generation_ = 0;
+    // Clock "HH:MM" last set by UpdateStatusBar and the generation it got, only used by the main task
+    char status_clock_[6] = "";
+    uint32_t status_clock_generation_ = 0;
+    StatusBarStats status_bar_stats_;
 
     std::chrono::system_clock::time_point last_status_update_time_;
     esp_timer_handle_t notification_timer_ = nullptr;
 
+    // Status label update for callers that already hold the display lock
+    void SetStatusUnlocked(const char* status);
+
     friend class DisplayLockGuard;
     virtual bool Lock(int timeout_ms = 0) = 0;
     virtual void Unlock() = 0;
@@ -9,7 +9,7 @@
 #define TAG "LvglImage"
 
 
-LvglRawImage::LvglRawImage(void* data, size_t size) {
+LvglRawImage::LvglRawImage(void* data, size_t size, const char* name) : name_(name != nullptr ? name : "") {
     bzero(&image_dsc_, sizeof(image_dsc_));
     image_dsc_.data_size = size;
     image_dsc_.data = static_cast<uint8_t*>(data);
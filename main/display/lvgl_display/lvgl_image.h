@@ -1,6 +1,9 @@
 #pragma once
 
 #include <lvgl.h>
+#include "gif/gif_frame_cache.h"
+
+#include <string>
 
 
 // Wrap around lv_img_dsc_t
@@ -8,18 +11,26 @@ class LvglImage {
 public:
     virtual const lv_img_dsc_t* image_dsc() const = 0;
     virtual bool IsGif() const { return false; }
+    virtual GifCacheMode gif_cache_mode() const { return kGifCacheDeltas; }
+    // Name of the asset the image comes from, nullptr if it has none
+    virtual const char* name() const { return nullptr; }
     virtual ~LvglImage() = default;
 };
 
 
 class LvglRawImage : public LvglImage {
 public:
-    LvglRawImage(void* data, size_t size);
+    LvglRawImage(void* data, size_t size, const char* name = nullptr);
     virtual const lv_img_dsc_t* image_dsc() const override { return &image_dsc_; }
     virtual bool IsGif() const;
+    virtual const char* name() const override { return name_.empty() ? nullptr : name_.c_str(); }
+    virtual GifCacheMode gif_cache_mode() const override { return gif_cache_mode_; }
+    void set_gif_cache_mode(GifCacheMode mode) { gif_cache_mode_ = mode; }
 
 private:
     lv_img_dsc_t image_dsc_;
+    GifCacheMode gif_cache_mode_ = kGifCacheDeltas;
+    std::string name_;
 };
 
 class LvglCBinImage : public LvglImage {
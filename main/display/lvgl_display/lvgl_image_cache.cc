@@ -0,0 +1,223 @@
+#include "lvgl_image_cache.h"
+#include "jpg/jpeg_to_image.h"
+
+#include <esp_log.h>
+#include <esp_timer.h>
+#include <esp_heap_caps.h>
+#include <cstring>
+
+#define TAG "LvglImageCache"
+
+// The lodepng built into LVGL (LV_USE_LODEPNG), its header is not part of LVGL's public API
+extern "C" unsigned lodepng_decode32(unsigned char** out, unsigned* w, unsigned* h, const unsigned char* in, size_t insize);
+
+// LVGL caches the header and draw buffer of an image by its address, drop them with the pixels
+static std::shared_ptr<LvglImage> MakeDecodedImage(void* data, size_t size, int width, int height, int stride, int color_format) {
+    return std::shared_ptr<LvglImage>(new LvglAllocatedImage(data, size, width, height, stride, color_format), [](LvglImage* image) {
+        lv_image_header_cache_drop(image->image_dsc());
+        lv_image_cache_drop(image->image_dsc());
+        delete image;
+    });
+}
+
+LvglImageCache::LvglImageCache(size_t max_bytes) : max_bytes_(max_bytes) {
+}
+
+bool LvglImageCache::IsCompressed(const LvglImage* image) {
+    if (image == nullptr || image->IsGif()) {
+        return false;
+    }
+    auto dsc = image->image_dsc();
+    if (dsc == nullptr || dsc->data == nullptr || dsc->data_size < 4) {
+        return false;
+    }
+    static const uint8_t png_magic[] = {0x89, 'P', 'N', 'G'};
+    if (memcmp(dsc->data, png_magic, sizeof(png_magic)) == 0) {
+        return true;
+    }
+#ifndef CONFIG_IDF_TARGET_ESP32
+    // There is no JPEG decoder outside LVGL on the ESP32, LVGL decodes those when drawing
+    static const uint8_t jpeg_magic[] = {0xFF, 0xD8, 0xFF};
+    return memcmp(dsc->data, jpeg_magic, sizeof(jpeg_magic)) == 0;
+#else
+    return false;
+#endif
+}
+
+std::shared_ptr<LvglImage> LvglImageCache::Decode(const LvglImage* image) {
+    if (!IsCompressed(image)) {
+        return nullptr;
+    }
+
+    int64_t start_time = esp_timer_get_time();
+    auto src = image->image_dsc();
+    std::shared_ptr<LvglImage> decoded;
+#ifndef CONFIG_IDF_TARGET_ESP32
+    if (src->data[0] == 0xFF) {
+        uint8_t* out = nullptr;
+        size_t out_len, width, height, stride;
+        if (jpeg_to_image(src->data, src->data_size, &out, &out_len, &width, &height, &stride) == ESP_OK) {
+            decoded = MakeDecodedImage(out, out_len, width, height, stride, LV_COLOR_FORMAT_RGB565);
+        }
+    } else
+#endif
+    {
+        // lodepng directly rather than the LVGL decoder, so that no LVGL state is touched
+        unsigned char* rgba = nullptr;
+        unsigned width = 0, height = 0;
+        if (lodepng_decode32(&rgba, &width, &height, src->data, src->data_size) == 0) {
+            // LVGL's ARGB8888 is B, G, R, A in memory
+            size_t size = (size_t)width * height * 4;
+            auto data = (uint8_t*)heap_caps_malloc(size, MALLOC_CAP_SPIRAM);
+            if (data != nullptr) {
+                for (size_t i = 0; i < size; i += 4) {
+                    data[i] = rgba[i + 2];
+                    data[i + 1] = rgba[i + 1];
+                    data[i + 2] = rgba[i];
+                    data[i + 3] = rgba[i + 3];
+                }
+                decoded = MakeDecodedImage(data, size, width, height, width * 4, LV_COLOR_FORMAT_ARGB8888);
+            }
+        }
+        lv_free(rgba);
+    }
+    int64_t decode_us = esp_timer_get_time() - start_time;
+
+    const char* name = image->name() != nullptr ? image->name() : "image";
+    if (decoded == nullptr) {
+        ESP_LOGW(TAG, "Failed to decode %s", name);
+        return nullptr;
+    }
+    ESP_LOGI(TAG, "Decoded %s %ux%u in %d ms", name, (unsigned)decoded->image_dsc()->header.w,
+        (unsigned)decoded->image_dsc()->header.h, int(decode_us / 1000));
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    stats_.decodes++;
+    stats_.decode_us += decode_us;
+    if (decode_us > stats_.max_decode_us) {
+        stats_.max_decode_us = decode_us;
+    }
+    return decoded;
+}
+
+std::list<LvglImageCache::Entry>::iterator LvglImageCache::Find(const std::string& name, const void* source) {
+    auto it = index_.find(name);
+    if (it == index_.end()) {
+        return entries_.end();
+    }
+    if (it->second->source != source) {
+        stats_.bytes -= it->second->size;
+        entries_.erase(it->second);
+        index_.erase(it);
+        return entries_.end();
+    }
+    entries_.splice(entries_.begin(), entries_, it->second);
+    return entries_.begin();
+}
+
+void LvglImageCache::Insert(Entry entry) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (entry.size > max_bytes_ || index_.find(entry.name) != index_.end()) {
+        return;
+    }
+    while (stats_.bytes + entry.size > max_bytes_ && !entries_.empty()) {
+        auto& last = entries_.back();
+        ESP_LOGD(TAG, "Evict %s, %u bytes", last.name.c_str(), last.size);
+        stats_.bytes -= last.size;
+        stats_.evictions++;
+        index_.erase(last.name);
+        entries_.pop_back();
+    }
+    stats_.bytes += entry.size;
+    entries_.push_front(std::move(entry));
+    index_[entries_.front().name] = entries_.begin();
+}
+
+bool LvglImageCache::Prefetch(Entry entry) {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        // Drops a stale entry under the same name first
+        if (Find(entry.name, entry.source) != entries_.end()) {
+            return true;
+        }
+        if (stats_.bytes + entry.size > max_bytes_) {
+            return false;
+        }
+    }
+    Insert(std::move(entry));
+    return true;
+}
+
+std::shared_ptr<LvglImage> LvglImageCache::Get(const std::string& name, const LvglImage* image) {
+    if (!IsCompressed(image)) {
+        return nullptr;
+    }
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = Find(name, image->image_dsc()->data);
+    if (it != entries_.end() && it->image != nullptr) {
+        stats_.hits++;
+        return it->image;
+    }
+    stats_.misses++;
+    return nullptr;
+}
+
+void LvglImageCache::Insert(const std::string& name, const LvglImage* image, std::shared_ptr<LvglImage> decoded) {
+    size_t size = decoded->image_dsc()->data_size;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        Find(name, image->image_dsc()->data);
+    }
+    Insert({name, image->image_dsc()->data, std::move(decoded), nullptr, size});
+}
+
+bool LvglImageCache::Contains(const std::string& name, const LvglImage* image) const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = index_.find(name);
+    return it != index_.end() && it->second->source == image->image_dsc()->data;
+}
+
+bool LvglImageCache::Prefetch(const std::string& name, const LvglImage* image, std::shared_ptr<LvglImage> decoded) {
+    size_t size = decoded->image_dsc()->data_size;
+    return Prefetch({name, image->image_dsc()->data, std::move(decoded), nullptr, size});
+}
+
+std::shared_ptr<const GifFrameCache> LvglImageCache::GetFrames(const std::string& name, const LvglImage* image) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = Find(name, image->image_dsc()->data);
+    if (it != entries_.end() && it->frames != nullptr) {
+        stats_.hits++;
+        return it->frames;
+    }
+    stats_.misses++;
+    return nullptr;
+}
+
+void LvglImageCache::InsertFrames(const std::string& name, const LvglImage* image, std::shared_ptr<const GifFrameCache> frames) {
+    size_t size = frames != nullptr ? frames->size() : 0;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        Find(name, image->image_dsc()->data);
+    }
+    Insert({name, image->image_dsc()->data, nullptr, std::move(frames), size});
+}
+
+bool LvglImageCache::Prefetch(const std::string& name, const LvglImage* image, std::shared_ptr<const GifFrameCache> frames) {
+    size_t size = frames != nullptr ? frames->size() : 0;
+    return Prefetch({name, image->image_dsc()->data, nullptr, std::move(frames), size});
+}
+
+void LvglImageCache::Clear() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    index_.clear();
+    entries_.clear();
+    stats_.bytes = 0;
+}
+
+LvglImageCacheStats LvglImageCache::GetStats() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    LvglImageCacheStats stats = stats_;
+    stats.entries = entries_.size();
+    return stats;
+}
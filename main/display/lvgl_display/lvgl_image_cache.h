@@ -0,0 +1,85 @@
+#pragma once
+
+#include "lvgl_image.h"
+
+#include <lvgl.h>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+struct LvglImageCacheStats {
+    uint32_t hits = 0;
+    uint32_t misses = 0;
+    uint32_t evictions = 0;
+    uint32_t decodes = 0;           // Images decoded, cached or not
+    int64_t decode_us = 0;          // Time spent decoding
+    int64_t max_decode_us = 0;      // Slowest single decode
+    size_t bytes = 0;               // Decoded bytes held by the cache, GIF frames included
+    size_t entries = 0;
+};
+
+/**
+ * Decoded PNG and JPEG images and the frames of GIFs, keyed by asset name and evicted least
+ * recently used first under one byte budget.
+ *
+ * The images are decoded once into PSRAM and handed out as RGB565 or ARGB8888 images that LVGL
+ * draws without a decoder. GIF frames are built by the caller with GifFrameCache::Create() and
+ * only stored here. An entry stays valid while a caller holds it, even after it has been
+ * evicted. Decoding does not touch LVGL and may run without the display lock. Releasing the last
+ * reference to an image drops it from LVGL's caches, so every method that may evict or drop a stale
+ * entry, all but Decode(), Contains() and GetStats(), needs the display lock.
+ */
+class LvglImageCache {
+public:
+    explicit LvglImageCache(size_t max_bytes);
+    LvglImageCache(const LvglImageCache&) = delete;
+    LvglImageCache& operator=(const LvglImageCache&) = delete;
+
+    // Images the cache decodes: PNG, and JPEG except on the ESP32
+    static bool IsCompressed(const LvglImage* image);
+
+    // Decodes without caching, nullptr if the image is not compressed or fails to decode
+    std::shared_ptr<LvglImage> Decode(const LvglImage* image);
+    // Returns the decoded image, nullptr on a miss. It never decodes, a miss is decoded with Decode() off the lock.
+    std::shared_ptr<LvglImage> Get(const std::string& name, const LvglImage* image);
+    // Inserts an image decoded with Decode(), evicting older entries for it
+    void Insert(const std::string& name, const LvglImage* image, std::shared_ptr<LvglImage> decoded);
+    // Whether the image is cached, a new asset under the same name is not
+    bool Contains(const std::string& name, const LvglImage* image) const;
+    // Inserts an image decoded ahead with Decode() if it fits without evicting anything, false once the cache is full
+    bool Prefetch(const std::string& name, const LvglImage* image, std::shared_ptr<LvglImage> decoded);
+
+    // Frames of a GIF, nullptr on a miss or when the GIF could not be cached
+    std::shared_ptr<const GifFrameCache> GetFrames(const std::string& name, const LvglImage* image);
+    // Inserts the frames of a GIF, evicting older entries for them. nullptr frames record a GIF
+    // that is played without a cache, so Contains() stops it from being built again.
+    void InsertFrames(const std::string& name, const LvglImage* image, std::shared_ptr<const GifFrameCache> frames);
+    // Like InsertFrames() if the frames fit without evicting anything, false once the cache is full
+    bool Prefetch(const std::string& name, const LvglImage* image, std::shared_ptr<const GifFrameCache> frames);
+    void Clear();
+
+    inline size_t max_bytes() const { return max_bytes_; }
+    LvglImageCacheStats GetStats() const;
+
+private:
+    struct Entry {
+        std::string name;
+        const void* source;         // Compressed data, a new asset under the same name is a miss
+        std::shared_ptr<LvglImage> image;
+        std::shared_ptr<const GifFrameCache> frames;
+        size_t size;
+    };
+
+    size_t max_bytes_;
+    mutable std::mutex mutex_;
+    std::list<Entry> entries_;      // Most recently used first
+    std::unordered_map<std::string, std::list<Entry>::iterator> index_;
+    LvglImageCacheStats stats_;
+
+    // Moves a hit to the front and drops a stale entry, called with mutex_ held
+    std::list<Entry>::iterator Find(const std::string& name, const void* source);
+    void Insert(Entry entry);
+    bool Prefetch(Entry entry);
+};
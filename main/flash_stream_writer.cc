@@ -0,0 +1,209 @@
+#include "flash_stream_writer.h"
+
+#include <esp_log.h>
+#include <esp_timer.h>
+#include <esp_heap_caps.h>
+
+#define TAG "FlashStreamWriter"
+
+FlashStreamWriter::FlashStreamWriter(size_t chunk_size, size_t chunk_count, WriteFunction write)
+    : chunk_size_(chunk_size), write_(write) {
+    for (size_t i = 0; i < chunk_count; i++) {
+        // Internal RAM lets the flash driver write without a bounce buffer
+        char* chunk = (char*)heap_caps_malloc(chunk_size_, MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+        if (chunk == nullptr) {
+            chunk = (char*)heap_caps_malloc(chunk_size_, MALLOC_CAP_8BIT);
+        }
+        if (chunk == nullptr) {
+            ESP_LOGW(TAG, "Only %u of %u chunks allocated", chunks_.size(), chunk_count);
+            break;
+        }
+        chunks_.push_back(chunk);
+    }
+    free_chunks_ = chunks_;
+}
+
+FlashStreamWriter::~FlashStreamWriter() {
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        stopping_ = true;
+        condition_variable_.notify_all();
+        condition_variable_.wait(lock, [this]() { return running_tasks_ == 0; });
+    }
+    for (auto chunk : chunks_) {
+        heap_caps_free(chunk);
+    }
+}
+
+bool FlashStreamWriter::PreErase(const esp_partition_t* partition, size_t length) {
+    size_t sector_size = esp_partition_get_main_flash_sector_size();
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        erase_partition_ = partition;
+        erase_length_ = (length + sector_size - 1) / sector_size * sector_size;
+        erased_ = 0;
+        running_tasks_++;
+    }
+    auto ret = xTaskCreate([](void* arg) {
+        FlashStreamWriter* writer = (FlashStreamWriter*)arg;
+        writer->EraserTask();
+        vTaskDelete(NULL);
+    }, "flash_erase", 4096, this, 3, nullptr);
+    if (ret != pdPASS) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        erase_partition_ = nullptr;
+        running_tasks_--;
+        return false;
+    }
+    return true;
+}
+
+bool FlashStreamWriter::Start() {
+    if (chunks_.empty()) {
+        ESP_LOGE(TAG, "No chunks allocated");
+        return false;
+    }
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        running_tasks_++;
+    }
+    auto ret = xTaskCreate([](void* arg) {
+        FlashStreamWriter* writer = (FlashStreamWriter*)arg;
+        writer->WriterTask();
+        vTaskDelete(NULL);
+    }, "flash_write", 4096, this, 4, nullptr);
+    if (ret != pdPASS) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        running_tasks_--;
+        return false;
+    }
+    return true;
+}
+
+char* FlashStreamWriter::AcquireChunk() {
+    int64_t start_time = esp_timer_get_time();
+    std::unique_lock<std::mutex> lock(mutex_);
+    condition_variable_.wait(lock, [this]() { return !free_chunks_.empty() || error_ != ESP_OK; });
+    stats_.chunk_wait_us += esp_timer_get_time() - start_time;
+    if (error_ != ESP_OK) {
+        return nullptr;
+    }
+    char* chunk = free_chunks_.back();
+    free_chunks_.pop_back();
+    return chunk;
+}
+
+void FlashStreamWriter::SubmitChunk(char* chunk, size_t offset, size_t size) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    submitted_chunks_.push_back({chunk, offset, size});
+    condition_variable_.notify_all();
+}
+
+void FlashStreamWriter::ReleaseChunk(char* chunk) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    free_chunks_.push_back(chunk);
+    condition_variable_.notify_all();
+}
+
+esp_err_t FlashStreamWriter::Flush() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    condition_variable_.wait(lock, [this]() { return submitted_chunks_.empty() && !writing_; });
+    return error_;
+}
+
+FlashStreamStats FlashStreamWriter::GetStats() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return stats_;
+}
+
+void FlashStreamWriter::WriterTask() {
+    while (true) {
+        Chunk chunk;
+        esp_err_t err;
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            condition_variable_.wait(lock, [this]() { return stopping_ || !submitted_chunks_.empty(); });
+            if (submitted_chunks_.empty()) {
+                break;
+            }
+            chunk = submitted_chunks_.front();
+            submitted_chunks_.pop_front();
+            writing_ = true;
+
+            if (erase_partition_ != nullptr) {
+                int64_t start_time = esp_timer_get_time();
+                condition_variable_.wait(lock, [this, &chunk]() {
+                    return stopping_ || error_ != ESP_OK || erased_ >= chunk.offset + chunk.size;
+                });
+                stats_.erase_wait_us += esp_timer_get_time() - start_time;
+            }
+            // After a failure the remaining chunks are only returned
+            err = error_;
+            if (err == ESP_OK && erase_partition_ != nullptr && erased_ < chunk.offset + chunk.size) {
+                err = ESP_ERR_INVALID_STATE;
+            }
+        }
+
+        int64_t start_time = esp_timer_get_time();
+        if (err == ESP_OK) {
+            err = write_(chunk.offset, chunk.data, chunk.size);
+            if (err != ESP_OK) {
+                ESP_LOGE(TAG, "Failed to write %u bytes at offset %u: %s", chunk.size, chunk.offset, esp_err_to_name(err));
+            }
+        }
+        int64_t end_time = esp_timer_get_time();
+
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (err != ESP_OK) {
+            if (error_ == ESP_OK) {
+                error_ = err;
+            }
+        } else {
+            stats_.bytes += chunk.size;
+            stats_.write_us += end_time - start_time;
+        }
+        writing_ = false;
+        free_chunks_.push_back(chunk.data);
+        condition_variable_.notify_all();
+    }
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    running_tasks_--;
+    condition_variable_.notify_all();
+}
+
+void FlashStreamWriter::EraserTask() {
+    size_t sector_size = esp_partition_get_main_flash_sector_size();
+    while (true) {
+        size_t offset;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (stopping_ || error_ != ESP_OK || erased_ >= erase_length_) {
+                break;
+            }
+            offset = erased_;
+        }
+
+        // One sector at a time keeps each period with the flash cache disabled short
+        int64_t start_time = esp_timer_get_time();
+        esp_err_t err = esp_partition_erase_range(erase_partition_, offset, sector_size);
+        int64_t end_time = esp_timer_get_time();
+
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (err != ESP_OK) {
+            ESP_LOGE(TAG, "Failed to erase sector at offset %u: %s", offset, esp_err_to_name(err));
+            if (error_ == ESP_OK) {
+                error_ = err;
+            }
+            condition_variable_.notify_all();
+            break;
+        }
+        erased_ += sector_size;
+        stats_.erase_us += end_time - start_time;
+        condition_variable_.notify_all();
+    }
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    running_tasks_--;
+    condition_variable_.notify_all();
+}
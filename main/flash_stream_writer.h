@@ -0,0 +1,85 @@
+#ifndef FLASH_STREAM_WRITER_H
+#define FLASH_STREAM_WRITER_H
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <esp_err.h>
+#include <esp_partition.h>
+
+#include <functional>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <vector>
+
+struct FlashStreamStats {
+    size_t bytes = 0;               // Bytes written to flash
+    int64_t write_us = 0;           // Time spent in the write function
+    int64_t erase_us = 0;           // Time the eraser spent erasing ahead of the writes
+    int64_t erase_wait_us = 0;      // Time the writer waited for the eraser
+    int64_t chunk_wait_us = 0;      // Time the reader waited for a free chunk, flash slower than the network
+};
+
+/*
+ * Writes a sequential stream to flash from its own task.
+ *
+ * The reader fills a chunk, submits it and goes on reading into the next one while the writer
+ * task programs the previous one, so network reads and flash writes overlap. With PreErase,
+ * another task erases the partition ahead of the writes. When the flash falls behind, the
+ * reader waits for a free chunk, which is the backpressure on the download.
+ */
+class FlashStreamWriter {
+public:
+    typedef std::function<esp_err_t(size_t offset, const char* data, size_t size)> WriteFunction;
+
+    FlashStreamWriter(size_t chunk_size, size_t chunk_count, WriteFunction write);
+    ~FlashStreamWriter();
+    FlashStreamWriter(const FlashStreamWriter&) = delete;
+    FlashStreamWriter& operator=(const FlashStreamWriter&) = delete;
+
+    // Erases [0, length) of the partition in a background task, writes wait for their sectors
+    bool PreErase(const esp_partition_t* partition, size_t length);
+    bool Start();
+
+    // Blocks until a chunk is free, nullptr after a failed write
+    char* AcquireChunk();
+    // Queues size bytes of the chunk for writing at offset
+    void SubmitChunk(char* chunk, size_t offset, size_t size);
+    // Returns a chunk that holds nothing to write
+    void ReleaseChunk(char* chunk);
+    // Waits for the submitted chunks, returns the first error
+    esp_err_t Flush();
+
+    inline size_t chunk_size() const { return chunk_size_; }
+    FlashStreamStats GetStats() const;
+
+private:
+    struct Chunk {
+        char* data;
+        size_t offset;
+        size_t size;
+    };
+
+    size_t chunk_size_;
+    WriteFunction write_;
+    std::vector<char*> chunks_;
+
+    mutable std::mutex mutex_;
+    std::condition_variable condition_variable_;
+    std::vector<char*> free_chunks_;
+    std::deque<Chunk> submitted_chunks_;
+    bool writing_ = false;
+    bool stopping_ = false;
+    int running_tasks_ = 0;
+    esp_err_t error_ = ESP_OK;
+    FlashStreamStats stats_;
+
+    const esp_partition_t* erase_partition_ = nullptr;
+    size_t erase_length_ = 0;
+    size_t erased_ = 0;
+
+    void WriterTask();
+    void EraserTask();
+};
+
+#endif // FLASH_STREAM_WRITER_H
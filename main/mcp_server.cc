@@ -21,9 +21,25 @@
 #define TAG "MCP"
 
 McpServer::McpServer() {
+    esp_timer_create_args_t timer_args = {
+        .callback = [](void* arg) {
+            McpServer* server = (McpServer*)arg;
+            server->CheckToolCallTimeouts();
+        },
+        .arg = this,
+        .dispatch_method = ESP_TIMER_TASK,
+        .name = "mcp_timeout",
+        .skip_unhandled_events = true,
+    };
+    esp_timer_create(&timer_args, &timeout_timer_);
 }
 
 McpServer::~McpServer() {
+    esp_timer_stop(timeout_timer_);
+    esp_timer_delete(timeout_timer_);
+    for (auto worker : workers_) {
+        vTaskDelete(worker);
+    }
     for (auto tool : tools_) {
         delete tool;
     }
@@ -43,7 +59,7 @@ void McpServer::AddCommonTools() {
     // Custom tools must be added in the board's InitializeTools function.
 
     AddTool("self.get_device_status",
-        "Provides the real-time information of the device, including the current status of the audio speaker, screen, battery, network, etc.\n"
+        "Provides the real-time information of the device, including the current status of the audio speaker, screen, battery, network, audio link quality, etc.\n"
         "Use this tool for: \n"
         "1. Answering questions about current condition (e.g. what is the current volume of the audio speaker?)\n"
         "2. As the first step to control the device (e.g. turn up / down the volume of the audio speaker, etc.)",
@@ -118,11 +134,17 @@ void McpServer::AddCommonTools() {
                 auto question = properties["question"].value<std::string>();
                 return camera->Explain(question);
             });
+        // The capture and the upload run on a worker, the main loop keeps going meanwhile
+        auto tool = tools_by_name_.at("self.camera.take_photo");
+        tool->set_main_thread_only(false);
+        tool->set_timeout_ms(60000);
     }
 #endif
 
     // Restore the original tools list to the end of the tools list
     tools_.insert(tools_.end(), original_tools.begin(), original_tools.end());
+    std::lock_guard<std::mutex> lock(tools_list_mutex_);
+    tools_list_dirty_ = true;
 }
 
 void McpServer::AddUserOnlyTools() {
@@ -302,13 +324,15 @@ void McpServer::AddUserOnlyTools() {
 
 void McpServer::AddTool(McpTool* tool) {
     // Prevent adding duplicate tools
-    if (std::find_if(tools_.begin(), tools_.end(), [tool](const McpTool* t) { return t->name() == tool->name(); }) != tools_.end()) {
+    if (!tools_by_name_.emplace(tool->name(), tool).second) {
         ESP_LOGW(TAG, "Tool %s already added", tool->name().c_str());
         return;
     }
 
     ESP_LOGI(TAG, "Add tool: %s%s", tool->name().c_str(), tool->user_only() ? " [user]" : "");
     tools_.push_back(tool);
+    std::lock_guard<std::mutex> lock(tools_list_mutex_);
+    tools_list_dirty_ = true;
 }
 
 void McpServer::AddTool(const std::string& name, const std::string& description, const PropertyList& properties, std::function<ReturnValue(const PropertyList&)> callback) {
@@ -367,6 +391,14 @@ void McpServer::ParseMessage(const cJSON* json) {
     
     auto method_str = std::string(method->valuestring);
     if (method_str.find("notifications") == 0) {
+        auto params = cJSON_GetObjectItem(json, "params");
+        if (method_str == "notifications/cancelled" && cJSON_IsObject(params)) {
+            auto request_id = cJSON_GetObjectItem(params, "requestId");
+            auto reason = cJSON_GetObjectItem(params, "reason");
+            if (cJSON_IsNumber(request_id)) {
+                CancelToolCall(request_id->valueint, cJSON_IsString(reason) ? reason->valuestring : "");
+            }
+        }
         return;
     }
     
@@ -436,11 +468,23 @@ void McpServer::ParseMessage(const cJSON* json) {
 }
 
 void McpServer::ReplyResult(int id, const std::string& result) {
-    std::string payload = "{\"jsonrpc\":\"2.0\",\"id\":";
+    std::string payload;
+    payload.reserve(result.size() + 40);
+    payload += "{\"jsonrpc\":\"2.0\",\"id\":";
     payload += std::to_string(id) + ",\"result\":";
     payload += result;
     payload += "}";
-    Application::GetInstance().SendMcpMessage(payload);
+    Application::GetInstance().SendMcpMessage(std::move(payload));
+}
+
+void McpServer::ReplyResult(int id, const std::string& result, std::string&& attachment) {
+    std::string payload;
+    payload.reserve(result.size() + 40);
+    payload += "{\"jsonrpc\":\"2.0\",\"id\":";
+    payload += std::to_string(id) + ",\"result\":";
+    payload += result;
+    payload += "}";
+    Application::GetInstance().SendMcpMessage(std::move(payload), std::move(attachment));
 }
 
 void McpServer::ReplyError(int id, const std::string& message) {
@@ -449,53 +493,81 @@ void McpServer::ReplyError(int id, const std::string& message) {
     payload += ",\"error\":{\"message\":\"";
     payload += message;
     payload += "\"}}";
-    Application::GetInstance().SendMcpMessage(payload);
+    Application::GetInstance().SendMcpMessage(std::move(payload));
 }
 
-void McpServer::GetToolsList(int id, const std::string& cursor, bool list_user_only_tools) {
-    const int max_payload_size = 8000;
-    std::string json = "{\"tools\":[";
-    
-    bool found_cursor = cursor.empty();
-    auto it = tools_.begin();
-    std::string next_cursor = "";
-    
-    while (it != tools_.end()) {
-        // 如果我们还没有找到起始位置，继续搜索
-        if (!found_cursor) {
-            if ((*it)->name() == cursor) {
-                found_cursor = true;
-            } else {
-                ++it;
+void McpServer::BuildToolsListCache() {
+    tools_list_json_.clear();
+    tools_list_index_.clear();
+    tools_list_index_.reserve(tools_.size());
+    for (bool user_only : {false, true}) {
+        for (auto tool : tools_) {
+            if (tool->user_only() != user_only) {
                 continue;
             }
+            if (!tools_list_index_.empty()) {
+                tools_list_json_ += ',';
+            }
+            tools_list_index_.emplace_back(tool, tools_list_json_.size());
+            tools_list_json_ += tool->to_json();
+        }
+        if (!user_only) {
+            tools_list_regular_count_ = tools_list_index_.size();
         }
+    }
+    tools_list_json_.shrink_to_fit();
+    tools_list_dirty_ = false;
+    ESP_LOGI(TAG, "Cached tools/list: %u tools, %u bytes", (unsigned)tools_list_index_.size(), (unsigned)tools_list_json_.size());
+}
 
-        if (!list_user_only_tools && (*it)->user_only()) {
-            ++it;
-            continue;
+void McpServer::GetToolsList(int id, const std::string& cursor, bool list_user_only_tools) {
+    const size_t max_payload_size = 8000;
+    const char* prefix = "{\"tools\":[";
+    std::string json;
+    std::string next_cursor;
+    std::string error;
+    {
+        std::lock_guard<std::mutex> lock(tools_list_mutex_);
+        if (tools_list_dirty_) {
+            BuildToolsListCache();
         }
-        
-        // 添加tool前检查大小
-        std::string tool_json = (*it)->to_json() + ",";
-        if (json.length() + tool_json.length() + 30 > max_payload_size) {
-            // 如果添加这个tool会超出大小限制，设置next_cursor并退出循环
-            next_cursor = (*it)->name();
-            break;
+        size_t count = list_user_only_tools ? tools_list_index_.size() : tools_list_regular_count_;
+        // End of a tool in the cache, without the comma that follows it
+        auto tool_end = [this](size_t i) {
+            return i + 1 < tools_list_index_.size() ? tools_list_index_[i + 1].second - 1 : tools_list_json_.size();
+        };
+
+        size_t first = 0;
+        if (!cursor.empty()) {
+            while (first < count && tools_list_index_[first].first->name() != cursor) {
+                first++;
+            }
+        }
+        size_t start = first < count ? tools_list_index_[first].second : 0;
+        size_t last = first;
+        // Same limit as before: the page, one comma per tool and 30 bytes for the closing part
+        while (last < count && strlen(prefix) + tool_end(last) + 1 - start + 30 <= max_payload_size) {
+            last++;
+        }
+
+        if (last < count) {
+            next_cursor = tools_list_index_[last].first->name();
+        }
+        if (last == first && first < count) {
+            error = "Failed to add tool " + next_cursor + " because of payload size limit";
+        } else if (!cursor.empty() && first == count) {
+            error = "Invalid cursor: " + cursor;
+        } else {
+            size_t end = last > first ? tool_end(last - 1) : start;
+            json.reserve(strlen(prefix) + end - start + next_cursor.size() + 20);
+            json += prefix;
+            json.append(tools_list_json_, start, end - start);
         }
-        
-        json += tool_json;
-        ++it;
-    }
-    
-    if (json.back() == ',') {
-        json.pop_back();
     }
-    
-    if (json.back() == '[' && !tools_.empty()) {
-        // 如果没有添加任何tool，返回错误
-        ESP_LOGE(TAG, "tools/list: Failed to add tool %s because of payload size limit", next_cursor.c_str());
-        ReplyError(id, "Failed to add tool " + next_cursor + " because of payload size limit");
+
+    if (!error.empty()) {
+        ESP_LOGE(TAG, "tools/list: %s", error.c_str());
+        ReplyError(id, error);
         return;
     }
 
@@ -508,56 +580,222 @@ void McpServer::GetToolsList(int id, const std::string& cursor, bool list_user_o
     ReplyResult(id, json);
 }
 
+void McpServer::BindArguments(const McpTool* tool, PropertyList& arguments, const cJSON* tool_arguments) {
+    // One pass over the arguments that were sent, each found by a binary search of the tool's index
+    uint64_t found = 0;
+    if (cJSON_IsObject(tool_arguments)) {
+        for (auto value = tool_arguments->child; value != nullptr; value = value->next) {
+            if (value->string == nullptr) {
+                continue;
+            }
+            // Names are matched ignoring case, the first argument that matches a property is taken
+            int index = tool->FindProperty(value->string);
+            if (index < 0 || (found & (1ULL << index))) {
+                continue;
+            }
+            auto& argument = arguments.at(index);
+            if (argument.type() == kPropertyTypeBoolean && cJSON_IsBool(value)) {
+                argument.set_value<bool>(cJSON_IsTrue(value));
+            } else if (argument.type() == kPropertyTypeInteger && cJSON_IsNumber(value)) {
+                argument.set_value<int>(value->valueint);
+            } else if (argument.type() == kPropertyTypeString && cJSON_IsString(value)) {
+                argument.set_value<std::string>(value->valuestring);
+            } else {
+                continue;
+            }
+            found |= 1ULL << index;
+        }
+    }
+
+    // The frame may hold the values of an earlier call, arguments not sent get their defaults back
+    auto& definitions = tool->properties();
+    for (size_t i = 0; i < definitions.size(); i++) {
+        if (found & (1ULL << i)) {
+            continue;
+        }
+        auto& definition = definitions.at(i);
+        if (!definition.has_default_value()) {
+            throw std::invalid_argument("Missing valid argument: " + definition.name());
+        }
+        arguments.at(i).reset_value(definition);
+    }
+}
+
 void McpServer::DoToolCall(int id, const std::string& tool_name, const cJSON* tool_arguments) {
-    auto tool_iter = std::find_if(tools_.begin(), tools_.end(), 
-                                 [&tool_name](const McpTool* tool) { 
-                                     return tool->name() == tool_name; 
-                                 });
-    
-    if (tool_iter == tools_.end()) {
+    auto tool_iter = tools_by_name_.find(tool_name);
+    if (tool_iter == tools_by_name_.end()) {
         ESP_LOGE(TAG, "tools/call: Unknown tool: %s", tool_name.c_str());
         ReplyError(id, "Unknown tool: " + tool_name);
         return;
     }
 
-    PropertyList arguments = (*tool_iter)->properties();
+    McpTool* tool = tool_iter->second;
+    PropertyList* arguments = tool->AcquireArguments();
     try {
-        for (auto& argument : arguments) {
-            bool found = false;
-            if (cJSON_IsObject(tool_arguments)) {
-                auto value = cJSON_GetObjectItem(tool_arguments, argument.name().c_str());
-                if (argument.type() == kPropertyTypeBoolean && cJSON_IsBool(value)) {
-                    argument.set_value<bool>(value->valueint == 1);
-                    found = true;
-                } else if (argument.type() == kPropertyTypeInteger && cJSON_IsNumber(value)) {
-                    argument.set_value<int>(value->valueint);
-                    found = true;
-                } else if (argument.type() == kPropertyTypeString && cJSON_IsString(value)) {
-                    argument.set_value<std::string>(value->valuestring);
-                    found = true;
-                }
-            }
-
-            if (!argument.has_default_value() && !found) {
-                ESP_LOGE(TAG, "tools/call: Missing valid argument: %s", argument.name().c_str());
-                ReplyError(id, "Missing valid argument: " + argument.name());
-                return;
-            }
-        }
+        BindArguments(tool, *arguments, tool_arguments);
     } catch (const std::exception& e) {
+        tool->ReleaseArguments(arguments);
         ESP_LOGE(TAG, "tools/call: %s", e.what());
         ReplyError(id, e.what());
         return;
     }
 
+    auto call = std::make_shared<McpToolCall>();
+    call->id = id;
+    call->tool = tool;
+    call->arguments = arguments;
+    call->deadline_us = esp_timer_get_time() + (int64_t)tool->timeout_ms() * 1000;
+    {
+        std::lock_guard<std::mutex> lock(calls_mutex_);
+        const char* refused = nullptr;
+        if (active_calls_.find(id) != active_calls_.end()) {
+            refused = "Request id already in use";
+        } else if (!tool->main_thread_only() && pending_calls_.size() >= MCP_MAX_PENDING_CALLS) {
+            refused = "Too many tool calls in progress";
+        }
+        if (refused != nullptr) {
+            tool->ReleaseArguments(arguments);
+            ESP_LOGE(TAG, "tools/call: %s", refused);
+            ReplyError(id, refused);
+            return;
+        }
+        active_calls_[id] = call;
+        if (!esp_timer_is_active(timeout_timer_)) {
+            esp_timer_start_periodic(timeout_timer_, MCP_TIMEOUT_CHECK_INTERVAL_MS * 1000);
+        }
+        if (!tool->main_thread_only()) {
+            StartWorkers();
+            pending_calls_.push_back(call);
+            calls_cv_.notify_one();
+            return;
+        }
+    }
+
     // Use main thread to call the tool
     auto& app = Application::GetInstance();
-    app.Schedule([this, id, tool_iter, arguments = std::move(arguments)]() {
+    app.Schedule([this, call]() {
+        RunToolCall(call);
+    });
+}
+
+void McpServer::RunToolCall(const std::shared_ptr<McpToolCall>& call) {
+    bool finished;
+    {
+        std::lock_guard<std::mutex> lock(calls_mutex_);
+        finished = call->finished;
+    }
+
+    std::string result;
+    std::string attachment;
+    std::string error;
+    if (!finished) {
         try {
-            ReplyResult(id, (*tool_iter)->Call(arguments));
+            // Images are kept raw, the main task embeds them as base64 if the transport has no attachments
+            result = call->tool->Call(*call->arguments, &attachment);
         } catch (const std::exception& e) {
-            ESP_LOGE(TAG, "tools/call: %s", e.what());
-            ReplyError(id, e.what());
+            error = e.what();
         }
-    });
+    }
+    call->tool->ReleaseArguments(call->arguments);
+    call->arguments = nullptr;
+
+    {
+        std::lock_guard<std::mutex> lock(calls_mutex_);
+        if (call->finished) {
+            if (!finished) {
+                ESP_LOGW(TAG, "tools/call: Dropped the result of request %d", call->id);
+            }
+            return;
+        }
+        call->finished = true;
+        active_calls_.erase(call->id);
+    }
+
+    if (!error.empty()) {
+        ESP_LOGE(TAG, "tools/call: %s", error.c_str());
+        ReplyError(call->id, error);
+    } else if (!attachment.empty()) {
+        ReplyResult(call->id, result, std::move(attachment));
+    } else {
+        ReplyResult(call->id, result);
+    }
+}
+
+void McpServer::CancelToolCall(int id, const std::string& reason) {
+    // A call that is already running cannot be stopped, only its result is dropped
+    std::lock_guard<std::mutex> lock(calls_mutex_);
+    auto it = active_calls_.find(id);
+    if (it == active_calls_.end()) {
+        return;
+    }
+    ESP_LOGI(TAG, "tools/call: Request %d cancelled: %s", id, reason.c_str());
+    it->second->finished = true;
+    active_calls_.erase(it);
+}
+
+void McpServer::CheckToolCallTimeouts() {
+    std::vector<int> expired;
+    {
+        std::lock_guard<std::mutex> lock(calls_mutex_);
+        int64_t now = esp_timer_get_time();
+        for (auto it = active_calls_.begin(); it != active_calls_.end();) {
+            if (it->second->deadline_us <= now) {
+                it->second->finished = true;
+                expired.push_back(it->first);
+                it = active_calls_.erase(it);
+            } else {
+                ++it;
+            }
+        }
+        if (active_calls_.empty()) {
+            esp_timer_stop(timeout_timer_);
+        }
+    }
+    for (int id : expired) {
+        ESP_LOGE(TAG, "tools/call: Request %d timed out", id);
+        ReplyError(id, "Tool call timed out");
+    }
+}
+
+void McpServer::StartWorkers() {
+    // Only boards with tools that leave the main thread pay for the worker stacks
+    if (!workers_.empty()) {
+        return;
+    }
+    for (int i = 0; i < MCP_WORKER_COUNT; i++) {
+        TaskHandle_t handle = nullptr;
+        xTaskCreate([](void* arg) {
+            McpServer* server = (McpServer*)arg;
+            server->WorkerTask();
+            vTaskDelete(NULL);
+        }, "mcp_worker", MCP_WORKER_STACK_SIZE, this, 2, &handle);
+        workers_.push_back(handle);
+    }
+}
+
+void McpServer::WorkerTask() {
+    while (true) {
+        std::shared_ptr<McpToolCall> call;
+        {
+            // The oldest call whose tool is not running on the other worker, the tools are not reentrant
+            std::unique_lock<std::mutex> lock(calls_mutex_);
+            auto it = pending_calls_.end();
+            calls_cv_.wait(lock, [this, &it]() {
+                it = std::find_if(pending_calls_.begin(), pending_calls_.end(), [this](const auto& pending) {
+                    return running_tools_.find(pending->tool) == running_tools_.end();
+                });
+                return it != pending_calls_.end();
+            });
+            call = std::move(*it);
+            pending_calls_.erase(it);
+            running_tools_.insert(call->tool);
+        }
+        RunToolCall(call);
+        {
+            std::lock_guard<std::mutex> lock(calls_mutex_);
+            running_tools_.erase(call->tool);
+        }
+        // A call of the same tool may be waiting for this one
+        calls_cv_.notify_all();
+    }
 }
@@ -2,20 +2,32 @@
 #define MCP_SERVER_H
 
 #include <string>
+#include <string_view>
 #include <vector>
 #include <map>
+#include <set>
+#include <unordered_map>
+#include <algorithm>
+#include <memory>
 #include <functional>
 #include <variant>
 #include <optional>
 #include <stdexcept>
 #include <thread>
+#include <mutex>
+#include <deque>
+#include <condition_variable>
 #include <mbedtls/base64.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <esp_timer.h>
 
 #include <cJSON.h>
+#include <strings.h>
 
 class ImageContent {
 private:
-    std::string encoded_data_;
+    std::string data_;
     std::string mime_type_;
 
     static std::string Base64Encode(const std::string& data) {
@@ -27,17 +39,19 @@ private:
     }
 
 public:
-    ImageContent(const std::string& mime_type, const std::string& data) {
-        mime_type_ = mime_type;
-        // base64 encode data
-        encoded_data_ = Base64Encode(data);
-    }
+    // The raw data is kept, it is only base64 encoded when it goes out as JSON
+    ImageContent(const std::string& mime_type, std::string data)
+        : data_(std::move(data)), mime_type_(mime_type) {}
+
+    inline const std::string& mime_type() const { return mime_type_; }
+    // Hands the raw data over to be sent as an attachment
+    std::string TakeData() { return std::move(data_); }
 
     std::string to_json() const {
         cJSON *json = cJSON_CreateObject();
         cJSON_AddStringToObject(json, "type", "image");
         cJSON_AddStringToObject(json, "mimeType", mime_type_.c_str());
-        cJSON_AddStringToObject(json, "data", encoded_data_.c_str());
+        cJSON_AddStringToObject(json, "data", Base64Encode(data_).c_str());
         char* json_str = cJSON_PrintUnformatted(json);
         std::string result(json_str);
         cJSON_free(json_str);
@@ -96,6 +110,8 @@ public:
 
     inline const std::string& name() const { return name_; }
     inline PropertyType type() const { return type_; }
+    // Restores the default value of a reused argument from its definition
+    inline void reset_value(const Property& definition) { value_ = definition.value_; }
     inline bool has_default_value() const { return has_default_value_; }
     inline bool has_range() const { return min_value_.has_value() && max_value_.has_value(); }
     inline int min_value() const { return min_value_.value_or(0); }
@@ -120,7 +136,7 @@ public:
         value_ = value;
     }
 
-    std::string to_json() const {
+    cJSON* CreateJson() const {
         cJSON *json = cJSON_CreateObject();
         
         if (type_ == kPropertyTypeBoolean) {
@@ -145,7 +161,11 @@ public:
                 cJSON_AddStringToObject(json, "default", value<std::string>().c_str());
             }
         }
-        
+        return json;
+    }
+
+    std::string to_json() const {
+        cJSON *json = CreateJson();
         char *json_str = cJSON_PrintUnformatted(json);
         std::string result(json_str);
         cJSON_free(json_str);
@@ -177,6 +197,11 @@ public:
 
     auto begin() { return properties_.begin(); }
     auto end() { return properties_.end(); }
+    auto begin() const { return properties_.begin(); }
+    auto end() const { return properties_.end(); }
+    inline size_t size() const { return properties_.size(); }
+    inline Property& at(size_t index) { return properties_[index]; }
+    inline const Property& at(size_t index) const { return properties_[index]; }
 
     std::vector<std::string> GetRequired() const {
         std::vector<std::string> required;
@@ -188,14 +213,16 @@ public:
         return required;
     }
 
-    std::string to_json() const {
+    cJSON* CreateJson() const {
         cJSON *json = cJSON_CreateObject();
-        
         for (const auto& property : properties_) {
-            cJSON *prop_json = cJSON_Parse(property.to_json().c_str());
-            cJSON_AddItemToObject(json, property.name().c_str(), prop_json);
+            cJSON_AddItemToObject(json, property.name().c_str(), property.CreateJson());
         }
-        
+        return json;
+    }
+
+    std::string to_json() const {
+        cJSON *json = CreateJson();
         char *json_str = cJSON_PrintUnformatted(json);
         std::string result(json_str);
         cJSON_free(json_str);
@@ -205,6 +232,9 @@ public:
     }
 };
 
+// Time a tool call may take before the request is answered with an error
+#define MCP_DEFAULT_TOOL_TIMEOUT_MS 30000
+
 class McpTool {
 private:
     std::string name_;
@@ -212,6 +242,14 @@ private:
     PropertyList properties_;
     std::function<ReturnValue(const PropertyList&)> callback_;
     bool user_only_ = false;
+    bool main_thread_only_ = true;
+    int timeout_ms_ = MCP_DEFAULT_TOOL_TIMEOUT_MS;
+
+    // Property indexes sorted by name ignoring case, built once so that arguments bind without scanning
+    std::vector<std::pair<std::string_view, size_t>> property_index_;
+    // Argument frames of finished calls, reused instead of copying the property definitions
+    std::mutex frames_mutex_;
+    std::vector<std::unique_ptr<PropertyList>> free_frames_;
 
 public:
     McpTool(const std::string& name, 
@@ -221,13 +259,63 @@ public:
         : name_(name), 
         description_(description), 
         properties_(properties), 
-        callback_(callback) {}
+        callback_(callback) {
+        if (properties_.size() > 64) {
+            throw std::invalid_argument("Too many properties");
+        }
+        for (size_t i = 0; i < properties_.size(); i++) {
+            property_index_.emplace_back(properties_.at(i).name(), i);
+        }
+        std::stable_sort(property_index_.begin(), property_index_.end(), [](const auto& a, const auto& b) {
+            return CompareNames(a.first, b.first) < 0;
+        });
+    }
+
+    // Case-insensitive like cJSON_GetObjectItem, which the arguments were looked up with before
+    static int CompareNames(std::string_view a, std::string_view b) {
+        int result = strncasecmp(a.data(), b.data(), std::min(a.size(), b.size()));
+        if (result != 0) {
+            return result;
+        }
+        return a.size() < b.size() ? -1 : a.size() > b.size() ? 1 : 0;
+    }
+
+    // Index of the property, -1 if the tool has none of that name
+    int FindProperty(std::string_view name) const {
+        auto it = std::lower_bound(property_index_.begin(), property_index_.end(), name,
+            [](const auto& entry, std::string_view name) { return CompareNames(entry.first, name) < 0; });
+        if (it == property_index_.end() || CompareNames(it->first, name) != 0) {
+            return -1;
+        }
+        return it->second;
+    }
+
+    // A frame for the arguments of one call, it holds the values of the previous call
+    PropertyList* AcquireArguments() {
+        std::lock_guard<std::mutex> lock(frames_mutex_);
+        if (free_frames_.empty()) {
+            return new PropertyList(properties_);
+        }
+        auto frame = free_frames_.back().release();
+        free_frames_.pop_back();
+        return frame;
+    }
+
+    void ReleaseArguments(PropertyList* frame) {
+        std::lock_guard<std::mutex> lock(frames_mutex_);
+        free_frames_.emplace_back(frame);
+    }
 
     void set_user_only(bool user_only) { user_only_ = user_only; }
+    // Tools that do not touch state owned by the main task may run on the MCP workers
+    void set_main_thread_only(bool main_thread_only) { main_thread_only_ = main_thread_only; }
+    void set_timeout_ms(int timeout_ms) { timeout_ms_ = timeout_ms; }
     inline const std::string& name() const { return name_; }
     inline const std::string& description() const { return description_; }
     inline const PropertyList& properties() const { return properties_; }
     inline bool user_only() const { return user_only_; }
+    inline bool main_thread_only() const { return main_thread_only_; }
+    inline int timeout_ms() const { return timeout_ms_; }
 
     std::string to_json() const {
         std::vector<std::string> required = properties_.GetRequired();
@@ -239,8 +327,7 @@ public:
         cJSON *input_schema = cJSON_CreateObject();
         cJSON_AddStringToObject(input_schema, "type", "object");
         
-        cJSON *properties = cJSON_Parse(properties_.to_json().c_str());
-        cJSON_AddItemToObject(input_schema, "properties", properties);
+        cJSON_AddItemToObject(input_schema, "properties", properties_.CreateJson());
         
         if (!required.empty()) {
             cJSON *required_array = cJSON_CreateArray();
@@ -269,7 +356,11 @@ public:
         return result;
     }
 
-    std::string Call(const PropertyList& properties) {
+    /*
+     * When attachment is given, an image result is moved into it and its content item refers to
+     * it by offset and size. Otherwise the image is embedded as base64.
+     */
+    std::string Call(const PropertyList& properties, std::string* attachment = nullptr) {
         ReturnValue return_value = callback_(properties);
         // 返回结果
         cJSON* result = cJSON_CreateObject();
@@ -279,7 +370,16 @@ public:
             auto image_content = std::get<ImageContent*>(return_value);
             cJSON* image = cJSON_CreateObject();
             cJSON_AddStringToObject(image, "type", "image");
-            cJSON_AddStringToObject(image, "image", image_content->to_json().c_str());
+            if (attachment != nullptr) {
+                *attachment = image_content->TakeData();
+                cJSON_AddStringToObject(image, "mimeType", image_content->mime_type().c_str());
+                cJSON* reference = cJSON_CreateObject();
+                cJSON_AddNumberToObject(reference, "offset", 0);
+                cJSON_AddNumberToObject(reference, "size", attachment->size());
+                cJSON_AddItemToObject(image, "attachment", reference);
+            } else {
+                cJSON_AddStringToObject(image, "image", image_content->to_json().c_str());
+            }
             cJSON_AddItemToArray(content, image);
             delete image_content;
         } else {
@@ -311,6 +411,24 @@ public:
     }
 };
 
+// Tasks that run the tools which are not main thread only
+#define MCP_WORKER_COUNT 2
+// The tools ran on the main task before, so the workers get at least its stack
+#define MCP_WORKER_STACK_SIZE std::max(1024 * 8, CONFIG_ESP_MAIN_TASK_STACK_SIZE)
+// Calls waiting for a worker, more are refused
+#define MCP_MAX_PENDING_CALLS 8
+#define MCP_TIMEOUT_CHECK_INTERVAL_MS 200
+
+// A tools/call request from its arguments being bound to its reply
+struct McpToolCall {
+    int id;
+    McpTool* tool;
+    PropertyList* arguments;
+    int64_t deadline_us;
+    // Set once the request has been answered, cancelled or timed out, any later result is dropped
+    bool finished = false;
+};
+
 class McpServer {
 public:
     static McpServer& GetInstance() {
@@ -333,12 +451,43 @@ private:
     void ParseCapabilities(const cJSON* capabilities);
 
     void ReplyResult(int id, const std::string& result);
+    void ReplyResult(int id, const std::string& result, std::string&& attachment);
     void ReplyError(int id, const std::string& message);
 
     void GetToolsList(int id, const std::string& cursor, bool list_user_only_tools);
+    void BuildToolsListCache();
     void DoToolCall(int id, const std::string& tool_name, const cJSON* tool_arguments);
+    void BindArguments(const McpTool* tool, PropertyList& arguments, const cJSON* tool_arguments);
+    void RunToolCall(const std::shared_ptr<McpToolCall>& call);
+    void CancelToolCall(int id, const std::string& reason);
+    void CheckToolCallTimeouts();
+    void StartWorkers();
+    void WorkerTask();
 
     std::vector<McpTool*> tools_;
+    // Lookup by name, the keys are views of the tool names
+    std::unordered_map<std::string_view, McpTool*> tools_by_name_;
+
+    // Calls that have not been answered yet, by request id
+    std::mutex calls_mutex_;
+    std::condition_variable calls_cv_;
+    std::map<int, std::shared_ptr<McpToolCall>> active_calls_;
+    std::deque<std::shared_ptr<McpToolCall>> pending_calls_;
+    // Tools a worker is running, a tool never runs on two workers at once
+    std::set<const McpTool*> running_tools_;
+    std::vector<TaskHandle_t> workers_;
+    esp_timer_handle_t timeout_timer_ = nullptr;
+
+    /*
+     * tools/list cache: the JSON of every tool, separated by commas, with the tools visible to the
+     * AI first so that they are a prefix of the full list. A page is a single slice of it. The
+     * cache is rebuilt on the first tools/list after the tools change.
+     */
+    std::mutex tools_list_mutex_;
+    bool tools_list_dirty_ = true;
+    std::string tools_list_json_;
+    std::vector<std::pair<const McpTool*, size_t>> tools_list_index_;  // Tool and its offset
+    size_t tools_list_regular_count_ = 0;
 };
 
 #endif // MCP_SERVER_H
@@ -2,6 +2,7 @@
 #include "system_info.h"
 #include "settings.h"
 #include "assets/lang_config.h"
+#include "flash_stream_writer.h"
 
 #include <cJSON.h>
 #include <esp_log.h>
@@ -21,6 +22,12 @@
 
 #define TAG "Ota"
 
+// Buffers between the download and the flash writer task
+#define OTA_CHUNK_SIZE (16 * 1024)
+#define OTA_CHUNK_COUNT 4
+// Range requests after a dropped connection before giving up, 0 disables resuming
+#define OTA_MAX_RESUME_RETRIES 3
+
 
 Ota::Ota() {
 #ifdef ESP_EFUSE_BLOCK_USR_DATA
@@ -264,6 +271,7 @@ void Ota::MarkCurrentVersionValid() {
 bool Ota::Upgrade(const std::string& firmware_url, std::function<void(int progress, size_t speed)> callback) {
     ESP_LOGI(TAG, "Upgrading firmware from %s", firmware_url.c_str());
     esp_ota_handle_t update_handle = 0;
+    bool ota_begun = false;
     auto update_partition = esp_ota_get_next_update_partition(NULL);
     if (update_partition == NULL) {
         ESP_LOGE(TAG, "Failed to get update partition");
@@ -271,83 +279,162 @@ bool Ota::Upgrade(const std::string& firmware_url, std::function<void(int progre
     }
 
     ESP_LOGI(TAG, "Writing to partition %s at offset 0x%lx", update_partition->label, update_partition->address);
-    bool image_header_checked = false;
-    std::string image_header;
-
-    auto network = Board::GetInstance().GetNetwork();
-    auto http = network->CreateHttp(0);
-    if (!http->Open("GET", firmware_url)) {
-        ESP_LOGE(TAG, "Failed to open HTTP connection");
-        return false;
-    }
-
-    if (http->GetStatusCode() != 200) {
-        ESP_LOGE(TAG, "Failed to get firmware, status code: %d", http->GetStatusCode());
-        return false;
-    }
-
-    size_t content_length = http->GetBodyLength();
-    if (content_length == 0) {
-        ESP_LOGE(TAG, "Failed to get content length");
+    const size_t image_header_size = sizeof(esp_image_header_t) + sizeof(esp_image_segment_header_t) + sizeof(esp_app_desc_t);
+
+    // esp_ota_write erases and programs the flash in the writer task while the next chunk downloads
+    FlashStreamWriter writer(OTA_CHUNK_SIZE, OTA_CHUNK_COUNT, [&update_handle](size_t offset, const char* data, size_t size) {
+        return esp_ota_write(update_handle, data, size);
+    });
+    if (!writer.Start()) {
+        ESP_LOGE(TAG, "Failed to start the flash writer");
         return false;
     }
 
-    char buffer[512];
+    auto network = Board::GetInstance().GetNetwork();
+    size_t content_length = 0;
     size_t total_read = 0, recent_read = 0;
+    int failures = 0;
+    FlashStreamStats last_stats;
     auto last_calc_time = esp_timer_get_time();
-    while (true) {
-        int ret = http->Read(buffer, sizeof(buffer));
-        if (ret < 0) {
-            ESP_LOGE(TAG, "Failed to read HTTP data: %s", esp_err_to_name(ret));
-            return false;
-        }
+    bool download_failed = false;
 
-        // Calculate speed and progress every second
-        recent_read += ret;
-        total_read += ret;
-        if (esp_timer_get_time() - last_calc_time >= 1000000 || ret == 0) {
-            size_t progress = total_read * 100 / content_length;
-            ESP_LOGI(TAG, "Progress: %u%% (%u/%u), Speed: %uB/s", progress, total_read, content_length, recent_read);
-            if (callback) {
-                callback(progress, recent_read);
+    while (!download_failed && (content_length == 0 || total_read < content_length)) {
+        if (content_length != 0) {
+            if (++failures > OTA_MAX_RESUME_RETRIES) {
+                ESP_LOGE(TAG, "Download interrupted at %u/%u bytes", total_read, content_length);
+                break;
             }
-            last_calc_time = esp_timer_get_time();
-            recent_read = 0;
+            ESP_LOGW(TAG, "Download interrupted at %u/%u bytes, resuming (%d/%d)", total_read, content_length,
+                failures, OTA_MAX_RESUME_RETRIES);
+            vTaskDelay(pdMS_TO_TICKS(1000 * failures));
+        }
+
+        auto http = network->CreateHttp(0);
+        if (total_read > 0) {
+            http->SetHeader("Range", "bytes=" + std::to_string(total_read) + "-");
+        }
+        if (!http->Open("GET", firmware_url)) {
+            ESP_LOGE(TAG, "Failed to open HTTP connection");
+            download_failed = content_length == 0;
+            continue;
         }
 
-        if (ret == 0) {
+        if (content_length == 0) {
+            if (http->GetStatusCode() != 200) {
+                ESP_LOGE(TAG, "Failed to get firmware, status code: %d", http->GetStatusCode());
+                download_failed = true;
+                continue;
+            }
+            content_length = http->GetBodyLength();
+            if (content_length == 0) {
+                ESP_LOGE(TAG, "Failed to get content length");
+                download_failed = true;
+                continue;
+            }
+        } else if (http->GetStatusCode() != 206 || http->GetBodyLength() != content_length - total_read) {
+            ESP_LOGE(TAG, "The server cannot resume the download, status code: %d", http->GetStatusCode());
             break;
         }
 
-        if (!image_header_checked) {
-            image_header.append(buffer, ret);
-            if (image_header.size() >= sizeof(esp_image_header_t) + sizeof(esp_image_segment_header_t) + sizeof(esp_app_desc_t)) {
+        size_t resumed_at = total_read;
+        while (total_read < content_length) {
+            char* chunk = writer.AcquireChunk();
+            if (chunk == nullptr) {
+                download_failed = true;
+                break;
+            }
+
+            size_t chunk_offset = total_read;
+            size_t chunk_limit = std::min(writer.chunk_size(), content_length - chunk_offset);
+            size_t filled = 0;
+            int ret = 0;
+            while (filled < chunk_limit) {
+                ret = http->Read(chunk + filled, chunk_limit - filled);
+                if (ret <= 0) {
+                    break;
+                }
+                filled += ret;
+            }
+
+            // The first chunk holds the image header, the OTA begins once it has been checked
+            if (!ota_begun && filled > 0) {
+                if (filled < image_header_size) {
+                    ESP_LOGE(TAG, "Failed to read the image header");
+                    writer.ReleaseChunk(chunk);
+                    download_failed = true;
+                    break;
+                }
                 esp_app_desc_t new_app_info;
-                memcpy(&new_app_info, image_header.data() + sizeof(esp_image_header_t) + sizeof(esp_image_segment_header_t), sizeof(esp_app_desc_t));
-                
+                memcpy(&new_app_info, chunk + sizeof(esp_image_header_t) + sizeof(esp_image_segment_header_t), sizeof(esp_app_desc_t));
+
                 auto current_version = esp_app_get_description()->version;
                 ESP_LOGI(TAG, "Current version: %s, New version: %s", current_version, new_app_info.version);
 
                 if (esp_ota_begin(update_partition, OTA_WITH_SEQUENTIAL_WRITES, &update_handle)) {
                     esp_ota_abort(update_handle);
                     ESP_LOGE(TAG, "Failed to begin OTA");
+                    writer.ReleaseChunk(chunk);
                     return false;
                 }
+                ota_begun = true;
+            }
+
+            if (filled > 0) {
+                writer.SubmitChunk(chunk, chunk_offset, filled);
+            } else {
+                writer.ReleaseChunk(chunk);
+            }
+            total_read += filled;
+            recent_read += filled;
+
+            // Calculate network and flash speed and progress every second
+            if (esp_timer_get_time() - last_calc_time >= 1000000 || total_read == content_length) {
+                auto stats = writer.GetStats();
+                int64_t write_us = stats.write_us - last_stats.write_us;
+                size_t flash_speed = write_us > 0 ? (stats.bytes - last_stats.bytes) * 1000000LL / write_us : 0;
+                size_t progress = total_read * 100 / content_length;
+                ESP_LOGI(TAG, "Progress: %u%% (%u/%u), Network: %uB/s, Flash: %uB/s, Waited for flash: %dms",
+                    progress, total_read, content_length, recent_read, flash_speed,
+                    int((stats.chunk_wait_us - last_stats.chunk_wait_us) / 1000));
+                if (callback) {
+                    callback(progress, recent_read);
+                }
+                last_stats = stats;
+                last_calc_time = esp_timer_get_time();
+                recent_read = 0;
+            }
 
-                image_header_checked = true;
-                std::string().swap(image_header);
+            if (ret < 0) {
+                ESP_LOGE(TAG, "Failed to read HTTP data: %s", esp_err_to_name(ret));
+                break;
+            }
+            if (ret == 0 && filled < chunk_limit) {
+                break;
             }
         }
-        auto err = esp_ota_write(update_handle, buffer, ret);
+        http->Close();
+
+        if (total_read > resumed_at) {
+            failures = 0;
+        }
+    }
+
+    // The writer must be idle before the OTA handle is ended or aborted
+    esp_err_t err = writer.Flush();
+    auto stats = writer.GetStats();
+    ESP_LOGI(TAG, "Flash written: %u bytes in %d ms, waited for flash: %d ms", stats.bytes,
+        int(stats.write_us / 1000), int(stats.chunk_wait_us / 1000));
+    if (download_failed || err != ESP_OK || total_read != content_length || stats.bytes != content_length) {
         if (err != ESP_OK) {
             ESP_LOGE(TAG, "Failed to write OTA data: %s", esp_err_to_name(err));
+        }
+        if (ota_begun) {
             esp_ota_abort(update_handle);
-            return false;
         }
+        return false;
     }
-    http->Close();
 
-    esp_err_t err = esp_ota_end(update_handle);
+    err = esp_ota_end(update_handle);
     if (err != ESP_OK) {
         if (err == ESP_ERR_OTA_VALIDATE_FAILED) {
             ESP_LOGE(TAG, "Image validation failed, image is corrupted");
@@ -0,0 +1,92 @@
+#include "audio_sequence_tracker.h"
+
+#include <esp_log.h>
+#include <cstdlib>
+#include <algorithm>
+
+#define TAG "AudioSequenceTracker"
+
+// A jump this far ahead is taken as a restarted stream rather than lost audio
+#define AUDIO_SEQUENCE_MAX_GAP 1000
+
+void AudioSequenceTracker::Reset(int frame_duration_ms) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stats_ = AudioTransportStats();
+    frame_duration_us_ = frame_duration_ms > 0 ? frame_duration_ms * 1000 : 60000;
+    started_ = false;
+    window_ = 0;
+    window_span_ = 0;
+    jitter_us_ = 0;
+}
+
+uint64_t AudioSequenceTracker::MissingInWindow() const {
+    uint64_t valid = window_span_ >= 64 ? ~0ULL : ((1ULL << window_span_) - 1);
+    return ~window_ & valid;
+}
+
+void AudioSequenceTracker::Add(uint32_t sequence, int64_t arrival_us) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stats_.received++;
+
+    if (started_) {
+        // RFC 3550: the difference between the arrival spacing and the sending spacing
+        int64_t transit = (arrival_us - last_arrival_us_) -
+            (int64_t)(int32_t)(sequence - last_sequence_) * frame_duration_us_;
+        jitter_us_ += (std::llabs(transit) - jitter_us_) / 16;
+        stats_.jitter_us = jitter_us_;
+    }
+    last_sequence_ = sequence;
+    last_arrival_us_ = arrival_us;
+
+    int32_t delta = (int32_t)(sequence - highest_sequence_);
+    if (!started_ || delta > AUDIO_SEQUENCE_MAX_GAP) {
+        if (started_) {
+            ESP_LOGW(TAG, "Sequence jumped from %lu to %lu", (unsigned long)highest_sequence_, (unsigned long)sequence);
+        }
+        started_ = true;
+        highest_sequence_ = sequence;
+        window_ = 1;
+        window_span_ = 1;
+        return;
+    }
+
+    if (delta > 0) {
+        // The oldest sequence numbers leave the window, those never received are lost
+        uint64_t missing = MissingInWindow();
+        if (delta >= AUDIO_REORDER_WINDOW) {
+            stats_.lost += __builtin_popcountll(missing) + (delta - AUDIO_REORDER_WINDOW);
+            window_ = 1;
+        } else {
+            stats_.lost += __builtin_popcountll(missing >> (AUDIO_REORDER_WINDOW - delta));
+            window_ = (window_ << delta) | 1;
+        }
+        window_span_ = std::min<uint32_t>(window_span_ + delta, AUDIO_REORDER_WINDOW);
+        highest_sequence_ = sequence;
+    } else if (delta == 0) {
+        stats_.duplicates++;
+    } else if (-delta < AUDIO_REORDER_WINDOW) {
+        uint64_t bit = 1ULL << -delta;
+        if (window_ & bit) {
+            stats_.duplicates++;
+        } else {
+            window_ |= bit;
+            if ((uint32_t)-delta >= window_span_) {
+                window_span_ = -delta + 1;
+            }
+            stats_.reordered++;
+        }
+    } else {
+        // Already counted as lost when it left the window
+        if (stats_.lost > 0) {
+            stats_.lost--;
+        }
+        stats_.late++;
+    }
+}
+
+AudioTransportStats AudioSequenceTracker::GetStats() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    AudioTransportStats stats = stats_;
+    stats.lost += __builtin_popcountll(MissingInWindow());
+    return stats;
+}
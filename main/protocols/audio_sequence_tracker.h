@@ -0,0 +1,51 @@
+#ifndef AUDIO_SEQUENCE_TRACKER_H
+#define AUDIO_SEQUENCE_TRACKER_H
+
+#include <mutex>
+#include <cstdint>
+
+// Sequence numbers remembered behind the highest one received
+#define AUDIO_REORDER_WINDOW 64
+
+// Receive statistics of one audio session
+struct AudioTransportStats {
+    uint32_t received = 0;
+    uint32_t lost = 0;          // Not received, including those that may still arrive out of order
+    uint32_t duplicates = 0;
+    uint32_t reordered = 0;     // Arrived after a later packet, within the reorder window
+    uint32_t late = 0;          // Arrived after falling out of the reorder window
+    uint32_t jitter_us = 0;     // Inter-arrival jitter (RFC 3550) against the frame duration
+};
+
+/*
+ * Classifies the packets of a sequenced audio stream as they arrive.
+ *
+ * A bitmap remembers which of the last AUDIO_REORDER_WINDOW sequence numbers were seen, so a
+ * packet that arrives out of order is told apart from a duplicate, and a gap is only lost for
+ * good once it falls out of the window. The tracker only counts: packets are passed on as they
+ * arrive and the jitter buffer in AudioService puts them back in order.
+ */
+class AudioSequenceTracker {
+public:
+    // Starts a new session, its packets are expected every frame_duration_ms
+    void Reset(int frame_duration_ms);
+    // Called from the receive task for every packet
+    void Add(uint32_t sequence, int64_t arrival_us);
+    AudioTransportStats GetStats() const;
+
+private:
+    mutable std::mutex mutex_;
+    AudioTransportStats stats_;
+    int64_t frame_duration_us_ = 60000;
+    bool started_ = false;
+    uint32_t highest_sequence_ = 0;
+    uint64_t window_ = 0;           // Bit n is set when highest_sequence_ - n was received
+    uint32_t window_span_ = 0;      // Bits of window_ that belong to the stream
+    uint32_t last_sequence_ = 0;
+    int64_t last_arrival_us_ = 0;
+    int64_t jitter_us_ = 0;
+
+    uint64_t MissingInWindow() const;
+};
+
+#endif // AUDIO_SEQUENCE_TRACKER_H
@@ -12,6 +12,7 @@
 
 MqttProtocol::MqttProtocol() {
     event_group_handle_ = xEventGroupCreate();
+    mbedtls_aes_init(&aes_ctx_);
 
     // Initialize reconnect timer
     esp_timer_create_args_t reconnect_timer_args = {
@@ -46,6 +47,7 @@ MqttProtocol::~MqttProtocol() {
 
     udp_.reset();
     mqtt_.reset();
+    mbedtls_aes_free(&aes_ctx_);
     
     if (event_group_handle_ != nullptr) {
         vEventGroupDelete(event_group_handle_);
@@ -167,25 +169,49 @@ bool MqttProtocol::SendAudio(std::unique_ptr<AudioStreamPacket> packet) {
     if (udp_ == nullptr) {
         return false;
     }
+    return SendAudioDatagram(*packet);
+}
 
-    std::string nonce(aes_nonce_);
-    *(uint16_t*)&nonce[2] = htons(packet->payload.size());
-    *(uint32_t*)&nonce[8] = htonl(packet->timestamp);
-    *(uint32_t*)&nonce[12] = htonl(++local_sequence_);
+size_t MqttProtocol::SendAudioBatch(std::unique_ptr<AudioStreamPacket>* packets, size_t count) {
+    // Every packet is still its own datagram, the batch only takes the channel lock once
+    std::lock_guard<std::mutex> lock(channel_mutex_);
+    for (size_t i = 0; i < count; i++) {
+        if (udp_ == nullptr || !SendAudioDatagram(*packets[i])) {
+            return i;
+        }
+        packets[i].reset();
+    }
+    return count;
+}
 
-    std::string encrypted;
-    encrypted.resize(aes_nonce_.size() + packet->payload.size());
-    memcpy(encrypted.data(), nonce.data(), nonce.size());
+// Called with channel_mutex_ held
+bool MqttProtocol::SendAudioDatagram(const AudioStreamPacket& packet) {
+    const uint8_t* payload = packet.payload.data() + packet.headroom;
+    size_t payload_size = packet.payload.size() - packet.headroom;
+
+    /*
+     * Udp::Send() takes a std::string, so the datagram is built in a buffer that is kept across
+     * packets: the nonce header goes in front and AES-CTR writes the ciphertext right behind it.
+     */
+    udp_send_buffer_.resize(sizeof(aes_nonce_) + payload_size);
+    auto nonce = (uint8_t*)udp_send_buffer_.data();
+    memcpy(nonce, aes_nonce_, sizeof(aes_nonce_));
+    *(uint16_t*)&nonce[2] = htons(payload_size);
+    *(uint32_t*)&nonce[8] = htonl(packet.timestamp);
+    *(uint32_t*)&nonce[12] = htonl(++local_sequence_);
 
+    // The counter block is updated by the cipher, so it starts from a copy of the nonce
+    uint8_t nonce_counter[16];
+    memcpy(nonce_counter, nonce, sizeof(nonce_counter));
     size_t nc_off = 0;
     uint8_t stream_block[16] = {0};
-    if (mbedtls_aes_crypt_ctr(&aes_ctx_, packet->payload.size(), &nc_off, (uint8_t*)nonce.c_str(), stream_block,
-        (uint8_t*)packet->payload.data(), (uint8_t*)&encrypted[nonce.size()]) != 0) {
+    if (mbedtls_aes_crypt_ctr(&aes_ctx_, payload_size, &nc_off, nonce_counter, stream_block,
+        payload, nonce + sizeof(aes_nonce_)) != 0) {
         ESP_LOGE(TAG, "Failed to encrypt audio data");
         return false;
     }
 
-    return udp_->Send(encrypted) > 0;
+    return udp_->Send(udp_send_buffer_) > 0;
 }
 
 void MqttProtocol::CloseAudioChannel() {
@@ -249,25 +275,27 @@ bool MqttProtocol::OpenAudioChannel() {
         }
         uint32_t timestamp = ntohl(*(uint32_t*)&data[8]);
         uint32_t sequence = ntohl(*(uint32_t*)&data[12]);
-        if (sequence < remote_sequence_) {
-            ESP_LOGW(TAG, "Received audio packet with old sequence: %lu, expected: %lu", sequence, remote_sequence_);
-            return;
-        }
-        if (sequence != remote_sequence_ + 1) {
-            ESP_LOGW(TAG, "Received audio packet with wrong sequence: %lu, expected: %lu", sequence, remote_sequence_ + 1);
-        }
+        // Out-of-order and duplicate packets are counted here and sorted out by the jitter buffer
+        receive_tracker_.Add(sequence, esp_timer_get_time());
 
-        size_t decrypted_size = data.size() - aes_nonce_.size();
+        /*
+         * The receive buffer is owned by the transport, so the payload is decrypted straight into
+         * a pooled packet in one pass. The counter block is updated by the cipher, it starts from
+         * a copy of the header.
+         */
+        size_t decrypted_size = data.size() - sizeof(aes_nonce_);
         size_t nc_off = 0;
         uint8_t stream_block[16] = {0};
-        auto nonce = (uint8_t*)data.data();
-        auto encrypted = (uint8_t*)data.data() + aes_nonce_.size();
-        auto packet = std::make_unique<AudioStreamPacket>();
+        uint8_t nonce_counter[16];
+        memcpy(nonce_counter, data.data(), sizeof(nonce_counter));
+        auto encrypted = (const uint8_t*)data.data() + sizeof(aes_nonce_);
+        auto packet = AcquireIncomingPacket();
         packet->sample_rate = server_sample_rate_;
         packet->frame_duration = server_frame_duration_;
         packet->timestamp = timestamp;
+        packet->sequence = sequence;
         packet->payload.resize(decrypted_size);
-        int ret = mbedtls_aes_crypt_ctr(&aes_ctx_, decrypted_size, &nc_off, nonce, stream_block, encrypted, (uint8_t*)packet->payload.data());
+        int ret = mbedtls_aes_crypt_ctr(&aes_ctx_, decrypted_size, &nc_off, nonce_counter, stream_block, encrypted, packet->payload.data());
         if (ret != 0) {
             ESP_LOGE(TAG, "Failed to decrypt audio data, ret: %d", ret);
             return;
@@ -275,7 +303,6 @@ bool MqttProtocol::OpenAudioChannel() {
         if (on_incoming_audio_ != nullptr) {
             on_incoming_audio_(std::move(packet));
         }
-        remote_sequence_ = sequence;
         last_incoming_time_ = std::chrono::steady_clock::now();
     });
 
@@ -299,12 +326,7 @@ std::string MqttProtocol::GetHelloMessage() {
 #endif
     cJSON_AddBoolToObject(features, "mcp", true);
     cJSON_AddItemToObject(root, "features", features);
-    cJSON* audio_params = cJSON_CreateObject();
-    cJSON_AddStringToObject(audio_params, "format", "opus");
-    cJSON_AddNumberToObject(audio_params, "sample_rate", 16000);
-    cJSON_AddNumberToObject(audio_params, "channels", 1);
-    cJSON_AddNumberToObject(audio_params, "frame_duration", OPUS_FRAME_DURATION_MS);
-    cJSON_AddItemToObject(root, "audio_params", audio_params);
+    cJSON_AddItemToObject(root, "audio_params", CreateHelloAudioParams());
     auto json_str = cJSON_PrintUnformatted(root);
     std::string message(json_str);
     cJSON_free(json_str);
@@ -325,18 +347,8 @@ void MqttProtocol::ParseServerHello(const cJSON* root) {
         ESP_LOGI(TAG, "Session ID: %s", session_id_.c_str());
     }
 
-    // Get sample rate from hello message
-    auto audio_params = cJSON_GetObjectItem(root, "audio_params");
-    if (cJSON_IsObject(audio_params)) {
-        auto sample_rate = cJSON_GetObjectItem(audio_params, "sample_rate");
-        if (cJSON_IsNumber(sample_rate)) {
-            server_sample_rate_ = sample_rate->valueint;
-        }
-        auto frame_duration = cJSON_GetObjectItem(audio_params, "frame_duration");
-        if (cJSON_IsNumber(frame_duration)) {
-            server_frame_duration_ = frame_duration->valueint;
-        }
-    }
+    // Get the audio parameters from hello message
+    ParseServerAudioParams(cJSON_GetObjectItem(root, "audio_params"));
 
     auto udp = cJSON_GetObjectItem(root, "udp");
     if (!cJSON_IsObject(udp)) {
@@ -350,11 +362,20 @@ void MqttProtocol::ParseServerHello(const cJSON* root) {
 
     // auto encryption = cJSON_GetObjectItem(udp, "encryption")->valuestring;
     // ESP_LOGI(TAG, "UDP server: %s, port: %d, encryption: %s", udp_server_.c_str(), udp_port_, encryption);
-    aes_nonce_ = DecodeHexString(nonce);
-    mbedtls_aes_init(&aes_ctx_);
-    mbedtls_aes_setkey_enc(&aes_ctx_, (const unsigned char*)DecodeHexString(key).c_str(), 128);
+    auto nonce_bytes = DecodeHexString(nonce);
+    auto key_bytes = DecodeHexString(key);
+    if (nonce_bytes.size() != sizeof(aes_nonce_) || key_bytes.size() != 16) {
+        ESP_LOGE(TAG, "Invalid UDP key or nonce");
+        return;
+    }
+    memcpy(aes_nonce_, nonce_bytes.data(), sizeof(aes_nonce_));
+    // The context stays keyed across sessions, it is only rekeyed when the server changes the key
+    if (key_bytes != aes_key_) {
+        mbedtls_aes_setkey_enc(&aes_ctx_, (const unsigned char*)key_bytes.data(), 128);
+        aes_key_ = std::move(key_bytes);
+    }
     local_sequence_ = 0;
-    remote_sequence_ = 0;
+    receive_tracker_.Reset(server_frame_duration_);
     xEventGroupSetBits(event_group_handle_, MQTT_PROTOCOL_SERVER_HELLO_EVENT);
 }
 
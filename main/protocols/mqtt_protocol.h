@@ -30,9 +30,13 @@ public:
 
     bool Start() override;
     bool SendAudio(std::unique_ptr<AudioStreamPacket> packet) override;
+    size_t SendAudioBatch(std::unique_ptr<AudioStreamPacket>* packets, size_t count) override;
     bool OpenAudioChannel() override;
     void CloseAudioChannel() override;
     bool IsAudioChannelOpened() const override;
+    bool HasAudioTransportStats() const override {
+        return true;
+    }
 
 private:
     // Alive flag for safe scheduled callbacks - set to false in destructor
@@ -45,12 +49,14 @@ private:
     std::mutex channel_mutex_;
     std::unique_ptr<Mqtt> mqtt_;
     std::unique_ptr<Udp> udp_;
+    // Keyed once per session key and kept, the cipher runs on the AES peripheral where there is one
     mbedtls_aes_context aes_ctx_;
-    std::string aes_nonce_;
+    std::string aes_key_;
+    uint8_t aes_nonce_[16] = {0};   // Header template of every audio datagram
+    std::string udp_send_buffer_;   // Reused for every audio datagram
     std::string udp_server_;
     int udp_port_;
     uint32_t local_sequence_;
-    uint32_t remote_sequence_;
     esp_timer_handle_t reconnect_timer_;
 
     bool StartMqttClient(bool report_error=false);
@@ -58,6 +64,7 @@ private:
     std::string DecodeHexString(const std::string& hex_string);
 
     bool SendText(const std::string& text) override;
+    bool SendAudioDatagram(const AudioStreamPacket& packet);
     std::string GetHelloMessage();
 };
 
@@ -1,6 +1,8 @@
 #include "protocol.h"
+#include "audio_frame_pool.h"
 
 #include <esp_log.h>
+#include <mbedtls/base64.h>
 
 #define TAG "Protocol"
 
@@ -32,6 +34,64 @@ void Protocol::OnDisconnected(std::function<void()> callback) {
     on_disconnected_ = callback;
 }
 
+void Protocol::SetPreferredAudioParams(const AudioStreamParams& params) {
+    preferred_audio_params_ = params;
+    audio_params_ = params;
+}
+
+static bool IsValidFrameDuration(int frame_duration) {
+    return frame_duration == 20 || frame_duration == 40 || frame_duration == 60;
+}
+
+cJSON* Protocol::CreateHelloAudioParams() {
+    // A new session starts from the preferred parameters until the server answers
+    audio_params_ = preferred_audio_params_;
+
+    cJSON* audio_params = cJSON_CreateObject();
+    cJSON_AddStringToObject(audio_params, "format", "opus");
+    cJSON_AddNumberToObject(audio_params, "sample_rate", 16000);
+    cJSON_AddNumberToObject(audio_params, "channels", 1);
+    cJSON_AddNumberToObject(audio_params, "frame_duration", audio_params_.frame_duration);
+    cJSON_AddNumberToObject(audio_params, "complexity", audio_params_.complexity);
+    return audio_params;
+}
+
+void Protocol::ParseServerAudioParams(const cJSON* audio_params) {
+    if (!cJSON_IsObject(audio_params)) {
+        return;
+    }
+
+    // Downlink stream
+    auto sample_rate = cJSON_GetObjectItem(audio_params, "sample_rate");
+    if (cJSON_IsNumber(sample_rate)) {
+        server_sample_rate_ = sample_rate->valueint;
+    }
+    auto frame_duration = cJSON_GetObjectItem(audio_params, "frame_duration");
+    if (cJSON_IsNumber(frame_duration)) {
+        server_frame_duration_ = frame_duration->valueint;
+    }
+
+    // Uplink stream, servers that do not send "uplink" accept what the device proposed
+    auto uplink = cJSON_GetObjectItem(audio_params, "uplink");
+    if (cJSON_IsObject(uplink)) {
+        frame_duration = cJSON_GetObjectItem(uplink, "frame_duration");
+        if (cJSON_IsNumber(frame_duration)) {
+            if (IsValidFrameDuration(frame_duration->valueint)) {
+                audio_params_.frame_duration = frame_duration->valueint;
+            } else {
+                ESP_LOGW(TAG, "Unsupported uplink frame duration: %d", frame_duration->valueint);
+            }
+        }
+        auto complexity = cJSON_GetObjectItem(uplink, "complexity");
+        if (cJSON_IsNumber(complexity) && complexity->valueint >= 0 && complexity->valueint <= 10) {
+            audio_params_.complexity = complexity->valueint;
+        }
+    }
+    ESP_LOGI(TAG, "Audio params: uplink %dms complexity %d, downlink %dHz %dms",
+        audio_params_.frame_duration, audio_params_.complexity,
+        server_sample_rate_, server_frame_duration_);
+}
+
 void Protocol::SetError(const std::string& message) {
     error_occurred_ = true;
     if (on_network_error_ != nullptr) {
@@ -39,6 +99,26 @@ void Protocol::SetError(const std::string& message) {
     }
 }
 
+void Protocol::SetIncomingPacketPool(AudioFramePool* pool) {
+    incoming_packet_pool_ = pool;
+}
+
+std::unique_ptr<AudioStreamPacket> Protocol::AcquireIncomingPacket() {
+    if (incoming_packet_pool_ != nullptr) {
+        return incoming_packet_pool_->AcquirePacket();
+    }
+    return std::make_unique<AudioStreamPacket>();
+}
+
+size_t Protocol::SendAudioBatch(std::unique_ptr<AudioStreamPacket>* packets, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        if (!SendAudio(std::move(packets[i]))) {
+            return i;
+        }
+    }
+    return count;
+}
+
 void Protocol::SendAbortSpeaking(AbortReason reason) {
     std::string message = "{\"session_id\":\"" + session_id_ + "\",\"type\":\"abort\"";
     if (reason == kAbortReasonWakeWordDetected) {
@@ -74,8 +154,63 @@ void Protocol::SendStopListening() {
 }
 
 void Protocol::SendMcpMessage(const std::string& payload) {
-    std::string message = "{\"session_id\":\"" + session_id_ + "\",\"type\":\"mcp\",\"payload\":" + payload + "}";
-    SendText(message);
+    SendText(CreateMcpEnvelope(payload));
+}
+
+bool Protocol::SendMcpAttachment(const std::string& payload, const std::string& attachment) {
+    // Content items refer to the attachment by offset and size, they get the image as base64 instead
+    auto root = cJSON_Parse(payload.c_str());
+    auto result = cJSON_GetObjectItem(root, "result");
+    auto content = cJSON_GetObjectItem(result, "content");
+    cJSON* item = nullptr;
+    cJSON_ArrayForEach(item, content) {
+        auto reference = cJSON_GetObjectItem(item, "attachment");
+        auto offset = cJSON_GetObjectItem(reference, "offset");
+        auto size = cJSON_GetObjectItem(reference, "size");
+        auto mime_type = cJSON_GetObjectItem(item, "mimeType");
+        if (!cJSON_IsNumber(offset) || !cJSON_IsNumber(size) || !cJSON_IsString(mime_type) ||
+            offset->valuedouble < 0 || size->valuedouble < 0 || offset->valuedouble + size->valuedouble > attachment.size()) {
+            continue;
+        }
+        auto data = (const unsigned char*)attachment.data() + (size_t)offset->valuedouble;
+        size_t data_size = size->valuedouble;
+        size_t base64_size = 0;
+        mbedtls_base64_encode(nullptr, 0, &base64_size, data, data_size);
+        std::string base64(base64_size, 0);
+        mbedtls_base64_encode((unsigned char*)base64.data(), base64.size(), &base64_size, data, data_size);
+        base64.resize(base64_size);
+
+        cJSON* image = cJSON_CreateObject();
+        cJSON_AddStringToObject(image, "type", "image");
+        cJSON_AddStringToObject(image, "mimeType", mime_type->valuestring);
+        cJSON_AddStringToObject(image, "data", base64.c_str());
+        auto image_str = cJSON_PrintUnformatted(image);
+        cJSON_AddStringToObject(item, "image", image_str);
+        cJSON_free(image_str);
+        cJSON_Delete(image);
+        cJSON_DeleteItemFromObject(item, "attachment");
+        cJSON_DeleteItemFromObject(item, "mimeType");
+    }
+    auto json_str = cJSON_PrintUnformatted(root);
+    cJSON_Delete(root);
+    if (json_str == nullptr) {
+        ESP_LOGE(TAG, "Invalid MCP message with a %u byte attachment", (unsigned)attachment.size());
+        return false;
+    }
+    std::string message(json_str);
+    cJSON_free(json_str);
+    return SendText(CreateMcpEnvelope(message));
+}
+
+std::string Protocol::CreateMcpEnvelope(const std::string& payload) {
+    std::string message;
+    message.reserve(session_id_.size() + payload.size() + 48);
+    message += "{\"session_id\":\"";
+    message += session_id_;
+    message += "\",\"type\":\"mcp\",\"payload\":";
+    message += payload;
+    message += "}";
+    return message;
 }
 
 bool Protocol::IsTimeout() const {
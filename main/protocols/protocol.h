@@ -6,17 +6,48 @@
 #include <functional>
 #include <chrono>
 #include <vector>
+#include <memory>
+
+#include "audio_sequence_tracker.h"
+
+class AudioFramePool;
+
+// Room the encoder leaves in front of uplink Opus data, enough for any transport header
+#define AUDIO_PACKET_HEADROOM 16
 
 struct AudioStreamPacket {
     int sample_rate = 0;
     int frame_duration = 0;
     uint32_t timestamp = 0;
+    uint32_t sequence = 0;  // Transport sequence number, 0 if the protocol has none
+    // The first headroom bytes of payload are reserved for the transport header, the Opus data
+    // follows them. SendAudio() fills the header in place instead of copying the packet.
+    uint16_t headroom = 0;
+    int64_t enqueue_time_us = 0;    // When the packet entered the send queue
     std::vector<uint8_t> payload;
+    // Set when the packet comes from an AudioFramePool, deleting the packet returns it to the pool
+    AudioFramePool* pool = nullptr;
+};
+
+namespace std {
+template <>
+struct default_delete<AudioStreamPacket> {
+    void operator()(AudioStreamPacket* packet) const;
+};
+}
+
+/*
+ * Uplink Opus parameters for one audio session. The device proposes them in the hello
+ * audio_params, and the server may override them in "uplink" of its hello reply.
+ */
+struct AudioStreamParams {
+    int frame_duration = 60;    // 20, 40 or 60 ms
+    int complexity = 0;         // Opus complexity, 0-10
 };
 
 struct BinaryProtocol2 {
     uint16_t version;
-    uint16_t type;          // Message type (0: OPUS, 1: JSON)
+    uint16_t type;          // Message type (0: OPUS, 1: JSON, 2: MCP with attachments)
     uint32_t reserved;      // Reserved for future use
     uint32_t timestamp;     // Timestamp in milliseconds (used for server-side AEC)
     uint32_t payload_size;  // Payload size in bytes
@@ -30,6 +61,16 @@ struct BinaryProtocol3 {
     uint8_t payload[];
 } __attribute__((packed));
 
+static_assert(sizeof(BinaryProtocol2) <= AUDIO_PACKET_HEADROOM, "Headroom too small for BinaryProtocol2");
+
+/*
+ * BinaryProtocol2 payload of an MCP message with binary attachments:
+ * |header_size 4u|JSON message (header_size bytes)|attachment data|
+ * The JSON message is the same envelope as the text frame. Its content items refer to their
+ * data by "attachment": {"offset", "size"} within the attachment data instead of base64.
+ */
+#define BINARY_PROTOCOL_TYPE_MCP 2
+
 enum AbortReason {
     kAbortReasonNone,
     kAbortReasonWakeWordDetected
@@ -54,6 +95,26 @@ public:
     inline const std::string& session_id() const {
         return session_id_;
     }
+    // Uplink parameters negotiated in the last hello exchange
+    inline const AudioStreamParams& audio_params() const {
+        return audio_params_;
+    }
+    // Whether the server accepts MCP messages with binary attachments, from its hello
+    inline bool mcp_attachments() const {
+        return mcp_attachments_;
+    }
+    // Whether the transport feeds the receive statistics, false when it has no sequence numbers
+    virtual bool HasAudioTransportStats() const {
+        return false;
+    }
+    // Loss, reordering and jitter of the incoming audio in the current or last session
+    inline AudioTransportStats GetAudioTransportStats() const {
+        return receive_tracker_.GetStats();
+    }
+
+    void SetPreferredAudioParams(const AudioStreamParams& params);
+    // Incoming audio packets are taken from this pool, the pool must outlive the packets
+    void SetIncomingPacketPool(AudioFramePool* pool);
 
     void OnIncomingAudio(std::function<void(std::unique_ptr<AudioStreamPacket> packet)> callback);
     void OnIncomingJson(std::function<void(const cJSON* root)> callback);
@@ -68,11 +129,18 @@ public:
     virtual void CloseAudioChannel() = 0;
     virtual bool IsAudioChannelOpened() const = 0;
     virtual bool SendAudio(std::unique_ptr<AudioStreamPacket> packet) = 0;
+    // Sends the packets in order and returns how many were sent, stopping at the first failure
+    virtual size_t SendAudioBatch(std::unique_ptr<AudioStreamPacket>* packets, size_t count);
     virtual void SendWakeWordDetected(const std::string& wake_word);
     virtual void SendStartListening(ListeningMode mode);
     virtual void SendStopListening();
     virtual void SendAbortSpeaking(AbortReason reason);
     virtual void SendMcpMessage(const std::string& message);
+    /*
+     * Sends an MCP message with its attachment data. The default embeds the attachment in the
+     * message as base64, transports that carry binary attachments override it.
+     */
+    virtual bool SendMcpAttachment(const std::string& message, const std::string& attachment);
 
 protected:
     std::function<void(const cJSON* root)> on_incoming_json_;
@@ -85,11 +153,21 @@ protected:
 
     int server_sample_rate_ = 24000;
     int server_frame_duration_ = 60;
+    AudioStreamParams preferred_audio_params_;
+    AudioStreamParams audio_params_;
     bool error_occurred_ = false;
+    bool mcp_attachments_ = false;
     std::string session_id_;
+    AudioFramePool* incoming_packet_pool_ = nullptr;
+    // Fed by the protocols whose audio packets carry sequence numbers
+    AudioSequenceTracker receive_tracker_;
     std::chrono::time_point<std::chrono::steady_clock> last_incoming_time_;
 
     virtual bool SendText(const std::string& text) = 0;
+    std::unique_ptr<AudioStreamPacket> AcquireIncomingPacket();
+    cJSON* CreateHelloAudioParams();
+    std::string CreateMcpEnvelope(const std::string& payload);
+    void ParseServerAudioParams(const cJSON* audio_params);
     virtual void SetError(const std::string& message);
     virtual bool IsTimeout() const;
 };
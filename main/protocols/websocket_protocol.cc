@@ -5,6 +5,7 @@
 #include "settings.h"
 
 #include <cstring>
+#include <algorithm>
 #include <cJSON.h>
 #include <esp_log.h>
 #include <arpa/inet.h>
@@ -26,57 +27,104 @@ bool WebsocketProtocol::Start() {
 }
 
 bool WebsocketProtocol::SendAudio(std::unique_ptr<AudioStreamPacket> packet) {
+    std::lock_guard<std::mutex> lock(channel_mutex_);
     if (websocket_ == nullptr || !websocket_->IsConnected()) {
         return false;
     }
 
+    size_t header_size = 0;
     if (version_ == 2) {
-        std::string serialized;
-        serialized.resize(sizeof(BinaryProtocol2) + packet->payload.size());
-        auto bp2 = (BinaryProtocol2*)serialized.data();
+        header_size = sizeof(BinaryProtocol2);
+    } else if (version_ == 3) {
+        header_size = sizeof(BinaryProtocol3);
+    }
+    if (packet->headroom < header_size) {
+        // Packets from outside the encoder (e.g. wake word audio) have no headroom yet
+        packet->payload.insert(packet->payload.begin(), header_size - packet->headroom, 0);
+        packet->headroom = header_size;
+    }
+
+    // Build the frame header right in front of the Opus data, in the packet's own buffer
+    uint8_t* payload = packet->payload.data() + packet->headroom;
+    size_t payload_size = packet->payload.size() - packet->headroom;
+    uint8_t* frame = payload - header_size;
+    if (version_ == 2) {
+        auto bp2 = (BinaryProtocol2*)frame;
         bp2->version = htons(version_);
         bp2->type = 0;
         bp2->reserved = 0;
         bp2->timestamp = htonl(packet->timestamp);
-        bp2->payload_size = htonl(packet->payload.size());
-        memcpy(bp2->payload, packet->payload.data(), packet->payload.size());
-
-        return websocket_->Send(serialized.data(), serialized.size(), true);
+        bp2->payload_size = htonl(payload_size);
     } else if (version_ == 3) {
-        std::string serialized;
-        serialized.resize(sizeof(BinaryProtocol3) + packet->payload.size());
-        auto bp3 = (BinaryProtocol3*)serialized.data();
+        auto bp3 = (BinaryProtocol3*)frame;
         bp3->type = 0;
         bp3->reserved = 0;
-        bp3->payload_size = htons(packet->payload.size());
-        memcpy(bp3->payload, packet->payload.data(), packet->payload.size());
-
-        return websocket_->Send(serialized.data(), serialized.size(), true);
-    } else {
-        return websocket_->Send(packet->payload.data(), packet->payload.size(), true);
+        bp3->payload_size = htons(payload_size);
     }
+    return websocket_->Send(frame, header_size + payload_size, true);
 }
 
-bool WebsocketProtocol::SendText(const std::string& text) {
+bool WebsocketProtocol::SendMcpAttachment(const std::string& message, const std::string& attachment) {
+    // BinaryProtocol3 sizes are 16 bits, too small for images
+    if (!mcp_attachments_ || version_ != 2) {
+        return Protocol::SendMcpAttachment(message, attachment);
+    }
+
+    auto envelope = CreateMcpEnvelope(message);
+    size_t header_size = sizeof(BinaryProtocol2) + sizeof(uint32_t);
+    std::string header(header_size, 0);
+    auto bp2 = (BinaryProtocol2*)header.data();
+    bp2->version = htons(version_);
+    bp2->type = htons(BINARY_PROTOCOL_TYPE_MCP);
+    bp2->reserved = 0;
+    bp2->timestamp = 0;
+    bp2->payload_size = htonl(sizeof(uint32_t) + envelope.size() + attachment.size());
+    *(uint32_t*)&header[sizeof(BinaryProtocol2)] = htonl(envelope.size());
+    header += envelope;
+
+    // The attachment goes out as a continuation frame of the same message, it is never copied.
+    // No audio frame may go out between the two, so the channel stays locked across both.
+    std::lock_guard<std::mutex> lock(channel_mutex_);
     if (websocket_ == nullptr || !websocket_->IsConnected()) {
         return false;
     }
-
-    if (!websocket_->Send(text)) {
-        ESP_LOGE(TAG, "Failed to send text: %s", text.c_str());
+    if (!websocket_->Send(header.data(), header.size(), true, false) ||
+        !websocket_->Send(attachment.data(), attachment.size(), true, true)) {
+        ESP_LOGE(TAG, "Failed to send MCP attachment of %u bytes", (unsigned)attachment.size());
         SetError(Lang::Strings::SERVER_ERROR);
         return false;
     }
-
     return true;
 }
 
+bool WebsocketProtocol::SendText(const std::string& text) {
+    {
+        std::lock_guard<std::mutex> lock(channel_mutex_);
+        if (websocket_ == nullptr || !websocket_->IsConnected()) {
+            return false;
+        }
+        if (websocket_->Send(text)) {
+            return true;
+        }
+    }
+
+    ESP_LOGE(TAG, "Failed to send text: %s", text.c_str());
+    SetError(Lang::Strings::SERVER_ERROR);
+    return false;
+}
+
 bool WebsocketProtocol::IsAudioChannelOpened() const {
     return websocket_ != nullptr && websocket_->IsConnected() && !error_occurred_ && !IsTimeout();
 }
 
 void WebsocketProtocol::CloseAudioChannel() {
-    websocket_.reset();
+    std::unique_ptr<WebSocket> websocket;
+    {
+        std::lock_guard<std::mutex> lock(channel_mutex_);
+        websocket = std::move(websocket_);
+    }
+    // Closed outside the lock, so a sender never waits for the disconnect
+    websocket.reset();
 }
 
 bool WebsocketProtocol::OpenAudioChannel() {
@@ -90,9 +138,11 @@ bool WebsocketProtocol::OpenAudioChannel() {
 
     error_occurred_ = false;
 
+    // The new connection is set up aside and only swapped in once it is connected
+    CloseAudioChannel();
     auto network = Board::GetInstance().GetNetwork();
-    websocket_ = network->CreateWebSocket(1);
-    if (websocket_ == nullptr) {
+    auto websocket = network->CreateWebSocket(1);
+    if (websocket == nullptr) {
         ESP_LOGE(TAG, "Failed to create websocket");
         return false;
     }
@@ -102,38 +152,43 @@ bool WebsocketProtocol::OpenAudioChannel() {
         if (token.find(" ") == std::string::npos) {
             token = "Bearer " + token;
         }
-        websocket_->SetHeader("Authorization", token.c_str());
+        websocket->SetHeader("Authorization", token.c_str());
     }
-    websocket_->SetHeader("Protocol-Version", std::to_string(version_).c_str());
-    websocket_->SetHeader("Device-Id", SystemInfo::GetMacAddress().c_str());
-    websocket_->SetHeader("Client-Id", Board::GetInstance().GetUuid().c_str());
+    websocket->SetHeader("Protocol-Version", std::to_string(version_).c_str());
+    websocket->SetHeader("Device-Id", SystemInfo::GetMacAddress().c_str());
+    websocket->SetHeader("Client-Id", Board::GetInstance().GetUuid().c_str());
 
-    websocket_->OnData([this](const char* data, size_t len, bool binary) {
+    websocket->OnData([this](const char* data, size_t len, bool binary) {
         if (binary) {
             if (on_incoming_audio_ != nullptr) {
+                // The headers are read into locals, the receive buffer is left untouched
                 if (version_ == 2) {
-                    BinaryProtocol2* bp2 = (BinaryProtocol2*)data;
-                    bp2->version = ntohs(bp2->version);
-                    bp2->type = ntohs(bp2->type);
-                    bp2->timestamp = ntohl(bp2->timestamp);
-                    bp2->payload_size = ntohl(bp2->payload_size);
-                    auto payload = (uint8_t*)bp2->payload;
+                    if (len < sizeof(BinaryProtocol2)) {
+                        ESP_LOGE(TAG, "Invalid audio frame size: %u", len);
+                        return;
+                    }
+                    auto bp2 = (const BinaryProtocol2*)data;
+                    uint32_t payload_size = std::min<size_t>(ntohl(bp2->payload_size), len - sizeof(BinaryProtocol2));
+                    auto payload = (const uint8_t*)bp2->payload;
                     on_incoming_audio_(std::make_unique<AudioStreamPacket>(AudioStreamPacket{
                         .sample_rate = server_sample_rate_,
                         .frame_duration = server_frame_duration_,
-                        .timestamp = bp2->timestamp,
-                        .payload = std::vector<uint8_t>(payload, payload + bp2->payload_size)
+                        .timestamp = ntohl(bp2->timestamp),
+                        .payload = std::vector<uint8_t>(payload, payload + payload_size)
                     }));
                 } else if (version_ == 3) {
-                    BinaryProtocol3* bp3 = (BinaryProtocol3*)data;
-                    bp3->type = bp3->type;
-                    bp3->payload_size = ntohs(bp3->payload_size);
-                    auto payload = (uint8_t*)bp3->payload;
+                    if (len < sizeof(BinaryProtocol3)) {
+                        ESP_LOGE(TAG, "Invalid audio frame size: %u", len);
+                        return;
+                    }
+                    auto bp3 = (const BinaryProtocol3*)data;
+                    uint16_t payload_size = std::min<size_t>(ntohs(bp3->payload_size), len - sizeof(BinaryProtocol3));
+                    auto payload = (const uint8_t*)bp3->payload;
                     on_incoming_audio_(std::make_unique<AudioStreamPacket>(AudioStreamPacket{
                         .sample_rate = server_sample_rate_,
                         .frame_duration = server_frame_duration_,
                         .timestamp = 0,
-                        .payload = std::vector<uint8_t>(payload, payload + bp3->payload_size)
+                        .payload = std::vector<uint8_t>(payload, payload + payload_size)
                     }));
                 } else {
                     on_incoming_audio_(std::make_unique<AudioStreamPacket>(AudioStreamPacket{
@@ -164,7 +219,7 @@ bool WebsocketProtocol::OpenAudioChannel() {
         last_incoming_time_ = std::chrono::steady_clock::now();
     });
 
-    websocket_->OnDisconnected([this]() {
+    websocket->OnDisconnected([this]() {
         ESP_LOGI(TAG, "Websocket disconnected");
         if (on_audio_channel_closed_ != nullptr) {
             on_audio_channel_closed_();
@@ -172,11 +227,15 @@ bool WebsocketProtocol::OpenAudioChannel() {
     });
 
     ESP_LOGI(TAG, "Connecting to websocket server: %s with version: %d", url.c_str(), version_);
-    if (!websocket_->Connect(url.c_str())) {
-        ESP_LOGE(TAG, "Failed to connect to websocket server, code=%d", websocket_->GetLastError());
+    if (!websocket->Connect(url.c_str())) {
+        ESP_LOGE(TAG, "Failed to connect to websocket server, code=%d", websocket->GetLastError());
         SetError(Lang::Strings::SERVER_NOT_CONNECTED);
         return false;
     }
+    {
+        std::lock_guard<std::mutex> lock(channel_mutex_);
+        websocket_ = std::move(websocket);
+    }
 
     // Send hello message to describe the client
     auto message = GetHelloMessage();
@@ -200,7 +259,7 @@ bool WebsocketProtocol::OpenAudioChannel() {
 }
 
 std::string WebsocketProtocol::GetHelloMessage() {
-    // keys: message type, version, audio_params (format, sample_rate, channels)
+    // keys: message type, version, audio_params (format, sample_rate, channels, frame_duration, complexity)
     cJSON* root = cJSON_CreateObject();
     cJSON_AddStringToObject(root, "type", "hello");
     cJSON_AddNumberToObject(root, "version", version_);
@@ -209,14 +268,12 @@ std::string WebsocketProtocol::GetHelloMessage() {
     cJSON_AddBoolToObject(features, "aec", true);
 #endif
     cJSON_AddBoolToObject(features, "mcp", true);
+    if (version_ == 2) {
+        cJSON_AddBoolToObject(features, "mcp_attachments", true);
+    }
     cJSON_AddItemToObject(root, "features", features);
     cJSON_AddStringToObject(root, "transport", "websocket");
-    cJSON* audio_params = cJSON_CreateObject();
-    cJSON_AddStringToObject(audio_params, "format", "opus");
-    cJSON_AddNumberToObject(audio_params, "sample_rate", 16000);
-    cJSON_AddNumberToObject(audio_params, "channels", 1);
-    cJSON_AddNumberToObject(audio_params, "frame_duration", OPUS_FRAME_DURATION_MS);
-    cJSON_AddItemToObject(root, "audio_params", audio_params);
+    cJSON_AddItemToObject(root, "audio_params", CreateHelloAudioParams());
     auto json_str = cJSON_PrintUnformatted(root);
     std::string message(json_str);
     cJSON_free(json_str);
@@ -237,17 +294,12 @@ void WebsocketProtocol::ParseServerHello(const cJSON* root) {
         ESP_LOGI(TAG, "Session ID: %s", session_id_.c_str());
     }
 
-    auto audio_params = cJSON_GetObjectItem(root, "audio_params");
-    if (cJSON_IsObject(audio_params)) {
-        auto sample_rate = cJSON_GetObjectItem(audio_params, "sample_rate");
-        if (cJSON_IsNumber(sample_rate)) {
-            server_sample_rate_ = sample_rate->valueint;
-        }
-        auto frame_duration = cJSON_GetObjectItem(audio_params, "frame_duration");
-        if (cJSON_IsNumber(frame_duration)) {
-            server_frame_duration_ = frame_duration->valueint;
-        }
-    }
+    ParseServerAudioParams(cJSON_GetObjectItem(root, "audio_params"));
+
+    // Binary MCP frames are only used when the server says it understands them
+    auto features = cJSON_GetObjectItem(root, "features");
+    auto mcp_attachments = cJSON_IsObject(features) ? cJSON_GetObjectItem(features, "mcp_attachments") : nullptr;
+    mcp_attachments_ = version_ == 2 && cJSON_IsTrue(mcp_attachments);
 
     xEventGroupSetBits(event_group_handle_, WEBSOCKET_PROTOCOL_SERVER_HELLO_EVENT);
 }
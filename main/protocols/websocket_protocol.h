@@ -8,6 +8,8 @@
 #include <freertos/FreeRTOS.h>
 #include <freertos/event_groups.h>
 
+#include <mutex>
+
 #define WEBSOCKET_PROTOCOL_SERVER_HELLO_EVENT (1 << 0)
 
 class WebsocketProtocol : public Protocol {
@@ -20,9 +22,12 @@ public:
     bool OpenAudioChannel() override;
     void CloseAudioChannel() override;
     bool IsAudioChannelOpened() const override;
+    bool SendMcpAttachment(const std::string& message, const std::string& attachment) override;
 
 private:
     EventGroupHandle_t event_group_handle_;
+    // Held by every write and while websocket_ is replaced, audio is sent from its own task
+    std::mutex channel_mutex_;
     std::unique_ptr<WebSocket> websocket_;
     int version_ = 1;
 
@@ -8,6 +8,7 @@ import shutil
 import math
 import sys
 import time
+import zlib
 import numpy as np
 import importlib
 import subprocess
@@ -56,6 +57,32 @@ def compute_checksum(data):
     checksum = sum(data) & 0xFFFF
     return checksum
 
+def compute_crc32(data):
+    return zlib.crc32(data) & 0xFFFFFFFF
+
+def create_checksum_trailer(combined_data, asset_crcs):
+    """
+    CRC32 trailer appended after the data. Firmware that knows it verifies the pack with the CRC32
+    and each asset on first use, older firmware only reads the 16-bit checksum in the header.
+    """
+    trailer = bytearray(b'ZZCK')
+    trailer.extend((1).to_bytes(4, byteorder='little'))
+    trailer.extend(len(combined_data).to_bytes(4, byteorder='little'))
+    trailer.extend(compute_crc32(combined_data).to_bytes(4, byteorder='little'))
+    for crc in asset_crcs:
+        trailer.extend(crc.to_bytes(4, byteorder='little'))
+    return trailer
+
+def table_name(file_name, max_name_len):
+    return file_name.ljust(max_name_len, '\0')[:max_name_len].encode('utf-8')
+
+def sort_table(file_info_list, asset_crcs, max_name_len):
+    """
+    The firmware finds assets by binary search over the table, so it is sorted by the stored name bytes.
+    """
+    entries = sorted(zip(file_info_list, asset_crcs), key=lambda entry: table_name(entry[0][0], max_name_len).rstrip(b'\0'))
+    return [info for info, _ in entries], [crc for _, crc in entries]
+
 def sort_key(filename):
     basename, extension = os.path.splitext(filename)
     return extension, basename
@@ -401,6 +428,7 @@ def pack_assets(config: PackModelsConfig):
 
     merged_data = bytearray()
     file_info_list = []
+    asset_crcs = []
     skip_files = ['config.json', 'lvgl_image_converter']
 
     file_list = sorted(os.listdir(target_path), key=sort_key)
@@ -437,15 +465,16 @@ def pack_assets(config: PackModelsConfig):
             bin_data = bin_file.read()
 
         merged_data.extend(bin_data)
+        asset_crcs.append(compute_crc32(bin_data))
 
     total_files = len(file_info_list)
+    file_info_list, asset_crcs = sort_table(file_info_list, asset_crcs, int(max_name_len))
 
     mmap_table = bytearray()
     for file_name, offset, file_size, width, height in file_info_list:
         if len(file_name) > int(max_name_len):
             print(f'\033[1;33mWarn:\033[0m "{file_name}" exceeds {max_name_len} bytes and will be truncated.')
-        fixed_name = file_name.ljust(int(max_name_len), '\0')[:int(max_name_len)]
-        mmap_table.extend(fixed_name.encode('utf-8'))
+        mmap_table.extend(table_name(file_name, int(max_name_len)))
         mmap_table.extend(file_size.to_bytes(4, byteorder='little'))
         mmap_table.extend(offset.to_bytes(4, byteorder='little'))
         mmap_table.extend(width.to_bytes(2, byteorder='little'))
@@ -456,6 +485,8 @@ def pack_assets(config: PackModelsConfig):
     combined_data_length = len(combined_data).to_bytes(4, byteorder='little')
     header_data = total_files.to_bytes(4, byteorder='little') + combined_checksum.to_bytes(4, byteorder='little')
     final_data = header_data + combined_data_length + combined_data
+    final_data += b'\0' * (-len(final_data) % 4)
+    final_data += create_checksum_trailer(combined_data, asset_crcs)
 
     with open(out_file, 'wb') as output_bin:
         output_bin.write(final_data)